@@ -13,31 +13,145 @@
 #include <unistd.h>
 #include <string.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 
 #include "tau.h"
 #include "tau-utils.h"
+#include "tau-private.h"
+
+/***************************************************************************
+ * Handle state
+ ***************************************************************************/
+
+/* tauHandler is the file descriptor, so the link state is indexed by fd.
+ * Threads using shared handles look links up without taking the lock, so
+ * an outgrown table is kept: a thread may still be reading it.  Together
+ * the old tables are smaller than the current one */
+static struct tauLink **tau_links;
+static int tau_links_size;
+static pthread_mutex_t tau_links_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct tauLink *tauLinkGet(tauHandler handler)
+{
+	int fd = tauFd(handler);
+	struct tauLink *link;
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	/* The table is published before its size */
+	if (fd < __atomic_load_n(&tau_links_size, __ATOMIC_ACQUIRE)) {
+		link = __atomic_load_n(&__atomic_load_n(&tau_links, __ATOMIC_ACQUIRE)[fd],
+				       __ATOMIC_ACQUIRE);
+		if (link) {
+			return link;
+		}
+	}
+
+	pthread_mutex_lock(&tau_links_lock);
+
+	if (fd >= tau_links_size) {
+		int size = tau_links_size ? tau_links_size : 16;
+		struct tauLink **links;
+
+		while (size <= fd) {
+			size *= 2;
+		}
+		links = calloc(size, sizeof(*links));
+		if (!links) {
+			fprintf(stderr,"%s: failed to allocate handle table\n",__FUNCTION__);
+			pthread_mutex_unlock(&tau_links_lock);
+			return NULL;
+		}
+		if (tau_links_size) {
+			memcpy(links, tau_links, tau_links_size * sizeof(*links));
+		}
+		__atomic_store_n(&tau_links, links, __ATOMIC_RELEASE);
+		__atomic_store_n(&tau_links_size, size, __ATOMIC_RELEASE);
+	}
+
+	if (!tau_links[fd]) {
+		link = calloc(1, sizeof(struct tauLink));
+		if (!link) {
+			fprintf(stderr,"%s: failed to allocate handle state\n",__FUNCTION__);
+			pthread_mutex_unlock(&tau_links_lock);
+			return NULL;
+		}
+		link->fd = fd;
+		__atomic_store_n(&tau_links[fd], link, __ATOMIC_RELEASE);
+	}
+	link = tau_links[fd];
+
+	pthread_mutex_unlock(&tau_links_lock);
+	return link;
+}
+
+/** Releases the state associated with a handler, if any
+ * \param handler a tau handler used to exchange data with a Tau camera
+ */
+static void tauLinkFree(tauHandler handler)
+{
+	int fd = tauFd(handler);
+
+	if ((fd >= 0) && (fd < tau_links_size)) {
+		if (tau_links[fd]) {
+			tauShareStop(tau_links[fd]);
+			tauAsyncCancel(tau_links[fd], CAM_COMMUNICATION_ERROR);
+			tauTimeoutFree(tau_links[fd]);
+			tauCacheFree(tau_links[fd]);
+			tauStatsFree(tau_links[fd]);
+			tauTraceFree(tau_links[fd]);
+		}
+		pthread_mutex_lock(&tau_links_lock);
+		free(tau_links[fd]);
+		tau_links[fd] = NULL;
+		pthread_mutex_unlock(&tau_links_lock);
+	}
+}
 
-#define TAU_HEADER_SIZE 8
 
 /***************************************************************************
  * Communication routines
  ***************************************************************************/
 
 tauHandler tauOpenFromSerial(char *device)
+{
+	return tauOpenFromSerialAtRate(device, TAU_DEFAULT_BAUD_RATE);
+}
+
+
+tauHandler tauOpenFromSerialAtRate(char *device, long rate)
 {
 	int fd;
 	struct termios ios;
+	struct tauLink *link;
+	speed_t speed;
+
+	if (tauRateSpeed(rate, &speed) < 0) {
+		fprintf(stderr,"Unsupported baud rate: %ld\n", rate);
+		return -1;
+	}
 
 	fd = open(device, O_RDWR| O_NOCTTY);
 	if (fd < 0){
 		perror("Unable to open device");
-		return errno;
+		return -1;
 	}
 	if (tcgetattr(fd,&ios) < 0) {
 		perror("Unable to get serial device attributes");
-		return errno;
+		close(fd);
+		return -1;
 	}
 	/* CS8: 8n1 (8bit,no parity,1 stopbit)
 	 * CLOCAL  : local connection, no modem contol
@@ -46,31 +160,185 @@ tauHandler tauOpenFromSerial(char *device)
 	ios.c_iflag = IGNPAR;
 	ios.c_oflag = 0;
 	ios.c_lflag = 0;
+	/* Data is only read after poll() reports it, so have read() return
+	 * whatever has arrived instead of waiting for more */
+	ios.c_cc[VMIN] = 1;
+	ios.c_cc[VTIME] = 0;
 	tcflush(fd, TCIFLUSH);
 
-	/* Set to 57600 8N1 no flow control */
-	if (cfsetospeed(&ios, B57600) < 0 ) {
+	/* Set to the requested rate 8N1 no flow control */
+	if ((cfsetispeed(&ios, speed) < 0) || (cfsetospeed(&ios, speed) < 0)) {
 		perror("Unable to set baudrate");
-		return errno;
+		close(fd);
+		return -1;
 	}
 	if (tcsetattr(fd,TCSAFLUSH,&ios) < 0) {
 		perror("Unable to get serial device attributes");
-		return errno;
+		close(fd);
+		return -1;
+	}
+
+#ifdef ASYNC_LOW_LATENCY
+	{
+		/* Ask the UART driver to push received bytes up right away
+		 * rather than batching them; not every driver supports it */
+		struct serial_struct serial;
+
+		if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+			serial.flags |= ASYNC_LOW_LATENCY;
+			if (ioctl(fd, TIOCSSERIAL, &serial) < 0) {
+				vdbg("Unable to set low latency mode on %s", device);
+			}
+		}
 	}
+#endif
+
+	/* Drop state left behind by an earlier user of this descriptor */
+	tauLinkFree(fd);
+
+	/* Only serial ports can change rate */
+	link = tauLinkGet(fd);
+	if (link) {
+		link->baud = link->open_baud = rate;
+	}
+
 	return fd;
 }
 
 
 tauHandler tauOpenFromFd(int fd){
+	tauLinkFree(fd);
 	return (tauHandler)fd;
 }
 
 
+tauHandler tauOpenFromDaemon(const char *path)
+{
+	struct sockaddr_un addr;
+	struct tauRetryPolicy policy;
+	int fd;
+
+	if (!path) {
+		path = TAU_DAEMON_SOCKET;
+	}
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr,"Daemon socket path too long: %s\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("Unable to create daemon socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("Unable to connect to taud");
+		close(fd);
+		return -1;
+	}
+
+	tauOpenFromFd(fd);
+
+	/* taud retries what fails between it and the camera */
+	tauGetRetryPolicy(fd, &policy);
+	policy.attempts = 1;
+	tauSetRetryPolicy(fd, &policy);
+
+	return fd;
+}
+
+
 int tauFd(tauHandler handler)
 {
 	return (int) handler;
 }
 
+ssize_t tauLinkWritev(struct tauLink *link, const struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+	ssize_t len;
+
+	link->stats.syscalls++;
+
+	if (!link->net_addr_len) {
+		len = writev(link->fd, iov, iovcnt);
+	} else {
+		/* A peer that went away is an error to report, not a SIGPIPE */
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = (struct iovec *)iov;
+		msg.msg_iovlen = iovcnt;
+		len = sendmsg(link->fd, &msg, MSG_NOSIGNAL);
+	}
+
+	if (len > 0) {
+		link->stats.bytes_sent += len;
+		if (link->trace) {
+			tauTraceData(link, TAU_TRACE_TX, iov, len);
+		}
+	}
+	return len;
+}
+
+/** Writes a set of buffers to a Tau camera as one message, using as few
+ *  writev() calls as the descriptor allows
+ * \param link state of the handle to write to
+ * \param iov buffers to send, modified as they are sent
+ * \param iovcnt number of buffers
+ * \returns tauStatus indicating the outcome of the attempted data transmission
+ */
+static tauStatus tauWritev(struct tauLink *link, struct iovec *iov, int iovcnt)
+{
+	struct timespec deadline;
+	struct pollfd pfd;
+	ssize_t len;
+
+	tauDeadlineSet(&deadline, TAU_COMM_NORMAL_TIMEOUT);
+
+	while (iovcnt) {
+		len = tauLinkWritev(link, iov, iovcnt);
+
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN) {
+				perror("Unable to send message");
+				return CAM_COMMUNICATION_ERROR;
+			}
+
+			/* Non-blocking descriptor with a full output queue */
+			pfd.fd = link->fd;
+			pfd.events = POLLOUT;
+			link->stats.syscalls++;
+			if (poll(&pfd, 1, tauDeadlineRemaining(&deadline)) == 0) {
+				fprintf(stderr,"Unable to write all the bytes of the message\n");
+				return CAM_TIMEOUT_ERROR;
+			}
+			continue;
+		}
+
+		/* Skip what was sent, the last buffer may be partly sent */
+		while (iovcnt && (len >= (ssize_t)iov->iov_len)) {
+			len -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+
+	link->stats.frames_sent++;
+	return CAM_OK;
+}
+
 /** Sends a command packet to a Tau camera
  * \param handler used for camera data exchange
  * \param buffer holds the command packet data to send
@@ -79,104 +347,231 @@ int tauFd(tauHandler handler)
  */
 static tauStatus tauSendCmd(tauHandler handler, char *buffer, short bufferSize)
 {
-	tauStatus err;
-
-	if ((err = write(tauFd(handler),buffer,bufferSize)) != bufferSize) {
-		if (err < 0 ) {
-			perror("Unable to send message");
-			return err;
-		} else {
-			/* TODO, check for EAGAIN and send the rest */
-			fprintf(stderr,"Unable to write all the bytes of the message\n");
-			return err;
+	struct tauLink *link = tauLinkGet(handler);
+	struct iovec iov;
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	iov.iov_base = buffer;
+	iov.iov_len = bufferSize;
+
+	return tauWritev(link, &iov, 1);
+}
+
+void tauDeadlineSet(struct timespec *deadline, long msWait)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += msWait / 1000;
+	deadline->tv_nsec += (msWait % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+int tauDeadlineRemaining(const struct timespec *deadline)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+		(deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+
+	return ms > 0 ? ms : 0;
+}
+
+int tauReadRing(struct tauLink *link)
+{
+	struct iovec iov[2];
+	unsigned int start, space;
+	ssize_t len;
+
+	space = TAU_RX_RING_SIZE - (link->rx_tail - link->rx_head);
+	if (!space) {
+		return 0;
+	}
+
+	/* The free space may wrap around the end of the ring */
+	start = link->rx_tail & (TAU_RX_RING_SIZE - 1);
+	iov[0].iov_base = &link->rx_ring[start];
+	iov[0].iov_len = TAU_RX_RING_SIZE - start;
+	if (iov[0].iov_len > space) {
+		iov[0].iov_len = space;
+	}
+	iov[1].iov_base = link->rx_ring;
+	iov[1].iov_len = space - iov[0].iov_len;
+
+	link->stats.syscalls++;
+	len = readv(link->fd, iov, iov[1].iov_len ? 2 : 1);
+
+	if (len < 0) {
+		if ((errno == EINTR) || (errno == EAGAIN)) {
+			return 0;
 		}
+		perror("Unable to read from Tau camera");
+		return -1;
 	}
-	return CAM_OK;
+
+	if (len == 0) {
+		fprintf(stderr,"Tau camera connection closed\n");
+		return -1;
+	}
+
+	vdbg("Read %zd bytes", len);
+	link->rx_tail += len;
+	link->stats.bytes_received += len;
+	tauStatsMark(link, TAU_PHASE_FIRST_BYTE);
+	if (link->trace) {
+		tauTraceData(link, TAU_TRACE_RX, iov, len);
+	}
+
+	return len;
 }
 
-/** Reads a single character from a Tau camera
- * This function times out if no character is available.
- * \param handler used for camera data exchange
- * \param c character read from camera
- * \param msWait number of milliseconds to wait before returning timeout error
- * \returns tauStatus indicating the outcome of the attempted data read
- */
-static tauStatus tauReadChar(tauHandler handler, char *c, int msWait)
+tauStatus tauFillRing(struct tauLink *link, const struct timespec *deadline)
 {
-	struct timeval tv;
-	fd_set readfs;    /* file descriptor set */
-	int fd = tauFd(handler);
-	int len;
+	struct pollfd pfd;
 	int ret;
 
-	tv.tv_sec = msWait / 1000;
-	tv.tv_usec = (msWait % 1000) * 1000;
+	if (link->rx_tail - link->rx_head == TAU_RX_RING_SIZE) {
+		return CAM_OK;
+	}
 
-	FD_ZERO(&readfs);
-	FD_SET(fd, &readfs);
+	pfd.fd = link->fd;
+	pfd.events = POLLIN;
 
-	fflush(stdout);
-	ret = select(fd + 1, &readfs, NULL, NULL, &tv);
-	fflush(stdout);
+	do {
+		link->stats.syscalls++;
+		ret = poll(&pfd, 1, tauDeadlineRemaining(deadline));
+	} while ((ret < 0) && (errno == EINTR));
 
 	if (ret < 0) {
-		perror("Select() encountered an error\n");
+		perror("poll() encountered an error");
 		return CAM_COMMUNICATION_ERROR;
 	}
 
-	if (!FD_ISSET(fd, &readfs)) {
+	if (ret == 0) {
 		return CAM_TIMEOUT_ERROR;
 	}
 
-	len = read(fd, c, 1);
-	assert(len == 1);
-	fprintf(stderr, "Read: 0x%2.2X\n", *c);
+	if (tauReadRing(link) < 0) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
 	return CAM_OK;
 }
 
-/** Discards any stale data in the communication channel from tau camera
- * \param handler a tau handler used to exchange data with a Tau camera
- * \returns the status of attempted read
- */
-static tauStatus tauFlushReceivedData(tauHandler handler)
+unsigned int tauTakeRing(struct tauLink *link, char *buffer, unsigned int count)
 {
+	unsigned int start, chunk, available;
+	unsigned int len = 0;
+
+	available = link->rx_tail - link->rx_head;
+	if (available > count) {
+		available = count;
+	}
+
+	while (available) {
+		start = link->rx_head & (TAU_RX_RING_SIZE - 1);
+		chunk = TAU_RX_RING_SIZE - start;
+		if (chunk > available) {
+			chunk = available;
+		}
+		memcpy(&buffer[len], &link->rx_ring[start], chunk);
+		link->rx_head += chunk;
+		len += chunk;
+		available -= chunk;
+	}
+
+	return len;
+}
+
+int tauParseRing(struct tauLink *link, struct tauFrame *frame)
+{
+	unsigned int start, chunk, available;
+	unsigned int skipped = frame->skipped;
+	unsigned int resyncs = frame->resyncs;
+	int done = 0;
+
+	/* Parse in place, at most two contiguous pieces of the ring */
+	while ((available = link->rx_tail - link->rx_head)) {
+		start = link->rx_head & (TAU_RX_RING_SIZE - 1);
+		chunk = TAU_RX_RING_SIZE - start;
+		if (chunk > available) {
+			chunk = available;
+		}
+		link->rx_head += tauFrameParse(frame, &link->rx_ring[start], chunk);
+		if (frame->state == TAU_FRAME_DONE) {
+			link->stats.frames_received++;
+			done = 1;
+			break;
+		}
+	}
+
+	link->stats.noise_bytes += frame->skipped - skipped;
+	link->stats.resyncs += frame->resyncs - resyncs;
+
+	if (link->trace) {
+		tauTraceFrame(link, frame, skipped, resyncs, done);
+	}
+	return done;
+}
+
+void tauDiscardInput(struct tauLink *link, int msQuiet)
+{
+	struct timespec deadline;
 	tauStatus status = CAM_OK;
-	char data;
 
 	while (status == CAM_OK) {
-		status = tauReadChar(handler, &data, 10 );
+		link->rx_head = link->rx_tail;
+		tauDeadlineSet(&deadline, msQuiet);
+		status = tauFillRing(link, &deadline);
 
 		if ((status != CAM_OK) && (status != CAM_TIMEOUT_ERROR)) {
 			fprintf(stderr,"Error: unexpect problem tossing data from Tau: %d\n", status);
 		}
 	}
-	return CAM_OK;
+	link->stale = 0;
 }
 
-/** Receive specified number of bytes of data from a Tau camera
- * \param handler the handler for the Tau camera returned by tauOpen* functions
- * \param buffer holder for the received data
- * \param readAmount number of bytes to read
- * \param msWait number of milliseconds to wait before returning timeout error
+/** Discards any stale data in the communication channel from tau camera
+ * \param handler a tau handler used to exchange data with a Tau camera
  * \returns the status of attempted read
  */
-static int tauReadBinary(tauHandler handler, char *buffer, short readAmount, int msWait)
+static tauStatus tauFlushReceivedData(tauHandler handler)
 {
-	tauStatus status = CAM_OK;
-	int len = 0;
+	struct tauLink *link = tauLinkGet(handler);
 
-	while ((status == CAM_OK) && readAmount--) {
-		status = tauReadChar(handler, buffer++, msWait );
-		if (status == CAM_OK) {
-			len++;
-		}
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
 	}
-	return len;
-}
 
+	/* Noise and stray packets left in the line are skipped by the frame
+	 * parser, so only what has already arrived needs to go */
+	tauDiscardInput(link, 0);
+
+	return CAM_OK;
+}
 
 int tauClose(tauHandler handler)
 {
+	struct tauLink *link = tauLinkGet(handler);
+
+	/* The I/O thread of a shared handle is done before the rate changes */
+	if (link) {
+		tauShareStop(link);
+	}
+
+	/* Leave the camera at the rate the next user will expect */
+	if (link && (link->baud != link->open_baud) && !link->async_head) {
+		link->rate_control = 0;
+		tauSetBaudRate(handler, link->open_baud);
+	}
+
+	tauLinkFree(handler);
 	return close(tauFd(handler));
 }
 
@@ -184,228 +579,466 @@ int tauClose(tauHandler handler)
  * Packet handling routines
  ***************************************************************************/
 
+/** Runs the frame parser over received data until a packet answering cmd
+ *  is complete.  Packets answering other commands are late responses to
+ *  earlier requests and are skipped
+ * \param link state of the handle being read
+ * \param frame the parser, set up by tauFrameInit()
+ * \param cmd expected response command
+ * \param deadline absolute time after which to give up
+ * \returns CAM_OK once the packet is complete, or the error that ended the wait
+ */
+static tauStatus tauReceiveFrame(struct tauLink *link, struct tauFrame *frame, tauCmd cmd,
+				 const struct timespec *deadline)
+{
+	tauStatus status;
+
+	while (1) {
+		if (tauParseRing(link, frame)) {
+			if (frame->header[3] == (unsigned char)cmd) {
+				return CAM_OK;
+			}
+			dbg("Skipping response to command 0x%02X", frame->header[3]);
+			tauFrameRestart(frame);
+			continue;
+		}
+
+		status = tauFillRing(link, deadline);
+		if (status != CAM_OK) {
+			if (status == CAM_TIMEOUT_ERROR) {
+				fprintf(stderr,"Timeout waiting for response to command 0x%02X, %s\n", cmd,
+					frame->state == TAU_FRAME_SYNC ? "no packet" : "partial packet");
+			}
+			/* The rest of the packet may still arrive */
+			link->stale = 1;
+			return status;
+		}
+	}
+}
+
 /** Receive in a full packet, using the packet header data size value to know
  *  how much data to read
- * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param link state of the handle being read
+ * \param cmd expected response command
  * \param buffer holder for the data being received from the camera
  * \param bufferCount on entry indicates the buffer size, on exit contains the
  *        number of valid bytes of data in the buffer
- * \param msWait number of milliseconds to wait before returning timeout error
+ * \param msWait number of milliseconds to wait for the whole packet before
+ *        returning timeout error
  * \returns the status of attempted read
  */
-static tauStatus tauReceiveCmd(tauHandler handler, char *buffer, short *bufferCount, long msWait)
+static tauStatus tauReceiveCmd(struct tauLink *link, tauCmd cmd, char *buffer,
+			       short *bufferCount, long msWait)
 {
-	int len;
-	uint16_t *sptr;
-	short data_len;
+	struct timespec deadline;
+	struct tauFrame frame;
+	tauStatus status;
+
+	assert(*bufferCount >= TAU_HEADER_SIZE + TAU_CRC_SIZE);
 
-	assert(*bufferCount >= TAU_HEADER_SIZE);
+	/* The whole packet has to arrive within msWait */
+	tauDeadlineSet(&deadline, msWait);
 
-	len = tauReadBinary(handler,buffer,TAU_HEADER_SIZE, msWait);
+	/* The data lands in place, the header and crc are put around it */
+	tauFrameInit(&frame, &buffer[TAU_HEADER_SIZE],
+		     *bufferCount - TAU_HEADER_SIZE - TAU_CRC_SIZE);
 
-	if (len < 0 ) {
-		perror("Unable to receive response header");
+	status = tauReceiveFrame(link, &frame, cmd, &deadline);
+	if (status != CAM_OK) {
 		*bufferCount = 0;
-		return CAM_TIMEOUT_ERROR;
+		return status;
 	}
+	tauStatsMark(link, TAU_PHASE_LAST_BYTE);
 
-	if (len != TAU_HEADER_SIZE) {
-		/* TODO, check for EAGAIN and read in the rest */
-		fprintf(stderr,"Unable to receive all the bytes of the response header: %d/%d\n", len, TAU_HEADER_SIZE);
-		hexDump("Partial header", buffer, len);
+	if (!tauFrameIntact(&frame)) {
+		fprintf(stderr,"Packet received from Tau camera contains overall packet CRC error\n");
 		*bufferCount = 0;
-		return CAM_TIMEOUT_ERROR;
+		return CAM_CHECKSUM_ERROR;
 	}
+	link->rejected = frame.header[1] != CAM_OK;
 
-	sptr = (uint16_t *) &buffer[4];
-	data_len = ntohs(*sptr);
+	if (frame.data_len > frame.capacity) {
+		fprintf(stderr,"Response data does not fit in the receive buffer: %d/%d\n",
+			frame.data_len, frame.capacity);
+		*bufferCount = TAU_HEADER_SIZE;
+		return CAM_COMMUNICATION_ERROR;
+	}
 
-	assert ( * bufferCount >= (TAU_HEADER_SIZE + data_len + 2));
+	memcpy(buffer, frame.header, TAU_HEADER_SIZE);
+	memcpy(&buffer[TAU_HEADER_SIZE + frame.data_len], frame.trailer, TAU_CRC_SIZE);
+	*bufferCount = TAU_HEADER_SIZE + frame.data_len + TAU_CRC_SIZE;
+	tauStatsMark(link, TAU_PHASE_DECODE);
 
-	len = read(handler,&buffer[TAU_HEADER_SIZE],data_len + 2);
+	return CAM_OK;
+}
 
-	if (len < 0 ) {
+/** Fills in a packet header, header crc included
+ * \param cmd Tau camera command
+ * \param status value for the packet status byte
+ * \param header holder for the TAU_HEADER_SIZE header bytes
+ * \param dataSize number of data bytes that follow the header
+ * \returns the crc of the whole header, for the packet crc to continue from
+ */
+static unsigned short tauBuildHeader(tauCmd cmd, tauStatus status, char *header, unsigned short dataSize)
+{
+	uint16_t value;
+	unsigned short crc;
+
+	header[0] = 0x6E; /* process code */
+	header[1] = status;
+	header[2] = 0x00; /* reserved */
+	header[3] = cmd;
+	value = htons(dataSize); /* data byte count */
+	memcpy(&header[4], &value, sizeof(value));
+	crc = crcCcitt16(header, 6);
+	value = htons(crc); /* header crc */
+	memcpy(&header[6], &value, sizeof(value));
+
+	/* The packet crc covers the header crc as well */
+	return crcCcitt16Update(crc, &header[6], 2);
+}
 
-		fprintf(stderr,"Unable to receive response data: %d\n", len);
-		perror(NULL);
-		*bufferCount = TAU_HEADER_SIZE;
-		return CAM_TIMEOUT_ERROR;
+void tauBuildPacket(tauCmd cmd, tauStatus status, char *buffer, short *bufferCount, char *data, short dataSize)
+{
+	unsigned short crc;
+	uint16_t value;
+
+	if (!data) {
+		dataSize = 0;
 	}
 
-	if (len != data_len+2) {
-		/* TODO, check for EAGAIN and read in the rest */
-		fprintf(stderr,"Unable to receive all the bytes of response data: %d/%d\n", len, data_len+2);
-		*bufferCount = TAU_HEADER_SIZE;
-		return CAM_TIMEOUT_ERROR;
+	assert(*bufferCount >= TAU_HEADER_SIZE + dataSize + TAU_CRC_SIZE);
+
+	crc = tauBuildHeader(cmd, status, buffer, dataSize);
+	if (dataSize) {
+		memcpy(&buffer[TAU_HEADER_SIZE], data, dataSize);
+		crc = crcCcitt16Update(crc, data, dataSize);
 	}
+	value = htons(crc); /* header + data crc */
+	memcpy(&buffer[TAU_HEADER_SIZE + dataSize], &value, sizeof(value));
+	*bufferCount = TAU_HEADER_SIZE + dataSize + TAU_CRC_SIZE;
+}
 
-	*bufferCount = TAU_HEADER_SIZE + data_len + 2;
+void tauBuildRequest(tauCmd cmd, char *buffer, short *bufferCount, char *data, short dataSize)
+{
+	tauBuildPacket(cmd, CAM_OK, buffer, bufferCount, data, dataSize);
+}
 
-	return CAM_OK;
+/** Sends a request packet and receives the camera's response packet
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param request holds the request packet
+ * \param requestSize number of bytes in the request packet
+ * \param response holder for the response packet
+ * \param responseSize on entry indicates the response buffer size, on exit
+ *        contains the number of valid bytes in the response buffer
+ * \param msWait number of milliseconds to wait for the response
+ * \returns the status of the exchange
+ */
+static tauStatus tauTransact(tauHandler handler, char *request, short requestSize,
+			     char *response, short *responseSize, long msWait)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct timespec start;
+	tauStatus status;
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	/* Packets aren't passed to the I/O thread of a shared handle */
+	if (link->share) {
+		return CAM_BUSY;
+	}
+
+	/* The camera is busy with requests submitted by tauSubmitCmd() */
+	if (link->async_head) {
+		return CAM_BUSY;
+	}
+
+	/* Don't mistake the late answer to a failed request for this one */
+	if (link->stale) {
+		tauDiscardInput(link, 0);
+	}
+
+	link->rejected = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	/* The client built the packet */
+	tauStatsStart(link);
+	tauStatsMark(link, TAU_PHASE_BUILD);
+
+	status = tauSendCmd(handler, request, requestSize);
+	if (status == CAM_OK) {
+		tauStatsMark(link, TAU_PHASE_WRITE);
+		status = tauReceiveCmd(link, (unsigned char)request[3], response, responseSize, msWait);
+	}
+
+	tauTimeoutRecord(link, (unsigned char)request[3], status,
+			 requestSize - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+			 (status == CAM_OK) ? *responseSize - TAU_HEADER_SIZE - TAU_CRC_SIZE : 0,
+			 &start);
+	tauStatsRecord(link, (unsigned char)request[3], status);
+	tauTraceResult(link, (unsigned char)request[3], status);
+
+	if (status != CAM_OK) {
+		link->stale = 1;
+	}
+
+	return status;
 }
 
-/** Converts a Tau camera command and assoicated data into a packet with CRCs
+/** Sends a request packet straight from the caller's data: header, data and
+ *  crc go out in one writev() without being copied into a packet buffer
+ * \param link state of the handle
  * \param cmd Tau camera command
- * \param buffer to hold packet
- * \param bufferCount on entry indicates the buffer size, on exit contains the
- *        size of the packet (including the packet data) in bytes
- * \param data holds data to be included in the packet
- * \param dataCount number of data bytes in the data buffer
+ * \param input (optional, may be NULL) data included in the packet
+ * \param inputSize number of bytes of input
+ * \returns tauStatus indicating the outcome of the attempted data transmission
  */
-static void tauBuildRequest(tauCmd cmd, char *buffer, short *bufferCount, char *data, short dataSize)
+static tauStatus tauSendRequest(struct tauLink *link, tauCmd cmd, char *input, short inputSize)
 {
-	uint16_t *sptr;
+	char header[TAU_HEADER_SIZE];
+	char trailer[TAU_CRC_SIZE];
+	struct iovec iov[3];
+	unsigned short crc;
+	uint16_t value;
+	int iovcnt = 0;
+
+	if (!input) {
+		inputSize = 0;
+	}
 
-	assert(*bufferCount >= TAU_HEADER_SIZE + dataSize + 2);
-
-	buffer[0] = 0x6E; /* process code */
-	buffer[1] = CAM_OK; /* status */
-	buffer[2] = 0x00; /* reserved */
-	buffer[3] = cmd;
-	sptr = (uint16_t *)&buffer[4]; /* data byte count */
-	*sptr = htons(dataSize);
-	sptr = (uint16_t *)&buffer[6]; /* header crc */
-	*sptr = htons(crcCcitt16(buffer,6));
-	if (dataSize && data) {
-		memcpy(&buffer[8],data,dataSize);
-		sptr = (uint16_t *)&buffer[TAU_HEADER_SIZE + dataSize]; /* header + data crc */
-		*sptr = htons(crcCcitt16(buffer,TAU_HEADER_SIZE + dataSize));
-		*bufferCount = TAU_HEADER_SIZE + dataSize + 2;
-	} else {
-		sptr = (uint16_t *)&buffer[TAU_HEADER_SIZE]; /* crc for header + crc and no data */
-		*sptr = htons(crcCcitt16(buffer,TAU_HEADER_SIZE));
-		*bufferCount = TAU_HEADER_SIZE +2;
+	crc = tauBuildHeader(cmd, CAM_OK, header, inputSize);
+	iov[iovcnt].iov_base = header;
+	iov[iovcnt++].iov_len = TAU_HEADER_SIZE;
+
+	if (inputSize) {
+		crc = crcCcitt16Update(crc, input, inputSize);
+		iov[iovcnt].iov_base = input;
+		iov[iovcnt++].iov_len = inputSize;
 	}
+
+	value = htons(crc);
+	memcpy(trailer, &value, sizeof(value));
+	iov[iovcnt].iov_base = trailer;
+	iov[iovcnt++].iov_len = TAU_CRC_SIZE;
+	tauStatsMark(link, TAU_PHASE_BUILD);
+
+	hexDump("Sending request to Tau", header, TAU_HEADER_SIZE);
+	if (inputSize) {
+		hexDump("Request data", input, inputSize);
+	}
+
+	return tauWritev(link, iov, iovcnt);
 }
 
-/** Verifies packet from Tau camera is error free, matches exepected response, and extras any assoicated data
+/** Receives a response packet straight into the caller's buffer: the
+ *  frame parser copies the data once out of the receive ring and adds it
+ *  to the crc as it goes
+ * \param link state of the handle
  * \param cmd expected response command
- * \param buffer contains received data
- * \param bufferSize number of bytes of data in buffer
- * \param data holder for the command data data in the received packet, if any
- * \param dataCount on entry indicates the data buffer size, on exit contains the
- *        number of valid bytes of data in the data buffer
- * \returns the status of attempted read
+ * \param output (optional, may be NULL) holder for the response data
+ * \param outputCount (optional, may be NULL) on entry the size of output,
+ *        on exit the number of valid bytes in output
+ * \param msWait number of milliseconds to wait for the whole packet
+ * \returns the status of the command
  */
-static tauStatus tauDecodeResponse(short cmd, char *buffer, short bufferSize, char *data, short *dataCount)
+static tauStatus tauReceiveResponse(struct tauLink *link, tauCmd cmd,
+				    char *output, short *outputCount, long msWait)
 {
+	struct timespec deadline;
+	struct tauFrame frame;
 	tauStatus status;
-	uint16_t *sptr;
-	short data_len;
 
-	if (buffer[0] != 0x6E){
-		fprintf(stderr,"Invalid response process code\n");
-		return CAM_COMMUNICATION_ERROR;
+	if (output && outputCount) {
+		tauFrameInit(&frame, output, *outputCount > 0 ? *outputCount : 0);
+	} else {
+		tauFrameInit(&frame, NULL, 0);
+	}
+	if (outputCount) {
+		*outputCount = 0;
 	}
 
-	status = buffer[1];
+	/* The whole packet has to arrive within msWait */
+	tauDeadlineSet(&deadline, msWait);
 
+	status = tauReceiveFrame(link, &frame, cmd, &deadline);
 	if (status != CAM_OK) {
-		fprintf(stderr,"Camera reports error: %d\n", status);
 		return status;
 	}
+	tauStatsMark(link, TAU_PHASE_LAST_BYTE);
 
-	/* Check the message is right */
-	if (buffer[3] != cmd){
-		fprintf(stderr,"Response function number doesn't match requested command: %d/%d\n", buffer[3], cmd);
-		return CAM_COMMUNICATION_ERROR;
+	status = tauFrameResult(&frame);
+	link->rejected = tauFrameIntact(&frame) && (frame.header[1] != CAM_OK);
+	if ((status == CAM_OK) && outputCount && (frame.data_len <= frame.capacity)) {
+		*outputCount = frame.data_len;
 	}
+	tauStatsMark(link, TAU_PHASE_DECODE);
 
-	sptr = (uint16_t *)&buffer[6];
+	return status;
+}
 
-	if (ntohs(*sptr) != crcCcitt16(buffer,6)) {
-		fprintf(stderr,"Packet received from Tau camera contains header CRC error\n");
-		return CAM_CHECKSUM_ERROR;
-	}
+/***************************************************************************
+ * High level packet exchange routines
+ ***************************************************************************/
 
-	sptr = (uint16_t *)&buffer[4];
+tauStatus tauExchangePacket(tauHandler handler, char *request, short request_size,
+			    char *response, short *response_size)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	short size = *response_size;
+	char data[TAU_READ_CHUNK];
+	short data_count;
+	tauStatus status;
+	int attempt;
+	long wait;
 
-	data_len = ntohs(*sptr);
+	if ((request_size < TAU_HEADER_SIZE + 2) || (size < TAU_HEADER_SIZE + 2)) {
+		return CAM_BYTE_COUNT_ERROR;
+	}
 
-	sptr = (uint16_t *)&buffer[TAU_HEADER_SIZE + data_len];
+	/* Clients of taud share the cache of its handle */
+	data_count = sizeof(data);
+	if (link && tauCacheLookup(link, (unsigned char)request[3], &request[TAU_HEADER_SIZE],
+				   request_size - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+				   data, &data_count)) {
+		tauBuildPacket(request[3], CAM_OK, response, response_size, data, data_count);
+		return CAM_OK;
+	}
 
-	if (ntohs(*sptr) != crcCcitt16(buffer,TAU_HEADER_SIZE + data_len)) {
-		fprintf(stderr,"Packet received from Tau camera contains overall packet CRC error\n");
-		return CAM_CHECKSUM_ERROR;
+	for (attempt = 1; ; attempt++) {
+		*response_size = size;
+		status = tauTransact(handler, request, request_size, response, response_size,
+				     tauCmdTimeout(handler, (unsigned char)request[3],
+						   request_size - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+						   size - TAU_HEADER_SIZE - TAU_CRC_SIZE));
+
+		if ((status == CAM_COMMUNICATION_ERROR) && link && tauNetRecover(link, request[3])) {
+			*response_size = size;
+			status = tauTransact(handler, request, request_size, response, response_size,
+					     tauCmdTimeout(handler, (unsigned char)request[3],
+							   request_size - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+							   size - TAU_HEADER_SIZE - TAU_CRC_SIZE));
+		}
 
+		/* The response packet carries what the camera made of the request */
+		wait = link ? tauRetryWait(link, request[3],
+					   status == CAM_OK ? (unsigned char)response[1] : status,
+					   attempt) : -1;
+		if (wait < 0) {
+			break;
+		}
+		tauDiscardInput(link, wait);
 	}
 
+	if (link) {
+		tauCacheUpdate(link, (unsigned char)request[3], &request[TAU_HEADER_SIZE],
+			       request_size - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+			       status == CAM_OK ? (unsigned char)response[1] : status, &response[TAU_HEADER_SIZE],
+			       status == CAM_OK ? *response_size - TAU_HEADER_SIZE - TAU_CRC_SIZE : 0);
+	}
 
-	if (data_len && data && *dataCount) {
-		assert((dataCount == NULL) || (*dataCount >= data_len));
-		memcpy(data,&buffer[TAU_HEADER_SIZE],data_len);
-		if (dataCount) {
-			*dataCount = data_len;
-		}
-	} else if (data_len > 0) {
-		fprintf(stderr,"WARNING response data ignored\n");
-		if (dataCount) {
-			*dataCount = 0;
-		}
-	} else {
-		if (dataCount) {
-			*dataCount = 0;
-		}
+	if (status != CAM_OK) {
+		/* Answer with a packet carrying the failure */
+		*response_size = size;
+		tauBuildPacket(request[3], status, response, response_size, NULL, 0);
 	}
 
 	return status;
 }
 
-/***************************************************************************
- * High level packet exchange routines
- ***************************************************************************/
+tauStatus tauCommand(struct tauLink *link, tauCmd cmd, char *input, short inputSize,
+		     char *output, short *outputCount, long msWait)
+{
+	struct timespec start;
+	tauStatus status;
+
+	/* Don't mistake the late answer to a failed request for this one */
+	if (link->stale) {
+		tauDiscardInput(link, 0);
+	}
+
+	link->rejected = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tauStatsStart(link);
+	status = tauSendRequest(link, cmd, input, inputSize);
+
+	if (status == CAM_OK) {
+		tauStatsMark(link, TAU_PHASE_WRITE);
+		status = tauReceiveResponse(link, cmd, output, outputCount, msWait);
+	}
+
+	tauTimeoutRecord(link, cmd, status, inputSize,
+			 (output && outputCount) ? *outputCount : 0, &start);
+	tauStatsRecord(link, cmd, status);
+	tauTraceResult(link, cmd, status);
+
+	return status;
+}
 
 tauStatus tauDoCmd(tauHandler handler,tauCmd cmd,
 		   char *input, short input_size,
 		   char *output, short *output_count){
-	short  msg_size = 10 + input_size;
-	short rsp_size;
-	char *msg, *rsp;
-	unsigned short crc1, crc2;
-	int err;
-	tauStatus status = CAM_NOT_READY;
-
-	if (output_count) {
-		rsp_size = 10 + *output_count;
-	} else {
-		rsp_size = 10;
-	}
+	struct tauLink *link = tauLinkGet(handler);
+	short capacity = output_count ? *output_count : 0;
+	tauStatus status;
+	int attempt;
+	long wait;
 
-	msg = malloc(msg_size);
-	if (!msg) {
-		fprintf(stderr,"%s: failed to allocate memory for message: %d\n",__FUNCTION__, msg_size);
-		return CAM_NOT_READY;
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
 	}
-	rsp = malloc(rsp_size);
-	if (!rsp) {
-		fprintf(stderr,"%s: failed to allocate memory for response\n",__FUNCTION__);
-		err = CAM_NOT_READY;
-		goto free_msg;
+
+	/* Only the I/O thread of a shared handle talks to the camera */
+	if (tauShareForeign(link)) {
+		return tauShareCmd(link, cmd, input, input_size, output, output_count);
 	}
 
-	tauBuildRequest(cmd, msg, &msg_size, input, input_size);
-	hexDump("Sending request to Tau", msg, msg_size);
+	/* The camera is busy with requests submitted by tauSubmitCmd() */
+	if (link->async_head) {
+		return CAM_BUSY;
+	}
 
-	if (err =  tauSendCmd(handler, msg, msg_size)) {
-		goto free_rsp;
+	/* Data of the wrong size is refused here instead of by the camera */
+	status = tauCommandCheck(cmd, input_size);
+	if (status != CAM_OK) {
+		return status;
 	}
 
-	if (err =  tauReceiveCmd(handler, rsp, &rsp_size, TAU_COMM_NORMAL_TIMEOUT)) {
-		goto free_rsp;
+	if (tauCacheLookup(link, cmd, input, input_size, output, output_count)) {
+		return CAM_OK;
 	}
 
-	hexDump("Received response from Tau", rsp, rsp_size);
+	for (attempt = 1; ; attempt++) {
+		if (output_count) {
+			*output_count = capacity;
+		}
+		status = tauCommand(link, cmd, input, input_size, output, output_count,
+				    tauTimeoutFor(link, cmd, input_size, output ? capacity : 0));
+
+		if ((status == CAM_COMMUNICATION_ERROR) && tauNetRecover(link, cmd)) {
+			if (output_count) {
+				*output_count = capacity;
+			}
+			status = tauCommand(link, cmd, input, input_size, output, output_count,
+					    tauTimeoutFor(link, cmd, input_size, output ? capacity : 0));
+		}
 
-	if (err =  tauDecodeResponse(cmd, rsp, rsp_size, output, output_count)) {
-		goto free_rsp;
+		/* Let the link rate follow the line quality */
+		tauRateControl(link, status);
+
+		wait = tauRetryWait(link, cmd, status, attempt);
+		if (wait < 0) {
+			break;
+		}
+		/* Waits out the backoff, and whatever is left of the failed
+		 * exchange goes with it */
+		tauDiscardInput(link, wait);
 	}
 
-free_rsp:
-	free(rsp);
-free_msg:
-	free(msg);
+	tauCacheUpdate(link, cmd, input, input_size, status,
+		       output, (output && output_count) ? *output_count : 0);
 
-	return err;
+	return status;
 }
 
 tauStatus tauVerifyCommunication(tauHandler handler)
@@ -465,6 +1098,9 @@ int tauRunTests(void)
 	hexDump("CameraController.exe serial data capture\nexpected: 0x6E 0x00 0x00 0x05 0x00 0x08 0xB5 0x43\n          0x0A 0x00 0x02 0x2B 0x08 0x00 0x00 0x40\n          0x33 0x70\n\n",
 		buffer, buffer_len);
 
+	printf("CRC kernels\n");
+	crcCcitt16RunTests();
+
 	return 0;
 }
 #endif
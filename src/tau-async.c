@@ -0,0 +1,389 @@
+/* libtau asynchronous command interface
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+/** A command submitted with tauSubmitCmd() */
+struct tauAsyncRequest {
+	struct tauAsyncRequest *next;
+	tauCmd cmd;
+	tauCompletion done;
+	void *user_data;
+
+	int started;                /* request is being exchanged with the camera */
+	short cached;               /* answered from the cache, bytes of output plus one */
+	struct timespec start;      /* when the request started going out */
+	struct timespec deadline;   /* when the camera has to have answered */
+
+	char *request;              /* request packet */
+	short request_size;
+	short request_sent;         /* bytes written to the camera so far */
+
+	struct tauFrame frame;      /* response parser */
+	char *output;               /* response data */
+	short output_size;
+
+	char storage[];             /* request and output buffers */
+};
+
+/***************************************************************************
+ * Request state machine
+ ***************************************************************************/
+
+/** Starts the exchange of the request at the head of the queue
+ * \param link state of the handle
+ */
+static void tauAsyncStart(struct tauLink *link)
+{
+	struct tauAsyncRequest *req = link->async_head;
+	short count;
+
+	/* Don't mistake the late answer to a failed request for this one */
+	if (link->stale) {
+		do {
+			link->rx_head = link->rx_tail;
+		} while (tauReadRing(link) > 0);
+		link->rx_head = link->rx_tail;
+		link->stale = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &req->start);
+	req->started = 1;
+
+	/* A request for what the one before it fetched doesn't go out
+	 * again, so callers asking for the same value at once share one
+	 * exchange.  It completes on the next tauAsyncStep() */
+	count = req->output_size;
+	if (tauCacheLookup(link, req->cmd, &req->request[TAU_HEADER_SIZE],
+			   req->request_size - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+			   req->output, &count)) {
+		req->cached = count + 1;
+		req->request_sent = req->request_size;
+		tauDeadlineSet(&req->deadline, 0);
+		return;
+	}
+
+	tauDeadlineSet(&req->deadline,
+		       tauTimeoutFor(link, req->cmd, req->request_size - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+				     req->output_size));
+
+	/* The packet was built when the request was submitted */
+	tauStatsStart(link);
+	tauStatsMark(link, TAU_PHASE_BUILD);
+}
+
+/** Removes the request at the head of the queue, reports it to its owner
+ *  and starts the next one
+ * \param link state of the handle
+ * \param status outcome of the exchange
+ */
+static void tauAsyncComplete(struct tauLink *link, tauStatus status)
+{
+	struct tauAsyncRequest *req = link->async_head;
+	short output_count = 0;
+
+	link->async_head = req->next;
+	if (!link->async_head) {
+		link->async_tail = NULL;
+	}
+
+	if (req->cached) {
+		output_count = req->cached - 1;
+	} else {
+		if (status == CAM_OK) {
+			status = tauFrameResult(&req->frame);
+			if (req->frame.data_len <= req->frame.capacity) {
+				output_count = req->frame.data_len;
+			}
+			tauStatsMark(link, TAU_PHASE_DECODE);
+		}
+
+		if ((status == CAM_TIMEOUT_ERROR) || (status == CAM_COMMUNICATION_ERROR)) {
+			link->stale = 1;
+		}
+
+		if (status != CAM_OK) {
+			output_count = 0;
+		}
+
+		tauTimeoutRecord(link, req->cmd, status,
+				 req->request_size - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+				 output_count, &req->start);
+		if (req->started) {
+			tauStatsRecord(link, req->cmd, status);
+			tauTraceResult(link, req->cmd, status);
+		}
+
+		/* Before the next request starts, so it can be answered with
+		 * this response */
+		if (req->started) {
+			tauCacheUpdate(link, req->cmd, &req->request[TAU_HEADER_SIZE],
+				       req->request_size - TAU_HEADER_SIZE - TAU_CRC_SIZE,
+				       status, req->output, output_count);
+		}
+	}
+
+	if (link->async_head) {
+		tauAsyncStart(link);
+	}
+
+	if (req->done) {
+		req->done(link->fd, status, req->cmd, req->output, output_count, req->user_data);
+	}
+
+	free(req);
+}
+
+/** Writes as much of the request as the descriptor accepts
+ * \param link state of the handle
+ * \param req request being sent
+ * \returns zero on success, even if only part of the request was written,
+ *  negative on error
+ */
+static int tauAsyncSend(struct tauLink *link, struct tauAsyncRequest *req)
+{
+	struct iovec iov;
+	ssize_t len;
+
+	while (req->request_sent < req->request_size) {
+		iov.iov_base = &req->request[req->request_sent];
+		iov.iov_len = req->request_size - req->request_sent;
+		len = tauLinkWritev(link, &iov, 1);
+
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN) {
+				return 0;
+			}
+			perror("Unable to send message");
+			return -1;
+		}
+
+		req->request_sent += len;
+		if (req->request_sent == req->request_size) {
+			link->stats.frames_sent++;
+			tauStatsMark(link, TAU_PHASE_WRITE);
+		}
+	}
+
+	return 0;
+}
+
+/** Parses received data, reading from the descriptor until the response
+ *  is complete or nothing more is available
+ * \param link state of the handle
+ * \param req request waiting for its response
+ * \returns CAM_OK once the packet is complete, CAM_NOT_READY if more data
+ *  is needed, or the error that ends the exchange
+ */
+static tauStatus tauAsyncReceive(struct tauLink *link, struct tauAsyncRequest *req)
+{
+	int len;
+
+	while (1) {
+		if (tauParseRing(link, &req->frame)) {
+			if (req->frame.header[3] == (unsigned char)req->cmd) {
+				tauStatsMark(link, TAU_PHASE_LAST_BYTE);
+				return CAM_OK;
+			}
+			/* Late answer to an earlier request */
+			dbg("Skipping response to command 0x%02X", req->frame.header[3]);
+			tauFrameRestart(&req->frame);
+			continue;
+		}
+
+		len = tauReadRing(link);
+		if (len < 0) {
+			return CAM_COMMUNICATION_ERROR;
+		}
+		if (len == 0) {
+			return CAM_NOT_READY;
+		}
+	}
+}
+
+void tauAsyncCancel(struct tauLink *link, tauStatus status)
+{
+	while (link->async_head) {
+		tauAsyncComplete(link, status);
+	}
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauStatus tauSubmitCmd(tauHandler handler, tauCmd cmd,
+		       char *input, short input_size, short output_size,
+		       tauCompletion done, void *user_data)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	const struct tauCommandInfo *info;
+	struct tauAsyncRequest *req;
+	short request_size = TAU_HEADER_SIZE + input_size + TAU_CRC_SIZE;
+	tauStatus status;
+	int flags;
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	/* The I/O thread of a shared handle owns the descriptor */
+	if (link->share) {
+		return CAM_BUSY;
+	}
+
+	status = tauCommandCheck(cmd, input_size);
+	if (status != CAM_OK) {
+		return status;
+	}
+
+	/* Room for the largest response the command has, not for what the
+	 * caller guessed */
+	info = tauCommandInfo(cmd);
+	if (info && (output_size > info->response_max)) {
+		output_size = info->response_max;
+	}
+
+	req = malloc(sizeof(*req) + request_size + output_size);
+	if (!req) {
+		fprintf(stderr,"%s: failed to allocate memory for request\n",__FUNCTION__);
+		return CAM_NOT_READY;
+	}
+
+	memset(req, 0, sizeof(*req));
+	req->cmd = cmd;
+	req->done = done;
+	req->user_data = user_data;
+	req->request = req->storage;
+	req->output = req->request + request_size;
+	req->output_size = output_size;
+	tauFrameInit(&req->frame, req->output, output_size);
+
+	req->request_size = request_size;
+	tauBuildRequest(cmd, req->request, &req->request_size, input, input_size);
+	hexDump("Sending request to Tau", req->request, req->request_size);
+
+	/* The event loop decides when to read and write */
+	flags = fcntl(link->fd, F_GETFL);
+	if ((flags >= 0) && !(flags & O_NONBLOCK)) {
+		fcntl(link->fd, F_SETFL, flags | O_NONBLOCK);
+	}
+
+	if (link->async_tail) {
+		link->async_tail->next = req;
+		link->async_tail = req;
+		return CAM_OK;
+	}
+
+	link->async_head = link->async_tail = req;
+	tauAsyncStart(link);
+
+	/* Get the request on the wire right away, errors are reported by
+	 * the next tauAsyncStep() */
+	tauAsyncSend(link, req);
+
+	return CAM_OK;
+}
+
+
+short tauAsyncEvents(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauAsyncRequest *req;
+
+	if (!link || !link->async_head) {
+		return 0;
+	}
+
+	req = link->async_head;
+	if (req->request_sent < req->request_size) {
+		return POLLOUT;
+	}
+	return POLLIN;
+}
+
+
+int tauAsyncTimeout(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link || !link->async_head) {
+		return -1;
+	}
+
+	return tauDeadlineRemaining(&link->async_head->deadline);
+}
+
+
+int tauAsyncPending(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauAsyncRequest *req;
+	int count = 0;
+
+	if (!link) {
+		return 0;
+	}
+
+	for (req = link->async_head; req; req = req->next) {
+		count++;
+	}
+	return count;
+}
+
+
+tauStatus tauAsyncStep(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauAsyncRequest *req;
+	tauStatus status;
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	while ((req = link->async_head)) {
+		status = CAM_NOT_READY;
+		if (req->cached) {
+			status = CAM_OK;
+		} else if ((req->request_sent < req->request_size) && (tauAsyncSend(link, req) < 0)) {
+			status = CAM_COMMUNICATION_ERROR;
+		} else if (req->request_sent == req->request_size) {
+			status = tauAsyncReceive(link, req);
+		}
+
+		if ((status == CAM_NOT_READY) && !tauDeadlineRemaining(&req->deadline)) {
+			fprintf(stderr,"Timeout waiting for response to command 0x%02X\n", req->cmd);
+			status = CAM_TIMEOUT_ERROR;
+		}
+
+		if (status == CAM_NOT_READY) {
+			break;
+		}
+
+		tauAsyncComplete(link, status);
+
+		/* The callback may have closed the handler */
+		link = tauLinkGet(handler);
+		if (!link) {
+			break;
+		}
+	}
+
+	return CAM_OK;
+}
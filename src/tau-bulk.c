@@ -0,0 +1,362 @@
+/* libtau bulk memory access
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+#define TAU_PROGRESS_INTERVAL 100 /* ms between progress reports */
+#define TAU_FLASH_RETRIES     3   /* extra passes over chunks that failed to read */
+#define TAU_FLASH_ATTEMPTS    2   /* erase, write and verify cycles per block */
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Returns the milliseconds elapsed since start
+ * \param start time from CLOCK_MONOTONIC
+ */
+static long tauElapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/** Reads one chunk of camera memory straight into its place in the buffer
+ * \param link state of the handle
+ * \param address camera address of the chunk
+ * \param data holder for the chunk
+ * \param size chunk size, at most TAU_READ_CHUNK
+ * \returns the status of the command
+ */
+static tauStatus tauReadChunk(struct tauLink *link, unsigned long address, char *data,
+			      unsigned short size)
+{
+	char args[6];
+	uint32_t addr = htonl(address);
+	uint16_t count = htons(size);
+	short data_count = size;
+	tauStatus status;
+
+	memcpy(&args[0], &addr, sizeof(addr));
+	memcpy(&args[4], &count, sizeof(count));
+
+	status = tauCommand(link, READ_MEMORY, args, sizeof(args), data, &data_count,
+			    tauTimeoutFor(link, READ_MEMORY, sizeof(args), size));
+
+	/* Rate control sees bulk traffic like any other */
+	tauRateControl(link, status);
+
+	if ((status == CAM_OK) && (data_count != size)) {
+		fprintf(stderr,"Short memory read at 0x%08lX: %d/%d\n", address, data_count, size);
+		status = CAM_BYTE_COUNT_ERROR;
+	}
+
+	return status;
+}
+
+/** Writes one chunk of camera memory
+ * \param link state of the handle
+ * \param address camera address of the chunk
+ * \param data chunk data
+ * \param size chunk size, at most TAU_WRITE_CHUNK
+ * \returns the status of the command
+ */
+static tauStatus tauWriteChunk(struct tauLink *link, unsigned long address, const char *data,
+			       unsigned short size)
+{
+	char args[4 + TAU_WRITE_CHUNK];
+	uint32_t addr = htonl(address);
+	tauStatus status;
+
+	memcpy(&args[0], &addr, sizeof(addr));
+	memcpy(&args[4], data, size);
+
+	status = tauCommand(link, WRITE_MEMORY, args, 4 + size, NULL, NULL,
+			    tauTimeoutFor(link, WRITE_MEMORY, 4 + size, 0));
+	tauRateControl(link, status);
+
+	return status;
+}
+
+/** Returns nonzero if a chunk holds nothing but erased flash
+ * \param data chunk data
+ * \param size chunk size
+ */
+static int tauErased(const char *data, unsigned long size)
+{
+	while (size--) {
+		if ((unsigned char)*data++ != 0xFF) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/** Rewrites a flash block: erases it, writes the chunks that aren't left
+ *  erased and reads it back until it holds the target, or gives up
+ * \param handler the handler for the Tau camera
+ * \param link state of the handle
+ * \param address camera address of the block
+ * \param blockSize size of the block
+ * \param target what the block has to hold
+ * \param current holder for what the block holds, blockSize bytes
+ * \param stats accounting of the update
+ * \returns the status of the update of the block
+ */
+static tauStatus tauFlashBlock(tauHandler handler, struct tauLink *link, unsigned long address,
+			       unsigned long blockSize, const char *target, char *current,
+			       struct tauFlashStats *stats)
+{
+	uint16_t block = htons(address / TAU_FLASH_BLOCK_SIZE);
+	unsigned long offset;
+	unsigned short len;
+	tauStatus status = CAM_OK;
+	int attempt;
+
+	for (attempt = 0; attempt < TAU_FLASH_ATTEMPTS; attempt++) {
+		dbg("Updating flash block at 0x%08lX", address);
+
+		status = tauCommand(link, ERASE_MEMORY_BLOCK, (char *)&block, sizeof(block), NULL, NULL,
+				    tauTimeoutFor(link, ERASE_MEMORY_BLOCK, sizeof(block), 0));
+		if (status != CAM_OK) {
+			continue;
+		}
+
+		for (offset = 0; offset < blockSize; offset += len) {
+			len = blockSize - offset < TAU_WRITE_CHUNK ? blockSize - offset : TAU_WRITE_CHUNK;
+			if (tauErased(&target[offset], len)) {
+				continue;
+			}
+			status = tauWriteChunk(link, address + offset, &target[offset], len);
+			if (status != CAM_OK) {
+				break;
+			}
+			stats->bytes_written += len;
+		}
+		if (status != CAM_OK) {
+			continue;
+		}
+
+		status = tauReadMemory(handler, address, blockSize, current, NULL,
+				       TAU_FLASH_RETRIES, NULL, NULL);
+		if ((status == CAM_OK) && memcmp(current, target, blockSize)) {
+			fprintf(stderr,"Flash block at 0x%08lX does not verify\n", address);
+			stats->verify_failures++;
+			status = CAM_CHECKSUM_ERROR;
+		}
+		if (status == CAM_OK) {
+			break;
+		}
+	}
+
+	return status;
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauStatus tauReadMemory(tauHandler handler, unsigned long address, unsigned long size,
+			char *buffer, struct tauChunk *chunks, int retries,
+			tauProgress progress, void *user_data)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauChunk *own = NULL;
+	struct timespec start;
+	unsigned long count = TAU_CHUNK_COUNT(size);
+	unsigned long done = 0, fetched = 0;
+	unsigned long offset, i;
+	unsigned short len;
+	long reported = -TAU_PROGRESS_INTERVAL;
+	long elapsed;
+	int failed, pass;
+	tauStatus status = CAM_OK;
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	/* Bulk transfers aren't passed to the I/O thread of a shared handle */
+	if (link->share) {
+		return CAM_BUSY;
+	}
+
+	/* The camera is busy with requests submitted by tauSubmitCmd() */
+	if (link->async_head) {
+		return CAM_BUSY;
+	}
+
+	if (!chunks) {
+		chunks = own = calloc(count ? count : 1, sizeof(*chunks));
+		if (!chunks) {
+			fprintf(stderr,"%s: failed to allocate chunk map\n",__FUNCTION__);
+			return CAM_NOT_READY;
+		}
+	}
+
+	/* Chunks done by an earlier, interrupted read are kept only if the
+	 * buffer still holds what was read then */
+	for (i = 0, offset = 0; i < count; i++, offset += TAU_READ_CHUNK) {
+		len = size - offset < TAU_READ_CHUNK ? size - offset : TAU_READ_CHUNK;
+		if (chunks[i].done && (crcCcitt16(&buffer[offset], len) != chunks[i].crc)) {
+			dbg("Chunk at 0x%08lX changed since it was read", address + offset);
+			chunks[i].done = 0;
+		}
+		if (chunks[i].done) {
+			done += len;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Chunks go out back to back; the ones that fail are left for the
+	 * next pass so one bad exchange doesn't stall the rest */
+	for (pass = 0; pass <= retries; pass++) {
+		failed = 0;
+
+		for (i = 0, offset = 0; i < count; i++, offset += TAU_READ_CHUNK) {
+			if (chunks[i].done) {
+				continue;
+			}
+
+			len = size - offset < TAU_READ_CHUNK ? size - offset : TAU_READ_CHUNK;
+			status = tauReadChunk(link, address + offset, &buffer[offset], len);
+
+			if (status == CAM_OK) {
+				chunks[i].crc = crcCcitt16(&buffer[offset], len);
+				chunks[i].done = 1;
+				done += len;
+				fetched += len;
+			} else {
+				if (chunks[i].tries < 255) {
+					chunks[i].tries++;
+				}
+				failed++;
+			}
+
+			elapsed = tauElapsed(&start);
+			if (progress && ((elapsed - reported >= TAU_PROGRESS_INTERVAL) || (done == size))) {
+				reported = elapsed;
+				if (progress(done, size, elapsed ? fetched * 1000 / elapsed : 0, user_data)) {
+					dbg("Read abandoned at 0x%08lX", address + offset);
+					free(own);
+					return CAM_NOT_READY;
+				}
+			}
+		}
+
+		if (!failed) {
+			status = CAM_OK;
+			break;
+		}
+
+		dbg("Pass %d left %d chunks unread", pass, failed);
+	}
+
+	free(own);
+	return status;
+}
+
+
+tauStatus tauFlashUpdate(tauHandler handler, unsigned long address, const char *image,
+			 unsigned long size, unsigned long block_size,
+			 struct tauFlashStats *stats, tauProgress progress, void *user_data)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauFlashStats own;
+	struct timespec start;
+	unsigned long offset, len;
+	char *current, *target;
+	tauStatus status = CAM_OK;
+	long elapsed;
+
+	if (!stats) {
+		stats = &own;
+	}
+	memset(stats, 0, sizeof(*stats));
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	/* Bulk transfers aren't passed to the I/O thread of a shared handle */
+	if (link->share) {
+		return CAM_BUSY;
+	}
+
+	/* The camera is busy with requests submitted by tauSubmitCmd() */
+	if (link->async_head) {
+		return CAM_BUSY;
+	}
+
+	/* ERASE_MEMORY_BLOCK numbers blocks of the camera's own erase size */
+	if (block_size != TAU_FLASH_BLOCK_SIZE) {
+		fprintf(stderr,"%s: block size has to be 0x%X\n", __FUNCTION__, TAU_FLASH_BLOCK_SIZE);
+		return CAM_RANGE_ERROR;
+	}
+
+	if ((address % block_size) || ((address + size - 1) / block_size > 0xFFFF)) {
+		fprintf(stderr,"Flash update has to start on a block boundary and fit in 65536 blocks\n");
+		return CAM_RANGE_ERROR;
+	}
+
+	current = malloc(2 * block_size);
+	if (!current) {
+		fprintf(stderr,"%s: failed to allocate block buffers\n",__FUNCTION__);
+		return CAM_NOT_READY;
+	}
+	target = current + block_size;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (offset = 0; offset < size; offset += block_size) {
+		len = size - offset < block_size ? size - offset : block_size;
+
+		/* The camera can't checksum its flash, so the fingerprint of a
+		 * block is its contents.  Reading costs a fraction of erasing,
+		 * writing and verifying it */
+		status = tauReadMemory(handler, address + offset, block_size, current, NULL,
+				       TAU_FLASH_RETRIES, NULL, NULL);
+		if (status != CAM_OK) {
+			break;
+		}
+
+		/* A short last block keeps what follows the image */
+		memcpy(target, current, block_size);
+		memcpy(target, &image[offset], len);
+
+		stats->blocks++;
+		if (!memcmp(current, target, block_size)) {
+			stats->bytes_skipped += len;
+		} else {
+			status = tauFlashBlock(handler, link, address + offset, block_size,
+					       target, current, stats);
+			if (status != CAM_OK) {
+				break;
+			}
+			stats->blocks_written++;
+		}
+
+		elapsed = tauElapsed(&start);
+		if (progress && progress(offset + len, size,
+					 elapsed ? (offset + len) * 1000 / elapsed : 0, user_data)) {
+			dbg("Flash update abandoned at 0x%08lX", address + offset + len);
+			status = CAM_NOT_READY;
+			break;
+		}
+	}
+
+	free(current);
+	return status;
+}
@@ -0,0 +1,455 @@
+/* libtau response cache
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+#define TAU_CACHE_ENTRIES    64  /* responses kept per handle */
+#define TAU_CACHE_KEY_SIZE   8   /* largest request data that is cached */
+#define TAU_CACHE_VALUE_SIZE 32  /* largest response data that is cached */
+#define TAU_CACHE_LINE       128 /* longest line in a cache file */
+#define TAU_CACHE_PATH       256 /* longest cache file name */
+
+/** A response, keyed by the command and its request data */
+struct tauCacheEntry {
+	unsigned char cmd;
+	unsigned char request_size;
+	unsigned char response_size;
+	char request[TAU_CACHE_KEY_SIZE];
+	char response[TAU_CACHE_VALUE_SIZE];
+};
+
+struct tauCache {
+	int count;
+	int persisted; /* constants in the cache file when loaded or last saved */
+	struct tauCacheEntry entries[TAU_CACHE_ENTRIES];
+};
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Returns nonzero if the response to a request can be cached: a setting
+ *  read back without data, or a command whose answer never changes
+ * \param cmd Tau camera command
+ * \param inputSize bytes of request data
+ */
+static int tauCacheable(tauCmd cmd, short inputSize)
+{
+	const struct tauCommandInfo *info = tauCommandInfo(cmd);
+
+	if (!info || (inputSize > TAU_CACHE_KEY_SIZE) ||
+	    (info->response_max > TAU_CACHE_VALUE_SIZE)) {
+		return 0;
+	}
+	if (info->flags & TAU_CMD_CONSTANT) {
+		return 1;
+	}
+	return (info->flags & TAU_CMD_SETTING) && !inputSize;
+}
+
+/** Finds the entry of a request
+ * \param cache the cache
+ * \param cmd Tau camera command
+ * \param input request data
+ * \param inputSize bytes of request data
+ * \returns the entry, or NULL if the response isn't cached
+ */
+static struct tauCacheEntry *tauCacheFind(struct tauCache *cache, tauCmd cmd,
+					  const char *input, short inputSize)
+{
+	struct tauCacheEntry *entry;
+	int i;
+
+	for (i = 0; i < cache->count; i++) {
+		entry = &cache->entries[i];
+		if ((entry->cmd == (unsigned char)cmd) && (entry->request_size == inputSize) &&
+		    !memcmp(entry->request, input, inputSize)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/** Stores a response, replacing the one cached for the same request
+ * \param cache the cache
+ * \param cmd Tau camera command
+ * \param input request data
+ * \param inputSize bytes of request data, at most TAU_CACHE_KEY_SIZE
+ * \param output response data
+ * \param outputCount bytes of response data, at most TAU_CACHE_VALUE_SIZE
+ */
+static void tauCacheStore(struct tauCache *cache, tauCmd cmd, const char *input,
+			  short inputSize, const char *output, short outputCount)
+{
+	struct tauCacheEntry *entry = tauCacheFind(cache, cmd, input, inputSize);
+
+	if (!entry) {
+		/* Full only if something keeps asking for new addresses;
+		 * starting over is simplest */
+		if (cache->count == TAU_CACHE_ENTRIES) {
+			cache->count = 0;
+		}
+		entry = &cache->entries[cache->count++];
+	}
+
+	entry->cmd = cmd;
+	entry->request_size = inputSize;
+	memcpy(entry->request, input, inputSize);
+	entry->response_size = outputCount;
+	memcpy(entry->response, output, outputCount);
+}
+
+/** Drops cached responses
+ * \param cache the cache
+ * \param keep TAU_CMD_* flags of the commands whose responses stay
+ */
+static void tauCacheDrop(struct tauCache *cache, int keep)
+{
+	const struct tauCommandInfo *info;
+	int i, count = 0;
+
+	for (i = 0; i < cache->count; i++) {
+		info = tauCommandInfo(cache->entries[i].cmd);
+		if (info && (info->flags & keep)) {
+			cache->entries[count++] = cache->entries[i];
+		}
+	}
+	cache->count = count;
+}
+
+/** Counts the cached constants
+ * \param cache the cache
+ * \returns number of entries of TAU_CMD_CONSTANT commands
+ */
+static int tauCacheConstants(const struct tauCache *cache)
+{
+	const struct tauCommandInfo *info;
+	int i, count = 0;
+
+	for (i = 0; i < cache->count; i++) {
+		info = tauCommandInfo(cache->entries[i].cmd);
+		if (info && (info->flags & TAU_CMD_CONSTANT)) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/** Returns the name of the cache file of a camera
+ * \param handler the handler for the Tau camera
+ * \param dir directory of the cache files
+ * \param path holder for the name
+ * \param size size of path
+ * \returns CAM_OK, or the status of SERIAL_NUMBER
+ */
+static tauStatus tauCachePath(tauHandler handler, const char *dir, char *path, size_t size)
+{
+	char serial[TAU_CACHE_VALUE_SIZE];
+	short count = sizeof(serial);
+	tauStatus status;
+	int len, i;
+
+	/* The serial number itself comes out of the cache once known */
+	status = tauDoCmd(handler, SERIAL_NUMBER, NULL, 0, serial, &count);
+	if (status != CAM_OK) {
+		return status;
+	}
+
+	len = snprintf(path, size, "%s/tau-", dir);
+	for (i = 0; (i < count) && (len + 2 < (int)size); i++) {
+		len += snprintf(&path[len], size - len, "%02X", (unsigned char)serial[i]);
+	}
+	snprintf(&path[len], size - len, ".cache");
+
+	return CAM_OK;
+}
+
+/** Appends data to a cache file line as hex, '-' if there is none
+ * \param out stream to write to
+ * \param data the data
+ * \param size bytes of data
+ */
+static void tauCacheWriteHex(FILE *out, const char *data, int size)
+{
+	int i;
+
+	if (!size) {
+		fprintf(out, " -");
+		return;
+	}
+	fprintf(out, " ");
+	for (i = 0; i < size; i++) {
+		fprintf(out, "%02X", (unsigned char)data[i]);
+	}
+}
+
+/** Parses a field of a cache file line
+ * \param text hex digits, or '-' for no data
+ * \param data holder for the data
+ * \param size size of data
+ * \returns bytes stored in data, -1 if text is not valid
+ */
+static int tauCacheReadHex(char *text, char *data, int size)
+{
+	int digits = strlen(text);
+	int i;
+
+	if (!strcmp(text, "-")) {
+		return 0;
+	}
+	for (i = 0; i < digits; i++) {
+		if (!isxdigit(text[i])) {
+			return -1;
+		}
+	}
+	if ((digits % 2) || (digits / 2 > size)) {
+		return -1;
+	}
+	return asciiHexToBinary(data, size, text);
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+int tauCacheLookup(struct tauLink *link, tauCmd cmd, const char *input, short inputSize,
+		   char *output, short *outputCount)
+{
+	struct tauCacheEntry *entry;
+
+	if (!link->cache || !tauCacheable(cmd, inputSize)) {
+		return 0;
+	}
+
+	entry = tauCacheFind(link->cache, cmd, input, inputSize);
+	if (!entry) {
+		return 0;
+	}
+
+	/* A buffer too small for the answer gets the camera's verdict */
+	if (output && outputCount) {
+		if (*outputCount < entry->response_size) {
+			return 0;
+		}
+		memcpy(output, entry->response, entry->response_size);
+		*outputCount = entry->response_size;
+	}
+
+	dbg("Response to command 0x%02X from the cache", (unsigned char)cmd);
+	return 1;
+}
+
+
+void tauCacheUpdate(struct tauLink *link, tauCmd cmd, const char *input, short inputSize,
+		    tauStatus status, const char *output, short outputCount)
+{
+	const struct tauCommandInfo *info;
+
+	if (!link->cache) {
+		return;
+	}
+
+	if (tauCacheable(cmd, inputSize)) {
+		if ((status == CAM_OK) && output && (outputCount <= TAU_CACHE_VALUE_SIZE)) {
+			tauCacheStore(link->cache, cmd, input, inputSize, output, outputCount);
+		}
+		return;
+	}
+
+	/* Anything else may have changed what is cached, even if it failed,
+	 * since the camera could have acted on it before the link broke.
+	 * Settings can depend on each other, so setting one drops them
+	 * all, as does anything that isn't idempotent, such as SET_DEFAULTS
+	 * or DO_FFC.  Only a reset drops the constants too */
+	info = tauCommandInfo(cmd);
+	if (((unsigned char)cmd == CAMERA_RESET) || ((unsigned char)cmd == RESET_FACTORY_DEFAULTS)) {
+		tauCacheDrop(link->cache, 0);
+	} else if (!info || (info->flags & TAU_CMD_SETTING) || !(info->flags & TAU_CMD_IDEMPOTENT)) {
+		tauCacheDrop(link->cache, TAU_CMD_CONSTANT);
+	}
+}
+
+
+void tauCacheFree(struct tauLink *link)
+{
+	free(link->cache);
+	link->cache = NULL;
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauStatus tauCacheEnable(tauHandler handler, int enable)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	if (!enable) {
+		tauCacheFree(link);
+		return CAM_OK;
+	}
+
+	if (!link->cache) {
+		link->cache = calloc(1, sizeof(*link->cache));
+		if (!link->cache) {
+			fprintf(stderr,"%s: failed to allocate cache\n",__FUNCTION__);
+			return CAM_NOT_READY;
+		}
+	}
+	return CAM_OK;
+}
+
+
+void tauCacheFlush(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (link && link->cache) {
+		tauCacheDrop(link->cache, 0);
+	}
+}
+
+
+tauStatus tauCacheLoad(tauHandler handler, const char *dir)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauCacheEntry entry;
+	char path[TAU_CACHE_PATH];
+	char line[TAU_CACHE_LINE];
+	char cmd[TAU_CACHE_LINE], request[TAU_CACHE_LINE], response[TAU_CACHE_LINE];
+	const struct tauCommandInfo *info;
+	tauStatus status;
+	FILE *in;
+	int size;
+
+	status = tauCacheEnable(handler, 1);
+	if (status != CAM_OK) {
+		return status;
+	}
+
+	status = tauCachePath(handler, dir, path, sizeof(path));
+	if (status != CAM_OK) {
+		return status;
+	}
+
+	in = fopen(path, "r");
+	if (!in) {
+		/* First time this camera is seen */
+		if (errno == ENOENT) {
+			return CAM_OK;
+		}
+		perror("Unable to open cache file");
+		return CAM_NOT_READY;
+	}
+
+	/* <command> <request data> <response data>, lines that don't parse
+	 * or aren't constants are ignored */
+	while (fgets(line, sizeof(line), in)) {
+		line[strcspn(line, "#")] = '\0';
+		if (sscanf(line, "%s %s %s", cmd, request, response) != 3) {
+			continue;
+		}
+
+		if ((strlen(cmd) != 2) || (tauCacheReadHex(cmd, (char *)&entry.cmd, 1) != 1)) {
+			continue;
+		}
+		info = tauCommandInfo(entry.cmd);
+		if (!info || !(info->flags & TAU_CMD_CONSTANT)) {
+			continue;
+		}
+
+		size = tauCacheReadHex(request, entry.request, TAU_CACHE_KEY_SIZE);
+		if ((size < 0) || !tauCacheable(entry.cmd, size)) {
+			continue;
+		}
+		entry.request_size = size;
+
+		size = tauCacheReadHex(response, entry.response, TAU_CACHE_VALUE_SIZE);
+		if (size < 0) {
+			continue;
+		}
+		entry.response_size = size;
+
+		tauCacheStore(link->cache, entry.cmd, entry.request, entry.request_size,
+			      entry.response, entry.response_size);
+	}
+
+	fclose(in);
+	link->cache->persisted = tauCacheConstants(link->cache);
+	dbg("Loaded %s", path);
+	return CAM_OK;
+}
+
+
+tauStatus tauCacheSave(tauHandler handler, const char *dir)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	const struct tauCommandInfo *info;
+	const struct tauCacheEntry *entry;
+	char path[TAU_CACHE_PATH];
+	char temp[TAU_CACHE_PATH + 4];
+	tauStatus status;
+	FILE *out;
+	int count, i;
+
+	if (!link || !link->cache) {
+		return CAM_NOT_READY;
+	}
+
+	status = tauCachePath(handler, dir, path, sizeof(path));
+	if (status != CAM_OK) {
+		return status;
+	}
+
+	/* Constants dropped by a reset are still right in the file */
+	count = tauCacheConstants(link->cache);
+	if (count < link->cache->persisted) {
+		dbg("Keeping %s, %d constants cached, %d saved", path, count, link->cache->persisted);
+		return CAM_OK;
+	}
+
+	/* Written next to the old file and renamed over it, so a reader
+	 * never sees half of it */
+	snprintf(temp, sizeof(temp), "%s.new", path);
+	out = fopen(temp, "w");
+	if (!out) {
+		perror("Unable to create cache file");
+		return CAM_NOT_READY;
+	}
+
+	fprintf(out, "# <command> <request data> <response data>\n");
+	for (i = 0; i < link->cache->count; i++) {
+		entry = &link->cache->entries[i];
+		info = tauCommandInfo(entry->cmd);
+		if (!info || !(info->flags & TAU_CMD_CONSTANT)) {
+			continue;
+		}
+		fprintf(out, "%02X", entry->cmd);
+		tauCacheWriteHex(out, entry->request, entry->request_size);
+		tauCacheWriteHex(out, entry->response, entry->response_size);
+		fprintf(out, "  # %s\n", info->name);
+	}
+
+	if (fclose(out) || rename(temp, path)) {
+		perror("Unable to write cache file");
+		unlink(temp);
+		return CAM_NOT_READY;
+	}
+
+	link->cache->persisted = count;
+	return CAM_OK;
+}
@@ -0,0 +1,108 @@
+/* tau-cmdgen - generates the command name lookup table used by tau-commands.c
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ *
+ * Runs on the build machine, writes a C header to stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tau.h"
+#include "tau-private.h"
+
+/************************************************************************
+ * Constants
+ ************************************************************************/
+
+#define MAX_SEEDS   (1 << 20) /* seeds tried before the table is doubled */
+
+static const struct {
+	const char *name;
+	int cmd;
+} commands[] = {
+#define TAU_COMMAND(name, code, request_min, request_max, request_step, \
+		    response_max, flags, processing_ms) { #name, code },
+#include "tau-commands.def"
+#undef TAU_COMMAND
+};
+
+#define COMMAND_COUNT ((int)(sizeof(commands) / sizeof(commands[0])))
+
+/************************************************************************
+ * Private Functions
+ ************************************************************************/
+
+/** Places every command name in a table
+ * \param slots the table, filled with command codes or -1
+ * \param size number of slots, a power of two
+ * \param seed hash seed
+ * \return zero if no two names share a slot
+ */
+static int place(int *slots, unsigned int size, unsigned int seed)
+{
+	unsigned int slot;
+	int i;
+
+	for (i = 0; i < (int)size; i++) {
+		slots[i] = -1;
+	}
+
+	for (i = 0; i < COMMAND_COUNT; i++) {
+		slot = tauNameHash(commands[i].name, seed) & (size - 1);
+		if (slots[slot] >= 0) {
+			return -1;
+		}
+		slots[slot] = commands[i].cmd;
+	}
+	return 0;
+}
+
+/***************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	unsigned int size, seed;
+	int *slots;
+	int i;
+
+	/* Start at twice the number of names and grow until a seed turns
+	 * the hash into a perfect one */
+	for (size = 1; size < 2 * COMMAND_COUNT; size <<= 1);
+
+	for (;;) {
+		slots = malloc(size * sizeof(*slots));
+		if (!slots) {
+			fprintf(stderr, "tau-cmdgen: out of memory\n");
+			return 1;
+		}
+		for (seed = 2166136261u; seed < 2166136261u + MAX_SEEDS; seed++) {
+			if (!place(slots, size, seed)) {
+				break;
+			}
+		}
+		if (seed < 2166136261u + MAX_SEEDS) {
+			break;
+		}
+		free(slots);
+		size <<= 1;
+	}
+
+	printf("/* Generated by tau-cmdgen, do not edit */\n\n");
+
+	printf("#define TAU_NAME_SEED 0x%08Xu\n", seed);
+	printf("#define TAU_NAME_SLOTS %u\n\n", size);
+
+	/* Command code in each slot, -1 for none */
+	printf("static const short tau_name_slots[TAU_NAME_SLOTS] = {");
+	for (i = 0; i < (int)size; i++) {
+		printf("%s%4d,", (i % 8) ? " " : "\n\t", slots[i]);
+	}
+	printf("\n};\n");
+
+	free(slots);
+	return 0;
+}
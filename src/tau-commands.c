@@ -0,0 +1,60 @@
+/* libtau command descriptors
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <stdio.h>
+#include <strings.h>
+
+#include "tau.h"
+#include "tau-private.h"
+#include "tau-cmd-tables.h"
+
+/* Indexed by command code, codes that aren't commands have no name */
+static const struct tauCommandInfo tau_commands[256] = {
+#define TAU_COMMAND(name, code, request_min, request_max, request_step, \
+		    response_max, flags, processing_ms) \
+	[code] = { #name, code, request_min, request_max, request_step, \
+		   response_max, flags, processing_ms },
+#include "tau-commands.def"
+#undef TAU_COMMAND
+};
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+const struct tauCommandInfo *tauCommandInfo(tauCmd cmd)
+{
+	const struct tauCommandInfo *info = &tau_commands[(unsigned char)cmd];
+
+	return info->name ? info : NULL;
+}
+
+
+int tauCommandLookup(const char *name)
+{
+	int cmd = tau_name_slots[tauNameHash(name, TAU_NAME_SEED) & (TAU_NAME_SLOTS - 1)];
+
+	/* The slot holds the only command that can match */
+	if ((cmd < 0) || strcasecmp(tau_commands[cmd].name, name)) {
+		return -1;
+	}
+	return cmd;
+}
+
+
+tauStatus tauCommandCheck(tauCmd cmd, short input_size)
+{
+	const struct tauCommandInfo *info = tauCommandInfo(cmd);
+
+	if (!info) {
+		return CAM_OK;
+	}
+
+	if ((input_size < info->request_min) || (input_size > info->request_max) ||
+	    ((input_size - info->request_min) % info->request_step)) {
+		fprintf(stderr,"%s does not take %d bytes of data\n", info->name, input_size);
+		return CAM_BYTE_COUNT_ERROR;
+	}
+	return CAM_OK;
+}
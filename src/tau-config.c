@@ -0,0 +1,293 @@
+/* libtau camera configuration snapshots
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+#define TAU_CONFIG_LINE 128 /* longest line in a configuration file */
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Finds a setting among the command descriptors
+ * \param cmd the command that gets and sets it
+ * \returns the descriptor, or NULL if cmd isn't a setting
+ */
+static const struct tauCommandInfo *tauSettingFind(unsigned char cmd)
+{
+	const struct tauCommandInfo *info = tauCommandInfo(cmd);
+
+	return (info && (info->flags & TAU_CMD_SETTING)) ? info : NULL;
+}
+
+/** Finds a setting in a configuration
+ * \param config the settings
+ * \param cmd the command that gets and sets it
+ * \returns the setting, or NULL if config doesn't have it
+ */
+static const struct tauParam *tauConfigFind(const struct tauConfig *config, unsigned char cmd)
+{
+	int i;
+
+	for (i = 0; i < config->count; i++) {
+		if (config->params[i].cmd == cmd) {
+			return &config->params[i];
+		}
+	}
+	return NULL;
+}
+
+/** Reads a setting from the camera
+ * \param handler the handler for the Tau camera
+ * \param cmd the command that gets and sets it
+ * \param param holder for the value
+ * \returns the status of the command
+ */
+static tauStatus tauParamGet(tauHandler handler, unsigned char cmd, struct tauParam *param)
+{
+	short count = TAU_PARAM_MAX_SIZE;
+	tauStatus status;
+
+	status = tauDoCmd(handler, cmd, NULL, 0, param->value, &count);
+	param->cmd = cmd;
+	param->size = status == CAM_OK ? count : 0;
+
+	return status;
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+const char *tauParamName(tauCmd cmd)
+{
+	const struct tauCommandInfo *setting = tauSettingFind(cmd);
+
+	return setting ? setting->name : NULL;
+}
+
+
+tauStatus tauConfigSnapshot(tauHandler handler, struct tauConfig *config)
+{
+	const struct tauCommandInfo *setting;
+	struct tauParam *param;
+	tauStatus status;
+	int i;
+
+	config->count = 0;
+
+	/* In code order, which has the modes before the values they govern */
+	for (i = 0; i < 256; i++) {
+		setting = tauSettingFind(i);
+		if (!setting) {
+			continue;
+		}
+		if (config->count == TAU_CONFIG_MAX_PARAMS) {
+			fprintf(stderr,"More than %d settings in configuration\n", TAU_CONFIG_MAX_PARAMS);
+			return CAM_RANGE_ERROR;
+		}
+
+		param = &config->params[config->count];
+		status = tauParamGet(handler, setting->cmd, param);
+
+		/* Not every model has every setting */
+		if ((status == CAM_UNDEFINED_FUNCTION_ERROR) || (status == CAM_FEATURE_NOT_ENABLED)) {
+			dbg("Camera has no %s", setting->name);
+			continue;
+		}
+		if (status != CAM_OK) {
+			return status;
+		}
+		config->count++;
+	}
+
+	return CAM_OK;
+}
+
+
+int tauConfigDiff(const struct tauConfig *current, const struct tauConfig *desired,
+		  struct tauConfig *changes)
+{
+	const struct tauParam *want, *have;
+	int count = 0;
+	int i;
+
+	for (i = 0; i < desired->count; i++) {
+		want = &desired->params[i];
+		have = tauConfigFind(current, want->cmd);
+
+		if (have && (have->size == want->size) &&
+		    !memcmp(have->value, want->value, want->size)) {
+			continue;
+		}
+
+		if (changes) {
+			changes->params[count] = *want;
+		}
+		count++;
+	}
+
+	if (changes) {
+		changes->count = count;
+	}
+	return count;
+}
+
+
+tauStatus tauConfigApply(tauHandler handler, const struct tauConfig *desired, int save,
+			 struct tauConfig *changes)
+{
+	struct tauConfig current;
+	struct tauConfig differ;
+	struct tauParam echo;
+	tauStatus status;
+	tauStatus result = CAM_OK;
+	short count;
+	int applied = 0;
+	int i;
+
+	if (!changes) {
+		changes = &differ;
+	}
+	changes->count = 0;
+
+	/* Anything else would be run as a command, once to read it back and
+	 * again to set it */
+	for (i = 0; i < desired->count; i++) {
+		if (!tauSettingFind(desired->params[i].cmd)) {
+			fprintf(stderr,"Command 0x%02X is not a setting\n", desired->params[i].cmd);
+			return CAM_RANGE_ERROR;
+		}
+	}
+
+	/* Only what the desired configuration names is read back */
+	current.count = 0;
+	for (i = 0; i < desired->count; i++) {
+		status = tauParamGet(handler, desired->params[i].cmd, &current.params[current.count]);
+		if (status != CAM_OK) {
+			return status;
+		}
+		current.count++;
+	}
+
+	tauConfigDiff(&current, desired, changes);
+
+	for (i = 0; i < changes->count; i++) {
+		dbg("Setting %s", tauParamName(changes->params[i].cmd));
+		count = sizeof(echo.value);
+		status = tauDoCmd(handler, changes->params[i].cmd,
+				  changes->params[i].value, changes->params[i].size,
+				  echo.value, &count);
+		if (status != CAM_OK) {
+			changes->count = applied;
+			return status;
+		}
+
+		/* The camera answers with the value it took, which is not the
+		 * one asked for if it was clamped or refused */
+		if ((count != changes->params[i].size) ||
+		    memcmp(echo.value, changes->params[i].value, count)) {
+			fprintf(stderr,"Camera did not take the value of %s\n",
+				tauParamName(changes->params[i].cmd));
+			result = CAM_RANGE_ERROR;
+			continue;
+		}
+		changes->params[applied++] = changes->params[i];
+	}
+	changes->count = applied;
+
+	/* One save for the lot, and none if nothing changed */
+	if (applied && save) {
+		status = tauDoCmd(handler, SET_DEFAULTS, NULL, 0, NULL, NULL);
+		if (status != CAM_OK) {
+			return status;
+		}
+	}
+
+	return result;
+}
+
+
+int tauConfigWrite(FILE *out, const struct tauConfig *config)
+{
+	const struct tauParam *param;
+	const char *name;
+	int i, j;
+
+	for (i = 0; i < config->count; i++) {
+		param = &config->params[i];
+		fprintf(out, "%02X ", param->cmd);
+		for (j = 0; j < param->size; j++) {
+			fprintf(out, "%02X", (unsigned char)param->value[j]);
+		}
+		name = tauParamName(param->cmd);
+		fprintf(out, "%s%s\n", name ? "  # " : "", name ? name : "");
+	}
+
+	return ferror(out) ? -1 : 0;
+}
+
+
+int tauConfigRead(FILE *in, struct tauConfig *config)
+{
+	char line[TAU_CONFIG_LINE];
+	char cmd[2];
+	struct tauParam *param;
+	char *ptr, *value;
+	int digits;
+
+	config->count = 0;
+
+	while (fgets(line, sizeof(line), in)) {
+		line[strcspn(line, "#\r\n")] = '\0';
+		ptr = line + strspn(line, " \t");
+		if (!*ptr) {
+			continue;
+		}
+
+		if (config->count == TAU_CONFIG_MAX_PARAMS) {
+			fprintf(stderr,"More than %d settings in configuration\n", TAU_CONFIG_MAX_PARAMS);
+			return -1;
+		}
+		param = &config->params[config->count];
+
+		/* <command> <value>, both hex, the value up to TAU_PARAM_MAX_SIZE bytes */
+		if (!isxdigit(ptr[0]) || !isxdigit(ptr[1]) || !isblank(ptr[2]) ||
+		    (asciiHexToBinary(cmd, 1, ptr) != 1)) {
+			fprintf(stderr,"Invalid setting: '%s'\n", line);
+			return -1;
+		}
+		if (!tauSettingFind(cmd[0])) {
+			fprintf(stderr,"Not a setting: '%s'\n", line);
+			return -1;
+		}
+		param->cmd = cmd[0];
+		value = ptr += 2;
+
+		digits = 0;
+		while (*ptr) {
+			if (isxdigit(*ptr)) {
+				digits++;
+			} else if (!isblank(*ptr)) {
+				break;
+			}
+			ptr++;
+		}
+		if (*ptr || (digits % 2) || (digits / 2 > TAU_PARAM_MAX_SIZE)) {
+			fprintf(stderr,"Invalid setting value: '%s'\n", line);
+			return -1;
+		}
+		param->size = asciiHexToBinary(param->value, TAU_PARAM_MAX_SIZE, value);
+		config->count++;
+	}
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+/* tau-crcgen - generates the CCITT16 CRC tables used by tau-utils.c
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ *
+ * Runs on the build machine, writes a C header to stdout.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+/************************************************************************
+ * Constants
+ ************************************************************************/
+
+#define P_CCITT     0x1021
+#define SLICES      8
+#define FOLDS       4
+
+/************************************************************************
+ * Private Functions
+ ************************************************************************/
+
+/** Returns x^n mod P, the CCITT16 polynomial
+ * \param n power of x
+ * \return remainder, a polynomial of degree less than 16
+ */
+static uint16_t x_pow_mod(unsigned int n)
+{
+	uint32_t r = 1;
+
+	while (n--) {
+		r <<= 1;
+		if (r & 0x10000) {
+			r ^= 0x10000 | P_CCITT;
+		}
+	}
+	return r;
+}
+
+/***************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	uint16_t tab[SLICES][256];
+	uint16_t crc, c;
+	int i, j, k;
+
+	/* tab[0][i] is the CRC of byte i, tab[k][i] the CRC of byte i
+	 * followed by k zero bytes */
+	for (i = 0; i < 256; i++) {
+		crc = 0;
+		c = ((uint16_t) i) << 8;
+
+		for (j = 0; j < 8; j++) {
+			if ((crc ^ c) & 0x8000) {
+				crc = (crc << 1) ^ P_CCITT;
+			} else {
+				crc = crc << 1;
+			}
+			c = c << 1;
+		}
+		tab[0][i] = crc;
+	}
+
+	for (k = 1; k < SLICES; k++) {
+		for (i = 0; i < 256; i++) {
+			tab[k][i] = (tab[k-1][i] << 8) ^ tab[0][tab[k-1][i] >> 8];
+		}
+	}
+
+	printf("/* Generated by tau-crcgen, do not edit */\n\n");
+
+	printf("static const uint16_t crc_tabccitt[%d][256] = {\n", SLICES);
+	for (k = 0; k < SLICES; k++) {
+		printf("\t{");
+		for (i = 0; i < 256; i++) {
+			printf("%s0x%04X,", (i % 8) ? " " : "\n\t\t", tab[k][i]);
+		}
+		printf("\n\t},\n");
+	}
+	printf("};\n\n");
+
+	/* Folding a 128 bit block k blocks forward multiplies its upper
+	 * and lower 64 bits by x^(128k+64) and x^(128k) */
+	printf("static const uint64_t crc_foldccitt[%d][2] = {\n", FOLDS);
+	for (k = 1; k <= FOLDS; k++) {
+		printf("\t{ 0x%04X, 0x%04X },\n", x_pow_mod(128 * k + 64), x_pow_mod(128 * k));
+	}
+	printf("};\n");
+
+	return 0;
+}
@@ -0,0 +1,214 @@
+/* libtau multi-camera event loop
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+#define TAU_FLEET_EVENTS 64 /* epoll events handled per wakeup */
+
+/** A camera driven by the fleet */
+struct tauFleetMember {
+	tauHandler handler;
+	short events; /* poll() events currently registered with epoll */
+};
+
+struct tauFleet {
+	int epoll_fd;
+	struct tauFleetMember *members;
+	int count;
+	int size;
+};
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Converts poll() events as returned by tauAsyncEvents() to epoll events
+ * \param events poll() events
+ * \returns epoll events
+ */
+static uint32_t tauFleetEpollEvents(short events)
+{
+	uint32_t epoll_events = 0;
+
+	if (events & POLLIN) {
+		epoll_events |= EPOLLIN;
+	}
+	if (events & POLLOUT) {
+		epoll_events |= EPOLLOUT;
+	}
+	return epoll_events;
+}
+
+/** Brings the events epoll watches for a member in line with what its
+ *  pending commands need
+ * \param fleet the fleet
+ * \param index member to update
+ * \returns zero on success, -1 on error
+ */
+static int tauFleetWatch(tauFleet *fleet, int index)
+{
+	struct tauFleetMember *member = &fleet->members[index];
+	struct epoll_event ev;
+	short events = tauAsyncEvents(member->handler);
+
+	if (events == member->events) {
+		return 0;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = tauFleetEpollEvents(events);
+	ev.data.u32 = index;
+
+	if (epoll_ctl(fleet->epoll_fd, EPOLL_CTL_MOD, tauFd(member->handler), &ev) < 0) {
+		perror("Unable to update camera events");
+		return -1;
+	}
+
+	member->events = events;
+	return 0;
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauFleet *tauFleetCreate(void)
+{
+	tauFleet *fleet;
+
+	fleet = calloc(1, sizeof(*fleet));
+	if (!fleet) {
+		fprintf(stderr,"%s: failed to allocate fleet\n",__FUNCTION__);
+		return NULL;
+	}
+
+	fleet->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fleet->epoll_fd < 0) {
+		perror("Unable to create fleet event loop");
+		free(fleet);
+		return NULL;
+	}
+
+	return fleet;
+}
+
+
+int tauFleetAdd(tauFleet *fleet, tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct epoll_event ev;
+
+	if (!link) {
+		return -1;
+	}
+
+	if (fleet->count == fleet->size) {
+		int size = fleet->size ? fleet->size * 2 : 16;
+		struct tauFleetMember *members;
+
+		members = realloc(fleet->members, size * sizeof(*members));
+		if (!members) {
+			fprintf(stderr,"%s: failed to allocate fleet members\n",__FUNCTION__);
+			return -1;
+		}
+		fleet->members = members;
+		fleet->size = size;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.u32 = fleet->count;
+
+	if (epoll_ctl(fleet->epoll_fd, EPOLL_CTL_ADD, tauFd(handler), &ev) < 0) {
+		perror("Unable to add camera to fleet");
+		return -1;
+	}
+
+	/* Whatever the camera sent before joining is of no interest, it is
+	 * thrown away before the first command without waiting */
+	link->stale = 1;
+
+	fleet->members[fleet->count].handler = handler;
+	fleet->members[fleet->count].events = 0;
+	fleet->count++;
+
+	return 0;
+}
+
+
+tauStatus tauFleetRun(tauFleet *fleet)
+{
+	struct epoll_event events[TAU_FLEET_EVENTS];
+	int pending, timeout, ms;
+	int ret;
+	int i;
+
+	while (1) {
+		pending = 0;
+		timeout = -1;
+
+		/* Commands may have been submitted by completion callbacks or
+		 * from outside the loop, so refresh what each camera waits for */
+		for (i = 0; i < fleet->count; i++) {
+			if (tauFleetWatch(fleet, i) < 0) {
+				return CAM_COMMUNICATION_ERROR;
+			}
+			if (!fleet->members[i].events) {
+				continue;
+			}
+			pending = 1;
+			ms = tauAsyncTimeout(fleet->members[i].handler);
+			if ((ms >= 0) && ((timeout < 0) || (ms < timeout))) {
+				timeout = ms;
+			}
+		}
+
+		if (!pending) {
+			return CAM_OK;
+		}
+
+		ret = epoll_wait(fleet->epoll_fd, events, TAU_FLEET_EVENTS, timeout);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Fleet event loop failed");
+			return CAM_COMMUNICATION_ERROR;
+		}
+
+		for (i = 0; i < ret; i++) {
+			tauAsyncStep(fleet->members[events[i].data.u32].handler);
+		}
+
+		/* Let cameras whose deadline passed report their timeout, even
+		 * while others keep the loop busy */
+		for (i = 0; i < fleet->count; i++) {
+			if (fleet->members[i].events &&
+			    !tauAsyncTimeout(fleet->members[i].handler)) {
+				tauAsyncStep(fleet->members[i].handler);
+			}
+		}
+	}
+}
+
+
+void tauFleetDestroy(tauFleet *fleet)
+{
+	if (!fleet) {
+		return;
+	}
+	close(fleet->epoll_fd);
+	free(fleet->members);
+	free(fleet);
+}
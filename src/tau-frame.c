@@ -0,0 +1,195 @@
+/* libtau incremental frame parser
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Checks a complete header.  A good header starts the data; a bad one
+ *  was noise or a damaged frame, so parsing starts over at the next
+ *  process code already received, or goes back to scanning for one
+ * \param frame the parser
+ */
+static void tauFrameHeader(struct tauFrame *frame)
+{
+	unsigned char *next;
+	uint16_t value;
+	int shift;
+
+	frame->crc = crcCcitt16((char *)frame->header, 6);
+	memcpy(&value, &frame->header[6], sizeof(value));
+
+	if (ntohs(value) == frame->crc) {
+		frame->crc = crcCcitt16Update(frame->crc, &frame->header[6], 2);
+		memcpy(&value, &frame->header[4], sizeof(value));
+		frame->data_len = ntohs(value);
+		frame->count = 0;
+		frame->state = frame->data_len ? TAU_FRAME_DATA : TAU_FRAME_CRC;
+		return;
+	}
+
+	frame->resyncs++;
+
+	next = memchr(&frame->header[1], TAU_PROCESS_CODE, TAU_HEADER_SIZE - 1);
+	if (!next) {
+		frame->skipped += TAU_HEADER_SIZE;
+		frame->state = TAU_FRAME_SYNC;
+		return;
+	}
+
+	shift = next - frame->header;
+	frame->skipped += shift;
+	memmove(frame->header, next, TAU_HEADER_SIZE - shift);
+	frame->count = TAU_HEADER_SIZE - shift;
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+void tauFrameInit(struct tauFrame *frame, char *data, unsigned short capacity)
+{
+	memset(frame, 0, sizeof(*frame));
+	frame->data = data;
+	frame->capacity = data ? capacity : 0;
+	frame->state = TAU_FRAME_SYNC;
+}
+
+
+void tauFrameRestart(struct tauFrame *frame)
+{
+	frame->state = TAU_FRAME_SYNC;
+	frame->count = 0;
+}
+
+
+unsigned int tauFrameParse(struct tauFrame *frame, const unsigned char *bytes, unsigned int count)
+{
+	const unsigned char *sync;
+	unsigned int used = 0;
+	unsigned int n;
+
+	while ((used < count) && (frame->state != TAU_FRAME_DONE)) {
+		switch (frame->state) {
+		case TAU_FRAME_SYNC:
+			sync = memchr(&bytes[used], TAU_PROCESS_CODE, count - used);
+			if (!sync) {
+				frame->skipped += count - used;
+				used = count;
+				break;
+			}
+			frame->skipped += sync - &bytes[used];
+			used = sync - bytes;
+			frame->count = 0;
+			frame->state = TAU_FRAME_HEADER;
+			break;
+
+		case TAU_FRAME_HEADER:
+			n = TAU_HEADER_SIZE - frame->count;
+			if (n > count - used) {
+				n = count - used;
+			}
+			memcpy(&frame->header[frame->count], &bytes[used], n);
+			frame->count += n;
+			used += n;
+			if (frame->count == TAU_HEADER_SIZE) {
+				tauFrameHeader(frame);
+			}
+			break;
+
+		case TAU_FRAME_DATA:
+			n = frame->data_len - frame->count;
+			if (n > count - used) {
+				n = count - used;
+			}
+			/* Data that doesn't fit still has to be parsed to
+			 * stay in step, it only goes into the crc */
+			if (frame->data_len <= frame->capacity) {
+				memcpy(&frame->data[frame->count], &bytes[used], n);
+			}
+			frame->crc = crcCcitt16Update(frame->crc, &bytes[used], n);
+			frame->count += n;
+			used += n;
+			if (frame->count == frame->data_len) {
+				frame->count = 0;
+				frame->state = TAU_FRAME_CRC;
+			}
+			break;
+
+		case TAU_FRAME_CRC:
+			n = TAU_CRC_SIZE - frame->count;
+			if (n > count - used) {
+				n = count - used;
+			}
+			memcpy(&frame->trailer[frame->count], &bytes[used], n);
+			frame->count += n;
+			used += n;
+			if (frame->count == TAU_CRC_SIZE) {
+				frame->state = TAU_FRAME_DONE;
+			}
+			break;
+
+		case TAU_FRAME_DONE:
+			break;
+		}
+	}
+
+	return used;
+}
+
+
+int tauFrameIntact(const struct tauFrame *frame)
+{
+	uint16_t value;
+
+	memcpy(&value, frame->trailer, sizeof(value));
+	return ntohs(value) == frame->crc;
+}
+
+
+tauStatus tauFrameResult(const struct tauFrame *frame)
+{
+	tauStatus status;
+
+	hexDump("Received response from Tau", (char *)frame->header, TAU_HEADER_SIZE);
+
+	if (frame->skipped) {
+		dbg("Skipped %u bytes of noise, %u bad headers", frame->skipped, frame->resyncs);
+	}
+
+	if (!tauFrameIntact(frame)) {
+		fprintf(stderr,"Packet received from Tau camera contains overall packet CRC error\n");
+		return CAM_CHECKSUM_ERROR;
+	}
+
+	if (frame->data_len && (frame->data_len <= frame->capacity)) {
+		hexDump("Response data", frame->data, frame->data_len);
+	}
+
+	status = frame->header[1];
+	if (status != CAM_OK) {
+		fprintf(stderr,"Camera reports error: %d\n", status);
+		return status;
+	}
+
+	if (frame->data_len > frame->capacity) {
+		if (frame->data) {
+			fprintf(stderr,"Response data does not fit in the receive buffer: %d/%d\n",
+				frame->data_len, frame->capacity);
+			return CAM_COMMUNICATION_ERROR;
+		}
+		fprintf(stderr,"WARNING response data ignored\n");
+	}
+
+	return CAM_OK;
+}
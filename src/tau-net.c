@@ -0,0 +1,212 @@
+/* libtau TCP transport for cameras behind serial to Ethernet bridges
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+#define TAU_NET_KEEPIDLE     2    /* s idle before the first keepalive probe */
+#define TAU_NET_KEEPINTVL    1    /* s between unanswered probes */
+#define TAU_NET_KEEPCNT      3    /* unanswered probes that declare the peer dead */
+#define TAU_NET_USER_TIMEOUT 5000 /* ms sent data may stay unacknowledged */
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Tunes a connected socket for small request and response frames
+ * \param fd the socket
+ */
+static void tauNetTune(int fd)
+{
+	int on = 1;
+	int value;
+
+	/* A request is written with a single call, so with Nagle off it
+	 * leaves in one segment instead of waiting for the previous ack */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	/* An idle connection to a bridge that lost power would otherwise
+	 * look alive until the next command timed out */
+	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+	value = TAU_NET_KEEPIDLE;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &value, sizeof(value));
+	value = TAU_NET_KEEPINTVL;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &value, sizeof(value));
+	value = TAU_NET_KEEPCNT;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &value, sizeof(value));
+#ifdef TCP_USER_TIMEOUT
+	value = TAU_NET_USER_TIMEOUT;
+	setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &value, sizeof(value));
+#endif
+
+	/* Ignored by IPv6 sockets and by networks that don't honor it */
+	value = IPTOS_LOWDELAY;
+	setsockopt(fd, IPPROTO_IP, IP_TOS, &value, sizeof(value));
+}
+
+/** Connects a socket to an address without waiting past a deadline
+ * \param addr address to connect to
+ * \param addrLen size of addr
+ * \param deadline absolute time set by tauDeadlineSet()
+ * \returns the connected socket in blocking mode, or -1 on error
+ */
+static int tauNetConnect(const struct sockaddr *addr, socklen_t addrLen,
+			 const struct timespec *deadline)
+{
+	struct pollfd pfd;
+	socklen_t len;
+	int fd, err, ret;
+
+	fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Unable to create socket");
+		return -1;
+	}
+
+	if (connect(fd, addr, addrLen) < 0) {
+		if (errno != EINPROGRESS) {
+			perror("Unable to connect to Tau camera");
+			close(fd);
+			return -1;
+		}
+
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		do {
+			ret = poll(&pfd, 1, tauDeadlineRemaining(deadline));
+		} while ((ret < 0) && (errno == EINTR));
+
+		if (ret == 0) {
+			fprintf(stderr,"Timed out connecting to Tau camera\n");
+			close(fd);
+			return -1;
+		}
+
+		len = sizeof(err);
+		if ((ret < 0) || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+			errno = ret < 0 ? errno : err;
+			perror("Unable to connect to Tau camera");
+			close(fd);
+			return -1;
+		}
+	}
+
+	/* Exchanges wait with poll(), the same as on a serial port */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	tauNetTune(fd);
+
+	return fd;
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+int tauNetRecover(struct tauLink *link, tauCmd cmd)
+{
+	const struct tauCommandInfo *info;
+	struct timespec deadline;
+	int fd;
+
+	if (!link->net_addr_len) {
+		return 0;
+	}
+
+	dbg("Reconnecting to Tau camera");
+	tauDeadlineSet(&deadline, link->net_connect_ms);
+	fd = tauNetConnect((struct sockaddr *)&link->net_addr, link->net_addr_len, &deadline);
+	if (fd < 0) {
+		return 0;
+	}
+
+	/* The handler is the descriptor, so the new connection takes its
+	 * place and whatever the old one had buffered is gone */
+	if (dup2(fd, link->fd) < 0) {
+		perror("Unable to replace Tau camera connection");
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	link->rx_head = link->rx_tail = 0;
+	link->stale = 0;
+
+	/* Whether the camera acted on the command before the connection
+	 * dropped is unknown */
+	info = tauCommandInfo(cmd);
+	return info && (info->flags & TAU_CMD_IDEMPOTENT);
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauHandler tauOpenFromNetwork(const char *host, unsigned short port, long ms_connect)
+{
+	struct addrinfo hints, *list, *ai;
+	struct timespec deadline;
+	struct tauLink *link;
+	char service[8];
+	int fd = -1;
+	int ret;
+
+	if (!ms_connect) {
+		ms_connect = TAU_NET_CONNECT_TIMEOUT;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%u", port);
+
+	ret = getaddrinfo(host, service, &hints, &list);
+	if (ret) {
+		fprintf(stderr,"Unable to resolve %s: %s\n", host, gai_strerror(ret));
+		return -1;
+	}
+
+	/* Every address shares the one deadline */
+	tauDeadlineSet(&deadline, ms_connect);
+	for (ai = list; ai; ai = ai->ai_next) {
+		fd = tauNetConnect(ai->ai_addr, ai->ai_addrlen, &deadline);
+		if (fd >= 0) {
+			break;
+		}
+	}
+
+	if (fd < 0) {
+		freeaddrinfo(list);
+		return -1;
+	}
+
+	tauOpenFromFd(fd);
+	link = tauLinkGet(fd);
+	if (!link) {
+		freeaddrinfo(list);
+		close(fd);
+		return -1;
+	}
+
+	/* Kept to dial the same address again if the connection drops */
+	memcpy(&link->net_addr, ai->ai_addr, ai->ai_addrlen);
+	link->net_addr_len = ai->ai_addrlen;
+	link->net_connect_ms = ms_connect;
+	freeaddrinfo(list);
+
+	dbg("Connected to %s port %u", host, port);
+	return fd;
+}
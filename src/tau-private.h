@@ -0,0 +1,472 @@
+/* libtau internal definitions shared by the library sources
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+
+#ifndef __TAU_PRIVATE_H
+#define __TAU_PRIVATE_H
+
+#include <ctype.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "tau.h"
+
+#define TAU_RX_RING_SIZE 1024 /* bytes, must be a power of two */
+#define TAU_LATENCY_BUCKETS 96 /* latency histogram buckets, the last one past 29 s */
+#define TAU_PROCESS_CODE 0x6E /* first byte of every packet */
+
+/** Hashes a command name, ignoring case.  Shared with tau-cmdgen, which
+ *  picks the seed that gives every command its own slot
+ * \param name command name
+ * \param seed TAU_NAME_SEED
+ * \returns the hash, the slot is the hash modulo TAU_NAME_SLOTS
+ */
+static inline unsigned int tauNameHash(const char *name, unsigned int seed)
+{
+	unsigned int hash = seed;
+
+	while (*name) {
+		hash = (hash ^ toupper((unsigned char)*name++)) * 16777619u;
+	}
+	return hash ^ (hash >> 16);
+}
+
+struct tauAsyncRequest;
+struct tauCache;
+struct tauCmdStats;
+struct tauShare;
+struct tauTrace;
+
+/** Where the frame parser is within a packet */
+enum tauFrameState {
+	TAU_FRAME_SYNC,   /* looking for a process code */
+	TAU_FRAME_HEADER, /* collecting the header */
+	TAU_FRAME_DATA,   /* header checked out, receiving the data */
+	TAU_FRAME_CRC,    /* receiving the packet crc */
+	TAU_FRAME_DONE,   /* complete packet, see tauFrameResult() */
+};
+
+/** Incremental packet parser.  Bytes are fed as they arrive, the data goes
+ *  straight to its destination and into the crc, and anything that isn't
+ *  a packet with a good header crc is skipped */
+struct tauFrame {
+	enum tauFrameState state;
+	unsigned char header[TAU_HEADER_SIZE];
+	unsigned char trailer[TAU_CRC_SIZE];
+	unsigned short count;    /* bytes of the current part received */
+	unsigned short data_len; /* data size from the header */
+	unsigned short crc;      /* crc of the packet so far */
+	char *data;              /* destination of the data */
+	unsigned short capacity; /* size of data */
+	unsigned int skipped;    /* noise bytes thrown away */
+	unsigned int resyncs;    /* headers that failed their crc */
+};
+
+/** What a handle learned about the time a command takes */
+struct tauCmdTiming {
+	long override;           /* ms set by tauSetCmdTimeout(), zero for the model */
+	short response_size;     /* response data bytes last returned */
+	unsigned int samples;    /* latencies in the histogram */
+	unsigned short latency[TAU_LATENCY_BUCKETS]; /* camera processing time */
+};
+
+/** State libtau keeps for each open handle */
+struct tauLink {
+	int fd;
+	/* Received data not yet consumed by the packet routines. Indexes are
+	 * free running, the ring position is the index modulo the ring size */
+	unsigned char rx_ring[TAU_RX_RING_SIZE];
+	unsigned int rx_head; /* next byte to hand out */
+	unsigned int rx_tail; /* next free slot */
+	int stale; /* last exchange failed, a late response may still arrive */
+
+	/* Requests submitted with tauSubmitCmd(), the head one is in flight */
+	struct tauAsyncRequest *async_head;
+	struct tauAsyncRequest *async_tail;
+
+	/* Line rate, zero when the handle is not a serial port */
+	long baud;                   /* rate both ends use now */
+	long open_baud;              /* rate the port was opened at */
+	long max_baud;               /* fastest rate rate control may pick */
+	int rate_control;            /* adjust the rate to the error rate */
+	int rate_switching;          /* a rate change is in progress */
+	unsigned int rate_exchanges; /* exchanges since the rate last changed */
+	unsigned int rate_errors;    /* line errors in the current window */
+	unsigned int rate_probe;     /* clean exchanges before trying faster */
+
+	/* Address of a network camera, to reconnect to; zero length otherwise */
+	struct sockaddr_storage net_addr;
+	socklen_t net_addr_len;
+	long net_connect_ms;
+
+	/* Cached responses, NULL unless enabled with tauCacheEnable() */
+	struct tauCache *cache;
+
+	/* Response timing per command, allocated the first time it is used */
+	struct tauCmdTiming *timing[256];
+
+	/* Counters, and the phase times of each command, allocated the first
+	 * time it is exchanged */
+	struct tauStats stats;
+	struct tauCmdStats *cmd_stats[256];
+	/* When the exchange in progress started and each of its phases ended */
+	struct timespec marks[TAU_PHASE_COUNT + 1];
+	int marked; /* entries of marks set, zero between exchanges */
+
+	/* Retry policy, all zero for the default */
+	struct tauRetryPolicy retry;
+	unsigned int retry_seed; /* jitter of the waits */
+	int rejected; /* the camera answered the last exchange with an error */
+
+	/* Wire trace, NULL unless started with tauTraceStart() */
+	struct tauTrace *trace;
+
+	/* I/O thread and submission queue, NULL unless shared with tauShare() */
+	struct tauShare *share;
+};
+
+/** Returns the state associated with a handler, creating it on first use
+ * \param handler a tau handler used to exchange data with a Tau camera
+ * \returns the link state, or NULL if the handler is invalid or out of memory
+ */
+struct tauLink *tauLinkGet(tauHandler handler);
+
+/** Computes an absolute deadline msWait milliseconds from now
+ * \param deadline holder for the deadline
+ * \param msWait number of milliseconds from now
+ */
+void tauDeadlineSet(struct timespec *deadline, long msWait);
+
+/** Returns the number of milliseconds left before a deadline, rounded up
+ * \param deadline absolute time set by tauDeadlineSet()
+ * \returns milliseconds left, zero if the deadline has passed
+ */
+int tauDeadlineRemaining(const struct timespec *deadline);
+
+/** Writes buffers to the camera with a single call
+ * \param link state of the handle
+ * \param iov buffers to send
+ * \param iovcnt number of buffers
+ * \returns number of bytes written, -1 on error with errno set
+ */
+ssize_t tauLinkWritev(struct tauLink *link, const struct iovec *iov, int iovcnt);
+
+/** Moves everything the camera has sent into the receive ring with a
+ *  single read, without waiting
+ * \param link state of the handle being read
+ * \returns number of bytes read, zero if nothing was available or the ring
+ *  is full, negative on error or end of file
+ */
+int tauReadRing(struct tauLink *link);
+
+/** Waits until the camera sends data or the deadline passes, then moves
+ *  everything available into the receive ring with a single read
+ * \param link state of the handle being read
+ * \param deadline absolute time after which to give up
+ * \returns tauStatus indicating the outcome of the attempted data read
+ */
+tauStatus tauFillRing(struct tauLink *link, const struct timespec *deadline);
+
+/** Takes up to count bytes out of the receive ring
+ * \param link state of the handle being read
+ * \param buffer holder for the data
+ * \param count maximum number of bytes to take
+ * \returns number of bytes stored in buffer
+ */
+unsigned int tauTakeRing(struct tauLink *link, char *buffer, unsigned int count);
+
+/** Prepares a parser for the next packet
+ * \param frame the parser
+ * \param data (optional, may be NULL) destination of the packet data
+ * \param capacity size of data
+ */
+void tauFrameInit(struct tauFrame *frame, char *data, unsigned short capacity);
+
+/** Goes back to scanning for a packet, keeping the destination and counters
+ * \param frame the parser
+ */
+void tauFrameRestart(struct tauFrame *frame);
+
+/** Feeds received bytes to a parser, stopping at the end of a packet
+ * \param frame the parser
+ * \param bytes received data
+ * \param count number of bytes
+ * \returns number of bytes used, less than count only if the packet ended
+ */
+unsigned int tauFrameParse(struct tauFrame *frame, const unsigned char *bytes, unsigned int count);
+
+/** Tells whether a complete packet arrived undamaged
+ * \param frame a parser in the TAU_FRAME_DONE state
+ * \returns nonzero if the packet crc checks out
+ */
+int tauFrameIntact(const struct tauFrame *frame);
+
+/** Checks a complete packet: crc, camera status, and whether the data fit
+ * \param frame a parser in the TAU_FRAME_DONE state
+ * \returns the status of the command
+ */
+tauStatus tauFrameResult(const struct tauFrame *frame);
+
+/** Feeds everything in the receive ring to a parser, without waiting
+ * \param link state of the handle being read
+ * \param frame the parser
+ * \returns nonzero once the packet is complete
+ */
+int tauParseRing(struct tauLink *link, struct tauFrame *frame);
+
+/** Throws away received data until the camera has been quiet for msQuiet
+ * \param link state of the handle being flushed
+ * \param msQuiet milliseconds without data that end the flush, zero only
+ *        discards what has already arrived
+ */
+void tauDiscardInput(struct tauLink *link, int msQuiet);
+
+/** Converts a Tau camera command, status and assoicated data into a packet with CRCs
+ * \param cmd Tau camera command
+ * \param status value for the packet status byte
+ * \param buffer to hold packet
+ * \param bufferCount on entry indicates the buffer size, on exit contains the
+ *        size of the packet (including the packet data) in bytes
+ * \param data holds data to be included in the packet
+ * \param dataSize number of data bytes in the data buffer
+ */
+void tauBuildPacket(tauCmd cmd, tauStatus status, char *buffer, short *bufferCount, char *data, short dataSize);
+
+/** Converts a Tau camera command and assoicated data into a request packet with CRCs
+ * \param cmd Tau camera command
+ * \param buffer to hold packet
+ * \param bufferCount on entry indicates the buffer size, on exit contains the
+ *        size of the packet (including the packet data) in bytes
+ * \param data holds data to be included in the packet
+ * \param dataSize number of data bytes in the data buffer
+ */
+void tauBuildRequest(tauCmd cmd, char *buffer, short *bufferCount, char *data, short dataSize);
+
+/** Sends a command and receives its response, like tauDoCmd() but with
+ *  a caller chosen timeout and without rate control
+ * \param link state of the handle
+ * \param cmd the command to send to the camera
+ * \param input (optional, may be NULL) data sent to the camera
+ * \param inputSize number of bytes in input
+ * \param output (optional, may be NULL) holder for the response data
+ * \param outputCount on entry the size of output, on exit the amount of
+ *        valid data in output
+ * \param msWait number of milliseconds to wait for the response
+ * \returns the status of the camera
+ */
+tauStatus tauCommand(struct tauLink *link, tauCmd cmd, char *input, short inputSize,
+		     char *output, short *outputCount, long msWait);
+
+/** Answers a request from the cache, if the response is there
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \param input request data
+ * \param inputSize bytes of request data
+ * \param output (optional, may be NULL) holder for the response data
+ * \param outputCount on entry the size of output, on exit the amount of
+ *        valid data in output
+ * \returns nonzero if the request was answered
+ */
+int tauCacheLookup(struct tauLink *link, tauCmd cmd, const char *input, short inputSize,
+		   char *output, short *outputCount);
+
+/** Accounts for an exchange in the cache: stores the response of a
+ *  cacheable request, or drops what the command may have changed
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \param input request data
+ * \param inputSize bytes of request data
+ * \param status outcome of the exchange
+ * \param output (optional, may be NULL) response data
+ * \param outputCount bytes of response data
+ */
+void tauCacheUpdate(struct tauLink *link, tauCmd cmd, const char *input, short inputSize,
+		    tauStatus status, const char *output, short outputCount);
+
+/** Frees the cache of a handle
+ * \param link state of the handle
+ */
+void tauCacheFree(struct tauLink *link);
+
+/** Connects a network camera again after its connection failed
+ * \param link state of the handle
+ * \param cmd the command that failed
+ * \returns nonzero if the link was reconnected and cmd is safe to send again
+ */
+int tauNetRecover(struct tauLink *link, tauCmd cmd);
+
+/** Decides whether to send a failed command again, and counts the retry
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \param status outcome of the last attempt
+ * \param attempt number of times the command was sent so far
+ * \returns milliseconds to wait before sending it again, -1 to give up
+ */
+long tauRetryWait(struct tauLink *link, tauCmd cmd, tauStatus status, int attempt);
+
+/** Looks up the termios speed for a line rate
+ * \param rate bits per second
+ * \param speed holder for the termios speed
+ * \returns zero on success, -1 if the rate is not supported
+ */
+int tauRateSpeed(long rate, speed_t *speed);
+
+/** Accounts for the outcome of an exchange and changes the line rate
+ *  when the error rate calls for it, if rate control is enabled
+ * \param link state of the handle
+ * \param status outcome of the exchange
+ */
+void tauRateControl(struct tauLink *link, tauStatus status);
+
+/** Returns how long to wait for the response to a command: the time the
+ *  frames take on the wire at the current rate plus the processing time
+ *  learned for the command, or its budget until enough was learned
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \param inputSize number of bytes of request data
+ * \param outputSize largest amount of response data expected
+ * \returns milliseconds
+ */
+long tauTimeoutFor(struct tauLink *link, tauCmd cmd, short inputSize, short outputSize);
+
+/** Returns the time bytes take on the wire at the current rate
+ * \param link state of the handle
+ * \param bytes number of bytes, 8N1
+ * \returns microseconds, zero if the link is not a serial port
+ */
+long tauWireTimeUs(struct tauLink *link, long bytes);
+
+/** Learns from the time an exchange took
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \param status outcome of the exchange
+ * \param inputSize number of bytes of request data
+ * \param outputCount number of bytes of response data received
+ * \param start when the request started going out
+ */
+void tauTimeoutRecord(struct tauLink *link, tauCmd cmd, tauStatus status,
+		      short inputSize, short outputCount, const struct timespec *start);
+
+/** Releases the timing state of a handle
+ * \param link state of the handle
+ */
+void tauTimeoutFree(struct tauLink *link);
+
+/** Maps a latency to its histogram bucket.  Buckets are a quarter of an
+ *  octave wide, so percentiles are high by at most 25%.  The last bucket
+ *  holds every latency past the limit of the one before it.
+ * \param us latency in microseconds
+ * \returns bucket index, below TAU_LATENCY_BUCKETS
+ */
+int tauLatencyBucket(unsigned long us);
+
+/** Returns the largest latency that falls in a histogram bucket
+ * \param bucket bucket index
+ * \returns latency in microseconds
+ */
+unsigned long tauLatencyBucketLimit(int bucket);
+
+/** Starts timing an exchange
+ * \param link state of the handle
+ */
+void tauStatsStart(struct tauLink *link);
+
+/** Notes that a phase of the exchange being timed ended, along with any
+ *  phase before it that wasn't noted.  Does nothing between exchanges or
+ *  if the phase already ended
+ * \param link state of the handle
+ * \param phase the phase
+ */
+void tauStatsMark(struct tauLink *link, enum tauPhase phase);
+
+/** Accounts for the outcome of an exchange and the phases it got through
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \param status outcome of the exchange
+ */
+void tauStatsRecord(struct tauLink *link, tauCmd cmd, tauStatus status);
+
+/** Releases the phase times of a handle
+ * \param link state of the handle
+ */
+void tauStatsFree(struct tauLink *link);
+
+/** Records data that went over the link in the trace.  Only called when
+ *  link->trace is set
+ * \param link state of the handle
+ * \param type TAU_TRACE_TX or TAU_TRACE_RX
+ * \param iov buffers holding the data
+ * \param length bytes to record from the start of the buffers
+ */
+void tauTraceData(struct tauLink *link, enum tauTraceType type, const struct iovec *iov,
+		  size_t length);
+
+/** Records an event in the trace.  Only called when link->trace is set
+ * \param link state of the handle
+ * \param type the event
+ * \param data what enum tauTraceType says the event holds
+ * \param length bytes of data
+ */
+void tauTraceEvent(struct tauLink *link, enum tauTraceType type, const void *data,
+		   size_t length);
+
+/** Records what the parser made of the data fed to it by tauParseRing().
+ *  Only called when link->trace is set
+ * \param link state of the handle
+ * \param frame the parser
+ * \param skipped noise bytes the parser had thrown away before
+ * \param resyncs bad headers the parser had seen before
+ * \param done nonzero if the packet is complete
+ */
+void tauTraceFrame(struct tauLink *link, const struct tauFrame *frame,
+		   unsigned int skipped, unsigned int resyncs, int done);
+
+/** Records the end of an exchange in the trace, if the handle is traced
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \param status outcome of the exchange
+ */
+void tauTraceResult(struct tauLink *link, tauCmd cmd, tauStatus status);
+
+/** Flushes and releases the trace of a handle
+ * \param link state of the handle
+ */
+void tauTraceFree(struct tauLink *link);
+
+/** Completes every submitted request with the given status, used when the
+ *  handle goes away
+ * \param link state of the handle
+ * \param status status reported to the completion callbacks
+ */
+void tauAsyncCancel(struct tauLink *link, tauStatus status);
+
+/** Tells whether commands on a handle have to go through its I/O thread
+ * \param link state of the handle
+ * \returns nonzero if the handle is shared and this is not its I/O thread
+ */
+int tauShareForeign(struct tauLink *link);
+
+/** Has the I/O thread of a shared handle exchange a command, and waits for
+ *  the response
+ * \param link state of a shared handle
+ * \param cmd the command to send to the camera
+ * \param input (optional, may be NULL) data sent to the camera
+ * \param inputSize number of bytes in input
+ * \param output (optional, may be NULL) holder for the response data
+ * \param outputCount on entry the size of output, on exit the amount of
+ *        valid data in output
+ * \returns the status of the command
+ */
+tauStatus tauShareCmd(struct tauLink *link, tauCmd cmd, char *input, short inputSize,
+		      char *output, short *outputCount);
+
+/** Stops the I/O thread of a shared handle once it exchanged the commands
+ *  submitted so far
+ * \param link state of the handle
+ */
+void tauShareStop(struct tauLink *link);
+
+#endif
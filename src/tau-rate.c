@@ -0,0 +1,495 @@
+/* libtau serial line rate negotiation and control
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+#define TAU_RATE_SETTLE       10   /* ms for the camera UART to change rate */
+#define TAU_RATE_VERIFY_WAIT  100  /* ms for the NO_OP that proves a new rate */
+#define TAU_RATE_WINDOW       32   /* exchanges errors are counted over */
+#define TAU_RATE_MAX_ERRORS   4    /* errors in a window that lower the rate */
+#define TAU_RATE_PROBE        1024 /* clean exchanges before trying a faster rate */
+#define TAU_RATE_PROBE_MAX    (64 * TAU_RATE_PROBE)
+#define TAU_DETECT_WAIT       15   /* ms for the camera to answer a detection NO_OP */
+#define TAU_DETECT_ROUNDS     2    /* times every rate is tried before giving up */
+#define TAU_DETECT_PATH       256  /* longest rate file name */
+
+/** A line rate both the host and the camera may use */
+struct tauRate {
+	long rate;           /* bits per second */
+	speed_t speed;       /* termios speed */
+	unsigned short code; /* BAUD_RATE command argument */
+};
+
+/* Slowest first, the camera's codes are from the Tau 2 IDD */
+static const struct tauRate tau_rates[] = {
+	{ 9600,   B9600,   0x0001 },
+	{ 19200,  B19200,  0x0002 },
+	{ 57600,  B57600,  0x0004 },
+	{ 115200, B115200, 0x0005 },
+#ifdef B460800
+	{ 460800, B460800, 0x0006 },
+#endif
+#ifdef B921600
+	{ 921600, B921600, 0x0007 },
+#endif
+};
+
+#define TAU_RATE_COUNT ((int)(sizeof(tau_rates) / sizeof(tau_rates[0])))
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Finds a rate in the table
+ * \param rate bits per second
+ * \returns index in tau_rates, or -1 if the rate is not supported
+ */
+static int tauRateIndex(long rate)
+{
+	int i;
+
+	for (i = 0; i < TAU_RATE_COUNT; i++) {
+		if (tau_rates[i].rate == rate) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** Changes the host side of the line, after the pending output is sent
+ * \param fd serial port
+ * \param speed termios speed
+ * \returns zero on success, -1 if the port refuses the speed
+ */
+static int tauSetPortSpeed(int fd, speed_t speed)
+{
+	struct termios ios;
+
+	if (tcgetattr(fd, &ios) < 0) {
+		return -1;
+	}
+
+	if ((cfsetispeed(&ios, speed) < 0) || (cfsetospeed(&ios, speed) < 0)) {
+		return -1;
+	}
+
+	tcdrain(fd);
+	if (tcsetattr(fd, TCSANOW, &ios) < 0) {
+		return -1;
+	}
+
+	/* Some drivers accept any speed and quietly keep the old one */
+	if ((tcgetattr(fd, &ios) < 0) || (cfgetospeed(&ios) != speed)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Tells the camera to use a rate, switches the port and checks the
+ *  camera answers at the new rate, putting both back if it doesn't
+ * \param link state of the handle
+ * \param to index of the new rate in tau_rates
+ * \returns CAM_OK once both ends use the new rate
+ */
+static tauStatus tauSwitchRate(struct tauLink *link, int to)
+{
+	int from = tauRateIndex(link->baud);
+	uint16_t code;
+	char reply[2];
+	short reply_count = sizeof(reply);
+	tauStatus status;
+
+	if (from < 0) {
+		return CAM_FEATURE_NOT_ENABLED;
+	}
+
+	if (from == to) {
+		return CAM_OK;
+	}
+
+	dbg("Switching from %ld to %ld baud", link->baud, tau_rates[to].rate);
+
+	link->rate_switching = 1;
+
+	/* The camera answers at the old rate, then changes */
+	code = htons(tau_rates[to].code);
+	status = tauCommand(link, BAUD_RATE, (char *)&code, sizeof(code),
+			    reply, &reply_count, tauTimeoutFor(link, BAUD_RATE, sizeof(code), sizeof(reply)));
+	if (status != CAM_OK) {
+		link->rate_switching = 0;
+		return status;
+	}
+
+	usleep(TAU_RATE_SETTLE * 1000);
+
+	if (tauSetPortSpeed(link->fd, tau_rates[to].speed) == 0) {
+		tauDiscardInput(link, 0);
+		status = tauCommand(link, NO_OP, NULL, 0, NULL, NULL, TAU_RATE_VERIFY_WAIT);
+		if (status == CAM_OK) {
+			link->baud = tau_rates[to].rate;
+			link->rate_exchanges = 0;
+			link->rate_errors = 0;
+			link->rate_switching = 0;
+			return CAM_OK;
+		}
+	} else {
+		status = CAM_FEATURE_NOT_ENABLED;
+	}
+
+	/* Fall back: the camera may or may not have changed rate, ask it to
+	 * go back at the new rate, then make sure it answers at the old one */
+	fprintf(stderr,"Unable to use %ld baud, staying at %ld\n", tau_rates[to].rate, link->baud);
+	code = htons(tau_rates[from].code);
+	reply_count = sizeof(reply);
+	tauCommand(link, BAUD_RATE, (char *)&code, sizeof(code), reply, &reply_count,
+		   TAU_RATE_VERIFY_WAIT);
+	usleep(TAU_RATE_SETTLE * 1000);
+	tauSetPortSpeed(link->fd, tau_rates[from].speed);
+	tauDiscardInput(link, 0);
+
+	if (tauCommand(link, NO_OP, NULL, 0, NULL, NULL, TAU_RATE_VERIFY_WAIT) != CAM_OK) {
+		fprintf(stderr,"Tau camera lost while changing baud rate\n");
+		status = CAM_COMMUNICATION_ERROR;
+	}
+
+	link->rate_exchanges = 0;
+	link->rate_errors = 0;
+	link->rate_switching = 0;
+
+	return status;
+}
+
+/** Names the file that remembers the rate a device was last found at
+ * \param dir directory holding the file
+ * \param device path of the serial device
+ * \param path holder for the file name
+ * \param size size of path
+ */
+static void tauDetectPath(const char *dir, const char *device, char *path, size_t size)
+{
+	int len, i;
+
+	/* The device path flattened into one name, so by-id links keep
+	 * their own rate */
+	len = snprintf(path, size, "%s/tau-rate", dir);
+	for (i = 0; device[i] && (len + 1 < (int)size); i++) {
+		path[len++] = (device[i] == '/') ? '_' : device[i];
+	}
+	path[len < (int)size ? len : (int)size - 1] = '\0';
+}
+
+/** Reads the rate a device was last found at
+ * \param dir (optional, may be NULL) directory holding the rate files
+ * \param device path of the serial device
+ * \returns index in tau_rates, or -1 if the rate is not known
+ */
+static int tauDetectLoad(const char *dir, const char *device)
+{
+	char path[TAU_DETECT_PATH];
+	long rate;
+	FILE *in;
+	int ok;
+
+	if (!dir) {
+		return -1;
+	}
+
+	tauDetectPath(dir, device, path, sizeof(path));
+	in = fopen(path, "r");
+	if (!in) {
+		return -1;
+	}
+	ok = fscanf(in, "%ld", &rate) == 1;
+	fclose(in);
+
+	return ok ? tauRateIndex(rate) : -1;
+}
+
+/** Remembers the rate a device was found at for the next detection
+ * \param dir directory holding the rate files
+ * \param device path of the serial device
+ * \param rate bits per second
+ */
+static void tauDetectSave(const char *dir, const char *device, long rate)
+{
+	char path[TAU_DETECT_PATH];
+	char temp[TAU_DETECT_PATH + 4];
+	FILE *out;
+
+	tauDetectPath(dir, device, path, sizeof(path));
+
+	/* Written next to the old file and renamed over it, so a reader
+	 * never sees half of it */
+	snprintf(temp, sizeof(temp), "%s.new", path);
+	out = fopen(temp, "w");
+	if (!out) {
+		perror("Unable to create rate file");
+		return;
+	}
+
+	fprintf(out, "%ld\n", rate);
+	if (fclose(out) || rename(temp, path)) {
+		perror("Unable to write rate file");
+		unlink(temp);
+	}
+}
+
+/** Sends a NO_OP at one rate and waits just long enough for the answer.
+ *  The frame parser checks the header crc as the bytes arrive, so the
+ *  noise a camera at another rate makes is turned down as soon as a
+ *  header fails instead of at the deadline
+ * \param link state of the handle, a serial port
+ * \param index rate to try in tau_rates
+ * \param request NO_OP request packet
+ * \param size bytes in request
+ * \returns nonzero if the camera answered at the rate
+ */
+static int tauDetectProbe(struct tauLink *link, int index, char *request, short size)
+{
+	struct timespec deadline;
+	struct tauFrame frame;
+	struct iovec iov;
+	tauStatus status = CAM_OK;
+
+	if (tauSetPortSpeed(link->fd, tau_rates[index].speed) < 0) {
+		return 0;
+	}
+	link->baud = tau_rates[index].rate;
+
+	/* Whatever arrived at the old rate means nothing at this one */
+	tcflush(link->fd, TCIFLUSH);
+	link->rx_head = link->rx_tail;
+
+	iov.iov_base = request;
+	iov.iov_len = size;
+	if (tauLinkWritev(link, &iov, 1) != size) {
+		return 0;
+	}
+
+	/* The request and the answer on the wire, and a little for the
+	 * camera; a NO_OP takes it no time at all */
+	tauDeadlineSet(&deadline, (tauWireTimeUs(link, 2 * (TAU_HEADER_SIZE + TAU_CRC_SIZE)) + 999) / 1000 +
+		       TAU_DETECT_WAIT);
+	tauFrameInit(&frame, NULL, 0);
+
+	while (status == CAM_OK) {
+		if (tauParseRing(link, &frame)) {
+			return tauFrameIntact(&frame) && (frame.header[3] == NO_OP) &&
+				(frame.header[1] == CAM_OK);
+		}
+		if (frame.resyncs) {
+			vdbg("Noise at %ld baud", link->baud);
+			return 0;
+		}
+		status = tauFillRing(link, &deadline);
+	}
+
+	return 0;
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+int tauRateSpeed(long rate, speed_t *speed)
+{
+	int index = tauRateIndex(rate);
+
+	if (index < 0) {
+		return -1;
+	}
+	*speed = tau_rates[index].speed;
+	return 0;
+}
+
+
+void tauRateControl(struct tauLink *link, tauStatus status)
+{
+	int index;
+
+	if (!link->rate_control || link->rate_switching) {
+		return;
+	}
+
+	if ((status == CAM_CHECKSUM_ERROR) || (status == CAM_TIMEOUT_ERROR) ||
+	    (status == CAM_COMMUNICATION_ERROR)) {
+		link->rate_errors++;
+	}
+	link->rate_exchanges++;
+
+	index = tauRateIndex(link->baud);
+
+	/* Too many errors in the window, slow down */
+	if (link->rate_errors >= TAU_RATE_MAX_ERRORS) {
+		dbg("%u errors in %u exchanges at %ld baud", link->rate_errors,
+		    link->rate_exchanges, link->baud);
+		if ((index > 0) && (tauSwitchRate(link, index - 1) == CAM_OK)) {
+			/* Wait longer before trying the rate that failed again */
+			if (link->rate_probe < TAU_RATE_PROBE_MAX) {
+				link->rate_probe *= 2;
+			}
+		}
+		link->rate_exchanges = 0;
+		link->rate_errors = 0;
+		return;
+	}
+
+	if ((link->rate_exchanges % TAU_RATE_WINDOW) == 0) {
+		link->rate_errors = 0;
+	}
+
+	/* Clean for long enough, try the next faster rate */
+	if ((link->rate_exchanges >= link->rate_probe) && (index + 1 < TAU_RATE_COUNT) &&
+	    (tau_rates[index + 1].rate <= link->max_baud)) {
+		if (tauSwitchRate(link, index + 1) != CAM_OK) {
+			if (link->rate_probe < TAU_RATE_PROBE_MAX) {
+				link->rate_probe *= 2;
+			}
+		}
+		link->rate_exchanges = 0;
+		link->rate_errors = 0;
+	}
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+long tauBaudRate(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	return link ? link->baud : 0;
+}
+
+
+tauStatus tauSetBaudRate(tauHandler handler, long rate)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	int index = tauRateIndex(rate);
+
+	if (!link || !link->baud) {
+		return CAM_FEATURE_NOT_ENABLED;
+	}
+
+	/* The I/O thread of a shared handle may be using the port, and
+	 * requests submitted by tauSubmitCmd() may be on the wire */
+	if (link->share || link->async_head) {
+		return CAM_BUSY;
+	}
+
+	if (index < 0) {
+		fprintf(stderr,"Unsupported baud rate: %ld\n", rate);
+		return CAM_RANGE_ERROR;
+	}
+
+	return tauSwitchRate(link, index);
+}
+
+
+long tauNegotiateBaudRate(tauHandler handler, long max_rate, int adaptive)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	int i;
+
+	if (!link || !link->baud) {
+		return -1;
+	}
+
+	/* The I/O thread of a shared handle may be using the port, and
+	 * requests submitted by tauSubmitCmd() may be on the wire */
+	if (link->share || link->async_head) {
+		return -1;
+	}
+
+	/* Fastest first, the first rate that works wins */
+	for (i = TAU_RATE_COUNT - 1; i >= 0; i--) {
+		if ((tau_rates[i].rate > max_rate) || (tau_rates[i].rate <= link->baud)) {
+			continue;
+		}
+		if (tauSwitchRate(link, i) == CAM_OK) {
+			break;
+		}
+	}
+
+	link->max_baud = max_rate;
+	link->rate_control = adaptive;
+	link->rate_probe = TAU_RATE_PROBE;
+	link->rate_exchanges = 0;
+	link->rate_errors = 0;
+
+	dbg("Negotiated %ld baud", link->baud);
+
+	return link->baud;
+}
+
+
+tauHandler tauOpenFromSerialDetect(char *device, const char *cache_dir)
+{
+	struct tauLink *link;
+	int order[TAU_RATE_COUNT];
+	int count = 0;
+	int known, round, i;
+	char request[TAU_HEADER_SIZE + TAU_CRC_SIZE];
+	short size = sizeof(request);
+	tauHandler handler;
+
+	/* The rate the device was last found at, then the one cameras
+	 * power up at, then the rest fastest first since cameras are moved
+	 * to a faster rate far more often than to a slower one */
+	known = tauDetectLoad(cache_dir, device);
+	if (known >= 0) {
+		order[count++] = known;
+	}
+	i = tauRateIndex(TAU_DEFAULT_BAUD_RATE);
+	if (i != known) {
+		order[count++] = i;
+	}
+	for (i = TAU_RATE_COUNT - 1; i >= 0; i--) {
+		if ((i != known) && (tau_rates[i].rate != TAU_DEFAULT_BAUD_RATE)) {
+			order[count++] = i;
+		}
+	}
+
+	handler = tauOpenFromSerialAtRate(device, tau_rates[order[0]].rate);
+	link = tauLinkGet(handler);
+	if (!link) {
+		return -1;
+	}
+
+	tauBuildRequest(NO_OP, request, &size, NULL, 0);
+
+	/* A camera that was parsing noise when the right rate came may have
+	 * taken the NO_OP as part of it; it is over that by the next round */
+	for (round = 0; round < TAU_DETECT_ROUNDS; round++) {
+		for (i = 0; i < count; i++) {
+			if (tauDetectProbe(link, order[i], request, size)) {
+				link->baud = link->open_baud = tau_rates[order[i]].rate;
+				dbg("Tau camera on %s answers at %ld baud", device, link->baud);
+				if (cache_dir && (order[i] != known)) {
+					tauDetectSave(cache_dir, device, link->baud);
+				}
+				return handler;
+			}
+		}
+	}
+
+	fprintf(stderr,"No Tau camera answers on %s at any baud rate\n", device);
+	link->baud = link->open_baud;
+	tauClose(handler);
+	return -1;
+}
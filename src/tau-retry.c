@@ -0,0 +1,139 @@
+/* libtau retry policy for failed commands
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+static const struct tauRetryPolicy tau_retry_default = {
+	TAU_RETRY_DEFAULT_ATTEMPTS,
+	TAU_RETRY_DEFAULT_BACKOFF,
+	TAU_RETRY_DEFAULT_MAX,
+	TAU_RETRY_DEFAULT_JITTER,
+	TAU_RETRY_DEFAULT_ON,
+};
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Returns the policy a handle follows
+ * \param link state of the handle
+ * \returns the policy
+ */
+static const struct tauRetryPolicy *tauRetryPolicyOf(const struct tauLink *link)
+{
+	return link->retry.attempts ? &link->retry : &tau_retry_default;
+}
+
+/** Maps the outcome of an exchange to the TAU_RETRY_* flag that retries it
+ * \param status outcome of the exchange
+ * \returns the flag, zero for an outcome that is never retried
+ */
+static unsigned int tauRetryKind(tauStatus status)
+{
+	switch (status) {
+	case CAM_CHECKSUM_ERROR:
+		return TAU_RETRY_CHECKSUM;
+	case CAM_BUSY:
+	case CAM_NOT_READY:
+		return TAU_RETRY_BUSY;
+	case CAM_TIMEOUT_ERROR:
+		return TAU_RETRY_TIMEOUT;
+	default:
+		return 0;
+	}
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+long tauRetryWait(struct tauLink *link, tauCmd cmd, tauStatus status, int attempt)
+{
+	const struct tauRetryPolicy *policy = tauRetryPolicyOf(link);
+	const struct tauCommandInfo *info;
+	struct timespec now;
+	long wait;
+	int i;
+
+	if ((attempt >= policy->attempts) || !(policy->flags & tauRetryKind(status))) {
+		return -1;
+	}
+
+	/* Unless the camera said it didn't run the command, it may have */
+	if (!link->rejected && !(policy->flags & TAU_RETRY_UNSAFE)) {
+		info = tauCommandInfo(cmd);
+		if (!info || !(info->flags & TAU_CMD_IDEMPOTENT)) {
+			return -1;
+		}
+	}
+
+	wait = policy->backoff_ms;
+	for (i = 1; (i < attempt) && (wait < policy->backoff_max_ms); i++) {
+		wait *= 2;
+	}
+	if (wait > policy->backoff_max_ms) {
+		wait = policy->backoff_max_ms;
+	}
+
+	/* Cameras that failed together don't all come back at once */
+	if (policy->jitter && wait) {
+		if (!link->retry_seed) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			link->retry_seed = now.tv_nsec ^ link->fd;
+		}
+		wait -= (long)((long long)wait * policy->jitter / 100 *
+			       rand_r(&link->retry_seed) / RAND_MAX);
+	}
+
+	link->stats.retries++;
+	dbg("Command 0x%02X failed with %d, sending it again in %ld ms", (unsigned char)cmd,
+	    status, wait);
+	return wait;
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauStatus tauSetRetryPolicy(tauHandler handler, const struct tauRetryPolicy *policy)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	if (!policy) {
+		memset(&link->retry, 0, sizeof(link->retry));
+		return CAM_OK;
+	}
+
+	if ((policy->attempts < 1) || (policy->backoff_ms < 0) ||
+	    (policy->backoff_max_ms < policy->backoff_ms) ||
+	    (policy->jitter < 0) || (policy->jitter > 100)) {
+		return CAM_RANGE_ERROR;
+	}
+
+	link->retry = *policy;
+	return CAM_OK;
+}
+
+
+tauStatus tauGetRetryPolicy(tauHandler handler, struct tauRetryPolicy *policy)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+	*policy = *tauRetryPolicyOf(link);
+	return CAM_OK;
+}
@@ -0,0 +1,701 @@
+/* libtau scheduler of periodic polls and prioritized commands
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+/** A command queued with tauSchedCommand() */
+struct tauSchedCmd {
+	struct tauSchedCmd *next;
+	tauCmd cmd;
+	short input_size;
+	short output_size;
+	long long queued; /* us, orders it among the polls */
+	tauCompletion done;
+	void *user_data;
+	char input[];
+};
+
+/** A job added with tauSchedPoll().  Times are CLOCK_MONOTONIC in us */
+struct tauSchedJob {
+	int link;                /* index of its camera */
+	tauCmd cmd;
+	char *input;
+	short input_size;
+	short output_size;
+	long long period;
+	long long deadline_after;
+	long long next_release;
+	long long deadline;      /* of the poll that is due or running */
+	int due;                 /* released and not sent yet */
+	int running;
+	long density;            /* ppm of the link the job is budgeted */
+	tauCompletion done;
+	void *user_data;
+	struct tauSchedStats stats;
+};
+
+/** A camera the scheduler sends commands to */
+struct tauSchedLink {
+	tauSched *sched;
+	tauHandler handler;
+	long density;            /* ppm of the link budgeted to jobs */
+	struct tauSchedCmd *head[TAU_PRIORITY_COUNT];
+	struct tauSchedCmd *tail[TAU_PRIORITY_COUNT];
+	int busy;                /* a command of the scheduler is in flight */
+	int job;                 /* the job in flight, -1 for a one-off command */
+	struct tauSchedCmd *cmd; /* the one-off command in flight */
+};
+
+struct tauSched {
+	struct tauSchedLink **links;
+	struct pollfd *fds;
+	int link_count;
+	int link_size;
+	struct tauSchedJob *jobs;
+	int job_count;
+	int job_size;
+	int stopping;
+};
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Returns the time on the scheduler's clock
+ * \returns microseconds
+ */
+static long long tauSchedNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/** Returns the camera of a handler, adding it on first use
+ * \param sched the scheduler
+ * \param handler the handler for the Tau camera
+ * \returns index of the camera, -1 on error
+ */
+static int tauSchedLinkOf(tauSched *sched, tauHandler handler)
+{
+	struct tauSchedLink **links, *link;
+	struct pollfd *fds;
+	int i, size;
+
+	for (i = 0; i < sched->link_count; i++) {
+		if (sched->links[i]->handler == handler) {
+			return i;
+		}
+	}
+
+	if (!tauLinkGet(handler)) {
+		return -1;
+	}
+
+	if (sched->link_count == sched->link_size) {
+		size = sched->link_size ? 2 * sched->link_size : 4;
+		links = realloc(sched->links, size * sizeof(*links));
+		if (!links) {
+			fprintf(stderr,"%s: failed to allocate scheduler cameras\n",__FUNCTION__);
+			return -1;
+		}
+		sched->links = links;
+		fds = realloc(sched->fds, size * sizeof(*fds));
+		if (!fds) {
+			fprintf(stderr,"%s: failed to allocate scheduler cameras\n",__FUNCTION__);
+			return -1;
+		}
+		sched->fds = fds;
+		sched->link_size = size;
+	}
+
+	link = calloc(1, sizeof(*link));
+	if (!link) {
+		fprintf(stderr,"%s: failed to allocate scheduler camera\n",__FUNCTION__);
+		return -1;
+	}
+	link->sched = sched;
+	link->handler = handler;
+	link->job = -1;
+	sched->links[sched->link_count] = link;
+	return sched->link_count++;
+}
+
+/** Returns how long a poll keeps a camera busy: both packets on the wire
+ *  and the processing time learned for the command.  A command the handle
+ *  never timed is exchanged once to time it if sending it again is
+ *  harmless and nothing else is in flight, otherwise the processing time
+ *  of its descriptor is assumed
+ * \param handler the handler for the Tau camera
+ * \param cmd the command
+ * \param input request data
+ * \param input_size bytes of request data
+ * \param output_size largest amount of response data expected
+ * \returns microseconds
+ */
+static long tauSchedCost(tauHandler handler, tauCmd cmd, char *input, short input_size,
+			 short output_size)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	const struct tauCommandInfo *info = tauCommandInfo(cmd);
+	char response[256];
+	short count = sizeof(response);
+	long processing;
+
+	if (info && (info->response_max < output_size)) {
+		output_size = info->response_max;
+	}
+
+	processing = tauCmdLatency(handler, cmd, 99);
+	if ((processing < 0) && info && (info->flags & TAU_CMD_IDEMPOTENT) && !link->async_head) {
+		tauDoCmd(handler, cmd, input, input_size, response, &count);
+		processing = tauCmdLatency(handler, cmd, 99);
+	}
+	if (processing < 0) {
+		processing = 1000L * (info ? info->processing_ms : TAU_COMM_NORMAL_TIMEOUT);
+	}
+
+	return tauWireTimeUs(link, 2 * (TAU_HEADER_SIZE + TAU_CRC_SIZE) + input_size + output_size) +
+		processing;
+}
+
+/** Releases the polls that came due
+ * \param sched the scheduler
+ * \param now current time
+ * \returns when the next job comes due, -1 if there are no jobs
+ */
+static long long tauSchedRelease(tauSched *sched, long long now)
+{
+	struct tauSchedJob *job;
+	long long next = -1;
+	int i;
+
+	for (i = 0; i < sched->job_count; i++) {
+		job = &sched->jobs[i];
+
+		/* Releases are on the period grid, so late ones don't shift the
+		 * polls that follow */
+		while (job->next_release <= now) {
+			job->stats.released++;
+			if (job->due || job->running) {
+				job->stats.skipped++;
+			} else {
+				job->due = 1;
+				job->deadline = job->next_release + job->deadline_after;
+			}
+			job->next_release += job->period;
+		}
+
+		if ((next < 0) || (job->next_release < next)) {
+			next = job->next_release;
+		}
+	}
+	return next;
+}
+
+/** Finishes the command in flight on a camera and reports it
+ * \param link the camera
+ * \param status outcome of the command
+ * \param output response data
+ * \param output_count bytes of response data
+ */
+static void tauSchedFinish(struct tauSchedLink *link, tauStatus status,
+			   char *output, short output_count)
+{
+	tauSched *sched = link->sched;
+	struct tauSchedCmd *cmd = link->cmd;
+	struct tauSchedJob *job;
+	tauCompletion done;
+	void *user_data;
+	long long late;
+	tauCmd code;
+
+	link->busy = 0;
+	link->cmd = NULL;
+
+	if (cmd) {
+		if (cmd->done) {
+			cmd->done(link->handler, status, cmd->cmd, output, output_count, cmd->user_data);
+		}
+		free(cmd);
+		return;
+	}
+
+	job = &sched->jobs[link->job];
+	link->job = -1;
+	job->running = 0;
+	job->stats.completed++;
+	if (status != CAM_OK) {
+		job->stats.errors++;
+	}
+
+	late = tauSchedNow() - job->deadline;
+	if (late > 0) {
+		job->stats.late++;
+		if ((unsigned long)late > job->stats.max_late_us) {
+			job->stats.max_late_us = late;
+		}
+		dbg("Poll of command 0x%02X completed %lld us past its deadline",
+		    (unsigned char)job->cmd, late);
+	}
+
+	/* The callback may add jobs, which can move the table */
+	done = job->done;
+	user_data = job->user_data;
+	code = job->cmd;
+	if (done) {
+		done(link->handler, status, code, output, output_count, user_data);
+	}
+}
+
+/** Completion of the commands the scheduler submits
+ * \param handler the handler the command was submitted on
+ * \param status the status of the command
+ * \param cmd the command that completed
+ * \param output response data
+ * \param output_count number of valid bytes in output
+ * \param user_data the camera
+ */
+static void tauSchedDone(tauHandler handler, tauStatus status, tauCmd cmd,
+			 char *output, short output_count, void *user_data)
+{
+	tauSchedFinish(user_data, status, output, output_count);
+}
+
+/** Returns the due poll of a camera with the earliest deadline.  A poll
+ *  that can no longer make its deadline is dropped, so it doesn't make
+ *  the ones after it late too
+ * \param sched the scheduler
+ * \param index the camera
+ * \param now current time
+ * \returns the job, or NULL if no poll is due
+ */
+static struct tauSchedJob *tauSchedEarliest(tauSched *sched, int index, long long now)
+{
+	struct tauSchedJob *job, *earliest = NULL;
+	int i;
+
+	for (i = 0; i < sched->job_count; i++) {
+		job = &sched->jobs[i];
+		if ((job->link != index) || !job->due) {
+			continue;
+		}
+		if (job->deadline <= now) {
+			job->due = 0;
+			job->stats.dropped++;
+			dbg("Poll of command 0x%02X dropped, its deadline passed",
+			    (unsigned char)job->cmd);
+			continue;
+		}
+		if (!earliest || (job->deadline < earliest->deadline)) {
+			earliest = job;
+		}
+	}
+	return earliest;
+}
+
+/** Sends the most urgent command waiting for a free camera, if any
+ * \param sched the scheduler
+ * \param index the camera
+ * \param now current time
+ */
+static void tauSchedDispatch(tauSched *sched, int index, long long now)
+{
+	struct tauSchedLink *link = sched->links[index];
+	enum tauPriority priority = TAU_PRIORITY_CONTROL;
+	struct tauSchedCmd *cmd = link->head[priority];
+	struct tauSchedJob *job = NULL;
+	tauStatus status;
+
+	/* One-off commands of the poll class count as due when queued */
+	if (!cmd) {
+		priority = TAU_PRIORITY_POLL;
+		cmd = link->head[priority];
+		job = tauSchedEarliest(sched, index, now);
+		if (job && cmd && (cmd->queued <= job->deadline)) {
+			job = NULL;
+		} else if (job) {
+			cmd = NULL;
+		}
+	}
+	if (!cmd && !job) {
+		priority = TAU_PRIORITY_BULK;
+		cmd = link->head[priority];
+	}
+
+	if (cmd) {
+		link->head[priority] = cmd->next;
+		if (!link->head[priority]) {
+			link->tail[priority] = NULL;
+		}
+		link->cmd = cmd;
+		link->busy = 1;
+		status = tauSubmitCmd(link->handler, cmd->cmd, cmd->input_size ? cmd->input : NULL,
+				      cmd->input_size, cmd->output_size, tauSchedDone, link);
+	} else if (job) {
+		job->due = 0;
+		job->running = 1;
+		link->job = job - sched->jobs;
+		link->busy = 1;
+		status = tauSubmitCmd(link->handler, job->cmd, job->input, job->input_size,
+				      job->output_size, tauSchedDone, link);
+	} else {
+		return;
+	}
+
+	if (status != CAM_OK) {
+		tauSchedFinish(link, status, NULL, 0);
+	}
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauSched *tauSchedCreate(void)
+{
+	tauSched *sched = calloc(1, sizeof(*sched));
+
+	if (!sched) {
+		fprintf(stderr,"%s: failed to allocate scheduler\n",__FUNCTION__);
+	}
+	return sched;
+}
+
+
+int tauSchedPoll(tauSched *sched, tauHandler handler, tauCmd cmd,
+		 char *input, short input_size, short output_size,
+		 long period_ms, long deadline_ms, tauCompletion done, void *user_data)
+{
+	struct tauSchedJob *jobs, *job;
+	long cost, density;
+	int index, size;
+
+	if (!input) {
+		input_size = 0;
+	}
+	if (!deadline_ms) {
+		deadline_ms = period_ms;
+	}
+	if ((period_ms <= 0) || (deadline_ms < 0) || (deadline_ms > period_ms) ||
+	    (output_size < 0) || (tauCommandCheck(cmd, input_size) != CAM_OK)) {
+		fprintf(stderr,"%s: invalid job for command 0x%02X\n",__FUNCTION__,(unsigned char)cmd);
+		return -1;
+	}
+
+	index = tauSchedLinkOf(sched, handler);
+	if (index < 0) {
+		return -1;
+	}
+
+	/* Each job takes its share of the time up to its deadline; while the
+	 * shares add up to less than the link, earliest deadline first meets
+	 * them all */
+	cost = tauSchedCost(handler, cmd, input, input_size, output_size);
+	density = (long)((long long)cost * 1000 / deadline_ms);
+	if (sched->links[index]->density + density > TAU_SCHED_UTILIZATION * 10000L) {
+		fprintf(stderr,"%s: polling command 0x%02X within %ld ms takes %ld.%ld%% of the link, "
+			"%ld.%ld%% is left\n",__FUNCTION__,(unsigned char)cmd,deadline_ms,
+			density / 10000, density / 1000 % 10,
+			(TAU_SCHED_UTILIZATION * 10000L - sched->links[index]->density) / 10000,
+			(TAU_SCHED_UTILIZATION * 10000L - sched->links[index]->density) / 1000 % 10);
+		return -1;
+	}
+
+	if (sched->job_count == sched->job_size) {
+		size = sched->job_size ? 2 * sched->job_size : 8;
+		jobs = realloc(sched->jobs, size * sizeof(*jobs));
+		if (!jobs) {
+			fprintf(stderr,"%s: failed to allocate scheduler jobs\n",__FUNCTION__);
+			return -1;
+		}
+		sched->jobs = jobs;
+		sched->job_size = size;
+	}
+
+	job = &sched->jobs[sched->job_count];
+	memset(job, 0, sizeof(*job));
+	if (input_size) {
+		job->input = malloc(input_size);
+		if (!job->input) {
+			fprintf(stderr,"%s: failed to allocate job data\n",__FUNCTION__);
+			return -1;
+		}
+		memcpy(job->input, input, input_size);
+	}
+	job->link = index;
+	job->cmd = cmd;
+	job->input_size = input_size;
+	job->output_size = output_size;
+	job->period = period_ms * 1000LL;
+	job->deadline_after = deadline_ms * 1000LL;
+	job->next_release = tauSchedNow();
+	job->density = density;
+	job->done = done;
+	job->user_data = user_data;
+
+	sched->links[index]->density += density;
+	dbg("Polling command 0x%02X every %ld ms, %ld us each", (unsigned char)cmd, period_ms, cost);
+	return sched->job_count++;
+}
+
+
+tauStatus tauSchedCommand(tauSched *sched, tauHandler handler, enum tauPriority priority,
+			  tauCmd cmd, char *input, short input_size, short output_size,
+			  tauCompletion done, void *user_data)
+{
+	struct tauSchedLink *link;
+	struct tauSchedCmd *queued;
+	tauStatus status;
+	int index;
+
+	if ((priority < 0) || (priority >= TAU_PRIORITY_COUNT) || (output_size < 0)) {
+		return CAM_RANGE_ERROR;
+	}
+	if (!input) {
+		input_size = 0;
+	}
+
+	status = tauCommandCheck(cmd, input_size);
+	if (status != CAM_OK) {
+		return status;
+	}
+
+	index = tauSchedLinkOf(sched, handler);
+	if (index < 0) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+	link = sched->links[index];
+
+	queued = malloc(sizeof(*queued) + input_size);
+	if (!queued) {
+		fprintf(stderr,"%s: failed to allocate memory for command\n",__FUNCTION__);
+		return CAM_NOT_READY;
+	}
+	queued->next = NULL;
+	queued->cmd = cmd;
+	queued->input_size = input_size;
+	queued->output_size = output_size;
+	queued->queued = tauSchedNow();
+	queued->done = done;
+	queued->user_data = user_data;
+	memcpy(queued->input, input, input_size);
+
+	if (link->tail[priority]) {
+		link->tail[priority]->next = queued;
+	} else {
+		link->head[priority] = queued;
+	}
+	link->tail[priority] = queued;
+	return CAM_OK;
+}
+
+
+tauStatus tauSchedRun(tauSched *sched, long ms)
+{
+	long long now, end, next, wait;
+	int i, count, ret, timeout, left;
+	short events;
+
+	end = tauSchedNow() + ms * 1000LL;
+	sched->stopping = 0;
+
+	while (1) {
+		now = tauSchedNow();
+		next = tauSchedRelease(sched, now);
+		if ((ms >= 0) && (now >= end)) {
+			sched->stopping = 1;
+		}
+
+		/* Callbacks may have queued commands, so look at every camera */
+		count = 0;
+		timeout = -1;
+		for (i = 0; i < sched->link_count; i++) {
+			if (!sched->stopping && !sched->links[i]->busy &&
+			    !tauAsyncPending(sched->links[i]->handler)) {
+				tauSchedDispatch(sched, i, now);
+			}
+
+			events = tauAsyncEvents(sched->links[i]->handler);
+			sched->fds[i].fd = events ? tauFd(sched->links[i]->handler) : -1;
+			sched->fds[i].events = events;
+			sched->fds[i].revents = 0;
+			if (!events) {
+				continue;
+			}
+			count++;
+			left = tauAsyncTimeout(sched->links[i]->handler);
+			if ((left >= 0) && ((timeout < 0) || (left < timeout))) {
+				timeout = left;
+			}
+		}
+
+		if (sched->stopping) {
+			/* Done once what is in flight completed */
+			if (!count) {
+				return CAM_OK;
+			}
+		} else {
+			if (ms >= 0) {
+				next = (next < 0) || (end < next) ? end : next;
+			}
+			if (next >= 0) {
+				wait = (next - tauSchedNow() + 999) / 1000;
+				if (wait < 0) {
+					wait = 0;
+				}
+				if ((timeout < 0) || (wait < timeout)) {
+					timeout = wait;
+				}
+			}
+		}
+
+		ret = poll(sched->fds, sched->link_count, timeout);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Scheduler event loop failed");
+			return CAM_COMMUNICATION_ERROR;
+		}
+
+		/* Cameras that sent or took data, and those whose deadline
+		 * passed so they report their timeout */
+		for (i = 0; i < sched->link_count; i++) {
+			if (sched->fds[i].revents ||
+			    ((sched->fds[i].fd >= 0) && !tauAsyncTimeout(sched->links[i]->handler))) {
+				tauAsyncStep(sched->links[i]->handler);
+			}
+		}
+	}
+}
+
+
+void tauSchedStop(tauSched *sched)
+{
+	sched->stopping = 1;
+}
+
+
+tauStatus tauSchedJobStats(tauSched *sched, int job, struct tauSchedStats *stats)
+{
+	if ((job < 0) || (job >= sched->job_count)) {
+		return CAM_RANGE_ERROR;
+	}
+	*stats = sched->jobs[job].stats;
+	return CAM_OK;
+}
+
+
+void tauSchedWrite(tauSched *sched, FILE *file)
+{
+	static const struct {
+		const char *name;
+		const char *help;
+		size_t offset;
+	} counters[] = {
+		{ "tau_sched_released_total", "Times a periodic poll came due",
+		  offsetof(struct tauSchedStats, released) },
+		{ "tau_sched_completed_total", "Periodic polls that completed",
+		  offsetof(struct tauSchedStats, completed) },
+		{ "tau_sched_errors_total", "Periodic polls that failed",
+		  offsetof(struct tauSchedStats, errors) },
+		{ "tau_sched_late_total", "Periodic polls completed past their deadline",
+		  offsetof(struct tauSchedStats, late) },
+		{ "tau_sched_dropped_total", "Periodic polls dropped unsent once their deadline passed",
+		  offsetof(struct tauSchedStats, dropped) },
+		{ "tau_sched_skipped_total", "Releases while the previous poll was still due",
+		  offsetof(struct tauSchedStats, skipped) },
+	};
+	const struct tauCommandInfo *info;
+	struct tauSchedJob *job;
+	char code[8];
+	const char *name;
+	int i, j;
+
+	for (i = 0; i < (int)(sizeof(counters) / sizeof(counters[0])); i++) {
+		fprintf(file, "# HELP %s %s\n", counters[i].name, counters[i].help);
+		fprintf(file, "# TYPE %s counter\n", counters[i].name);
+		for (j = 0; j < sched->job_count; j++) {
+			job = &sched->jobs[j];
+			info = tauCommandInfo(job->cmd);
+			if (info) {
+				name = info->name;
+			} else {
+				snprintf(code, sizeof(code), "0x%02X", (unsigned char)job->cmd);
+				name = code;
+			}
+			fprintf(file, "%s{job=\"%d\",command=\"%s\"} %llu\n", counters[i].name, j, name,
+				*(unsigned long long *)((char *)&job->stats + counters[i].offset));
+		}
+	}
+
+	fprintf(file, "# HELP tau_sched_late_max_seconds Longest a periodic poll completed past its deadline\n");
+	fprintf(file, "# TYPE tau_sched_late_max_seconds gauge\n");
+	for (j = 0; j < sched->job_count; j++) {
+		job = &sched->jobs[j];
+		info = tauCommandInfo(job->cmd);
+		if (info) {
+			name = info->name;
+		} else {
+			snprintf(code, sizeof(code), "0x%02X", (unsigned char)job->cmd);
+			name = code;
+		}
+		fprintf(file, "tau_sched_late_max_seconds{job=\"%d\",command=\"%s\"} %.6f\n", j, name,
+			job->stats.max_late_us / 1e6);
+	}
+
+	fprintf(file, "# HELP tau_sched_budget_ratio Share of a camera link budgeted to periodic polls\n");
+	fprintf(file, "# TYPE tau_sched_budget_ratio gauge\n");
+	for (i = 0; i < sched->link_count; i++) {
+		fprintf(file, "tau_sched_budget_ratio{fd=\"%d\"} %.6f\n",
+			tauFd(sched->links[i]->handler), sched->links[i]->density / 1e6);
+	}
+}
+
+
+void tauSchedDestroy(tauSched *sched)
+{
+	struct tauSchedCmd *cmd;
+	int i, priority;
+
+	if (!sched) {
+		return;
+	}
+
+	/* The commands in flight complete into the scheduler */
+	tauSchedRun(sched, 0);
+
+	for (i = 0; i < sched->link_count; i++) {
+		for (priority = 0; priority < TAU_PRIORITY_COUNT; priority++) {
+			while ((cmd = sched->links[i]->head[priority])) {
+				sched->links[i]->head[priority] = cmd->next;
+				if (cmd->done) {
+					cmd->done(sched->links[i]->handler, CAM_COMMUNICATION_ERROR, cmd->cmd,
+						  NULL, 0, cmd->user_data);
+				}
+				free(cmd);
+			}
+		}
+		free(sched->links[i]);
+	}
+	for (i = 0; i < sched->job_count; i++) {
+		free(sched->jobs[i].input);
+	}
+	free(sched->links);
+	free(sched->fds);
+	free(sched->jobs);
+	free(sched);
+}
@@ -0,0 +1,290 @@
+/* libtau handles shared between threads
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+/** A command submitted with tauShareSubmit() */
+struct tauFuture {
+	struct tauFuture *next;
+	tauCmd cmd;
+	char *input;
+	short input_size;
+	char *output;
+	short output_size;
+	short output_count;  /* response bytes, once done */
+	tauStatus status;    /* outcome, once done */
+	int done;            /* set by the I/O thread once the rest is final */
+	sem_t ready;         /* posted when done is set */
+	char storage[];      /* input and output buffers */
+};
+
+/** The thread that owns a shared handle, and the commands waiting for it.
+ *  Submitting threads push onto the stack with compare and swap and never
+ *  wait for each other; the I/O thread takes the whole stack at once */
+struct tauShare {
+	struct tauFuture *submitted; /* newest first */
+	sem_t work;                  /* posted for each submission and to stop */
+	int stopping;
+	pthread_t thread;
+};
+
+/* The link whose I/O thread this is, NULL in every other thread */
+static __thread struct tauLink *tau_share_owner;
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Hands a finished command back to the thread that submitted it
+ * \param future the command
+ * \param status outcome of the command
+ */
+static void tauFutureComplete(struct tauFuture *future, tauStatus status)
+{
+	future->status = status;
+	__atomic_store_n(&future->done, 1, __ATOMIC_RELEASE);
+	sem_post(&future->ready);
+}
+
+/** Takes everything submitted so far, oldest first
+ * \param share the shared handle
+ * \returns the commands, linked through next
+ */
+static struct tauFuture *tauShareTake(struct tauShare *share)
+{
+	struct tauFuture *stack, *queue = NULL, *next;
+
+	stack = __atomic_exchange_n(&share->submitted, NULL, __ATOMIC_ACQUIRE);
+	while (stack) {
+		next = stack->next;
+		stack->next = queue;
+		queue = stack;
+		stack = next;
+	}
+	return queue;
+}
+
+/** Body of the I/O thread: exchanges the submitted commands one after the
+ *  other until the handle is closed
+ * \param arg state of the shared handle
+ * \returns NULL
+ */
+static void *tauShareRun(void *arg)
+{
+	struct tauLink *link = arg;
+	struct tauShare *share = link->share;
+	struct tauFuture *future, *next;
+	tauStatus status;
+
+	tau_share_owner = link;
+
+	while (1) {
+		while (sem_wait(&share->work) && (errno == EINTR));
+
+		future = tauShareTake(share);
+		if (!future && __atomic_load_n(&share->stopping, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		for (; future; future = next) {
+			next = future->next;
+			future->output_count = future->output_size;
+			status = tauDoCmd(link->fd, future->cmd, future->input, future->input_size,
+					  future->output, &future->output_count);
+			tauFutureComplete(future, status);
+		}
+	}
+
+	return NULL;
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+int tauShareForeign(struct tauLink *link)
+{
+	return link->share && (tau_share_owner != link);
+}
+
+
+tauStatus tauShareCmd(struct tauLink *link, tauCmd cmd, char *input, short inputSize,
+		      char *output, short *outputCount)
+{
+	tauFuture *future;
+
+	future = tauShareSubmit(link->fd, cmd, input, inputSize,
+				(output && outputCount) ? *outputCount : 0);
+	if (!future) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+	return tauFutureWait(future, output, outputCount);
+}
+
+
+void tauShareStop(struct tauLink *link)
+{
+	struct tauShare *share = link->share;
+	struct tauFuture *future, *next;
+
+	if (!share) {
+		return;
+	}
+
+	/* The thread finishes what was submitted before it goes */
+	__atomic_store_n(&share->stopping, 1, __ATOMIC_RELEASE);
+	sem_post(&share->work);
+	pthread_join(share->thread, NULL);
+
+	for (future = tauShareTake(share); future; future = next) {
+		next = future->next;
+		future->output_count = 0;
+		tauFutureComplete(future, CAM_COMMUNICATION_ERROR);
+	}
+
+	sem_destroy(&share->work);
+	free(share);
+	link->share = NULL;
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauStatus tauShare(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauShare *share;
+	int ret;
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+	if (link->share) {
+		return CAM_OK;
+	}
+
+	/* The I/O thread can't follow requests exchanged by the event loop */
+	if (link->async_head) {
+		return CAM_BUSY;
+	}
+
+	share = calloc(1, sizeof(*share));
+	if (!share) {
+		fprintf(stderr,"%s: failed to allocate shared handle\n",__FUNCTION__);
+		return CAM_COMMUNICATION_ERROR;
+	}
+	if (sem_init(&share->work, 0, 0)) {
+		perror("Unable to create shared handle semaphore");
+		free(share);
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	link->share = share;
+	ret = pthread_create(&share->thread, NULL, tauShareRun, link);
+	if (ret) {
+		fprintf(stderr,"%s: failed to start I/O thread: %s\n",__FUNCTION__,strerror(ret));
+		link->share = NULL;
+		sem_destroy(&share->work);
+		free(share);
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	dbg("Handle %d is shared, its I/O thread exchanges the commands", link->fd);
+	return CAM_OK;
+}
+
+
+tauFuture *tauShareSubmit(tauHandler handler, tauCmd cmd,
+			  char *input, short input_size, short output_size)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	const struct tauCommandInfo *info;
+	struct tauShare *share;
+	tauFuture *future;
+
+	if (!link || !link->share || (input_size < 0) || (output_size < 0)) {
+		return NULL;
+	}
+	share = link->share;
+
+	if (__atomic_load_n(&share->stopping, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	/* Room for the largest response the command has, not for what the
+	 * caller guessed */
+	info = tauCommandInfo(cmd);
+	if (info && (output_size > info->response_max)) {
+		output_size = info->response_max;
+	}
+
+	future = malloc(sizeof(*future) + input_size + output_size);
+	if (!future) {
+		fprintf(stderr,"%s: failed to allocate memory for request\n",__FUNCTION__);
+		return NULL;
+	}
+
+	memset(future, 0, sizeof(*future));
+	if (sem_init(&future->ready, 0, 0)) {
+		perror("Unable to create request semaphore");
+		free(future);
+		return NULL;
+	}
+	future->cmd = cmd;
+	future->input = input ? future->storage : NULL;
+	future->input_size = input ? input_size : 0;
+	if (input) {
+		memcpy(future->input, input, input_size);
+	}
+	future->output = future->storage + future->input_size;
+	future->output_size = output_size;
+
+	future->next = __atomic_load_n(&share->submitted, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&share->submitted, &future->next, future, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	sem_post(&share->work);
+
+	return future;
+}
+
+
+int tauFutureReady(tauFuture *future)
+{
+	return __atomic_load_n(&future->done, __ATOMIC_ACQUIRE);
+}
+
+
+tauStatus tauFutureWait(tauFuture *future, char *output, short *output_count)
+{
+	tauStatus status;
+	short count;
+
+	while (sem_wait(&future->ready) && (errno == EINTR));
+
+	count = future->output_count;
+	if (output_count) {
+		if (count > *output_count) {
+			count = *output_count;
+		}
+		if (output) {
+			memcpy(output, future->output, count);
+		}
+		*output_count = count;
+	}
+	status = future->status;
+
+	sem_destroy(&future->ready);
+	free(future);
+	return status;
+}
@@ -0,0 +1,351 @@
+/* libtau performance counters and exchange phase histograms
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+/** Time one phase of a command took */
+struct tauPhaseHistogram {
+	unsigned long count;
+	unsigned long long total_us;
+	unsigned long max_us;
+	unsigned int buckets[TAU_LATENCY_BUCKETS];
+};
+
+/** Phase times of a command */
+struct tauCmdStats {
+	struct tauPhaseHistogram phases[TAU_PHASE_COUNT];
+};
+
+/* Values of the phase label, in enum tauPhase order */
+static const char *tau_phase_names[TAU_PHASE_COUNT] = {
+	"build", "write", "first_byte", "last_byte", "decode",
+};
+
+static const struct {
+	const char *name;
+	const char *help;
+	size_t offset; /* of the counter in struct tauStats */
+} tau_counters[] = {
+	{ "tau_frames_sent_total", "Request packets written to the camera",
+	  offsetof(struct tauStats, frames_sent) },
+	{ "tau_frames_received_total", "Response packets received from the camera",
+	  offsetof(struct tauStats, frames_received) },
+	{ "tau_bytes_sent_total", "Bytes written to the camera",
+	  offsetof(struct tauStats, bytes_sent) },
+	{ "tau_bytes_received_total", "Bytes received from the camera",
+	  offsetof(struct tauStats, bytes_received) },
+	{ "tau_syscalls_total", "Reads, writes and polls of the camera descriptor",
+	  offsetof(struct tauStats, syscalls) },
+	{ "tau_crc_errors_total", "Exchanges that failed a crc check at either end",
+	  offsetof(struct tauStats, crc_errors) },
+	{ "tau_timeouts_total", "Exchanges the camera didn't answer in time",
+	  offsetof(struct tauStats, timeouts) },
+	{ "tau_resyncs_total", "Received packet headers that failed their crc",
+	  offsetof(struct tauStats, resyncs) },
+	{ "tau_noise_bytes_total", "Received bytes that weren't part of a packet",
+	  offsetof(struct tauStats, noise_bytes) },
+	{ "tau_retries_total", "Commands sent again after a failure",
+	  offsetof(struct tauStats, retries) },
+};
+
+#define TAU_COUNTER_COUNT ((int)(sizeof(tau_counters) / sizeof(tau_counters[0])))
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Returns the phase times of a command, creating them on first use
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \returns the phase times, or NULL if out of memory
+ */
+static struct tauCmdStats *tauCmdStatsGet(struct tauLink *link, tauCmd cmd)
+{
+	unsigned char index = cmd;
+
+	if (!link->cmd_stats[index]) {
+		link->cmd_stats[index] = calloc(1, sizeof(struct tauCmdStats));
+		if (!link->cmd_stats[index]) {
+			fprintf(stderr,"%s: failed to allocate command statistics\n",__FUNCTION__);
+		}
+	}
+	return link->cmd_stats[index];
+}
+
+/** Returns the histogram of a phase of a command, if it has one
+ * \param handler the handler for the Tau camera
+ * \param cmd Tau camera command
+ * \param phase the phase
+ * \returns the histogram, or NULL if the command was never timed
+ */
+static const struct tauPhaseHistogram *tauPhaseFind(tauHandler handler, tauCmd cmd,
+						    enum tauPhase phase)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link || ((int)phase < 0) || (phase >= TAU_PHASE_COUNT) ||
+	    !link->cmd_stats[(unsigned char)cmd]) {
+		return NULL;
+	}
+	return &link->cmd_stats[(unsigned char)cmd]->phases[phase];
+}
+
+/** Writes the labels of a metric
+ * \param file where to write them
+ * \param camera (optional, may be NULL) value of the camera label
+ * \param cmd (optional, may be NULL) value of the command label
+ * \param phase (optional, may be NULL) value of the phase label
+ * \param le (optional, may be NULL) value of the le label of a bucket
+ */
+static void tauStatsLabels(FILE *file, const char *camera, const char *cmd,
+			   const char *phase, const char *le)
+{
+	const char *names[] = { "camera", "command", "phase", "le" };
+	const char *values[] = { camera, cmd, phase, le };
+	const char *separator = "{";
+	const char *c;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (!values[i]) {
+			continue;
+		}
+		fprintf(file, "%s%s=\"", separator, names[i]);
+		for (c = values[i]; *c; c++) {
+			if ((*c == '\\') || (*c == '"')) {
+				fputc('\\', file);
+			}
+			fputc(*c == '\n' ? ' ' : *c, file);
+		}
+		fputc('"', file);
+		separator = ",";
+	}
+	if (*separator == ',') {
+		fputc('}', file);
+	}
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+void tauStatsStart(struct tauLink *link)
+{
+	clock_gettime(CLOCK_MONOTONIC, &link->marks[0]);
+	link->marked = 1;
+}
+
+
+void tauStatsMark(struct tauLink *link, enum tauPhase phase)
+{
+	struct timespec now;
+
+	if (!link->marked || (link->marked > (int)phase + 1)) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (link->marked <= (int)phase + 1) {
+		link->marks[link->marked++] = now;
+	}
+}
+
+
+void tauStatsRecord(struct tauLink *link, tauCmd cmd, tauStatus status)
+{
+	struct tauPhaseHistogram *histogram;
+	struct tauCmdStats *stats;
+	unsigned long us;
+	int i;
+
+	if (status == CAM_CHECKSUM_ERROR) {
+		link->stats.crc_errors++;
+	} else if (status == CAM_TIMEOUT_ERROR) {
+		link->stats.timeouts++;
+	}
+
+	stats = link->marked > 1 ? tauCmdStatsGet(link, cmd) : NULL;
+	for (i = 0; stats && (i + 1 < link->marked); i++) {
+		us = (link->marks[i + 1].tv_sec - link->marks[i].tv_sec) * 1000000 +
+			(link->marks[i + 1].tv_nsec - link->marks[i].tv_nsec) / 1000;
+		histogram = &stats->phases[i];
+		histogram->count++;
+		histogram->total_us += us;
+		if (us > histogram->max_us) {
+			histogram->max_us = us;
+		}
+		histogram->buckets[tauLatencyBucket(us)]++;
+	}
+
+	link->marked = 0;
+}
+
+
+void tauStatsFree(struct tauLink *link)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		free(link->cmd_stats[i]);
+		link->cmd_stats[i] = NULL;
+	}
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauStatus tauStatsGet(tauHandler handler, struct tauStats *stats)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+	*stats = link->stats;
+	return CAM_OK;
+}
+
+
+tauStatus tauStatsPhase(tauHandler handler, tauCmd cmd, enum tauPhase phase,
+			struct tauPhaseStats *stats)
+{
+	const struct tauPhaseHistogram *histogram;
+
+	if (!tauLinkGet(handler)) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	histogram = tauPhaseFind(handler, cmd, phase);
+	if (histogram) {
+		stats->count = histogram->count;
+		stats->total_us = histogram->total_us;
+		stats->max_us = histogram->max_us;
+	}
+	return CAM_OK;
+}
+
+
+long tauStatsPercentile(tauHandler handler, tauCmd cmd, enum tauPhase phase, int percentile)
+{
+	const struct tauPhaseHistogram *histogram = tauPhaseFind(handler, cmd, phase);
+	unsigned long total = 0;
+	unsigned long target;
+	int i;
+
+	if (!histogram || !histogram->count) {
+		return -1;
+	}
+
+	target = (histogram->count * percentile + 99) / 100;
+	for (i = 0; i < TAU_LATENCY_BUCKETS; i++) {
+		total += histogram->buckets[i];
+		if (total && (total >= target)) {
+			break;
+		}
+	}
+
+	/* The slowest exchange is known exactly, the bucket only bounds it */
+	if ((i == TAU_LATENCY_BUCKETS - 1) || (tauLatencyBucketLimit(i) > histogram->max_us)) {
+		return histogram->max_us;
+	}
+	return tauLatencyBucketLimit(i);
+}
+
+
+void tauStatsReset(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (link) {
+		memset(&link->stats, 0, sizeof(link->stats));
+		tauStatsFree(link);
+	}
+}
+
+
+tauStatus tauStatsWrite(tauHandler handler, FILE *file, const char *camera)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	const struct tauPhaseHistogram *histogram;
+	const struct tauCommandInfo *info;
+	unsigned long cumulative;
+	char code[8], le[24];
+	const char *name;
+	int cmd, phase, i;
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	for (i = 0; i < TAU_COUNTER_COUNT; i++) {
+		fprintf(file, "# HELP %s %s\n", tau_counters[i].name, tau_counters[i].help);
+		fprintf(file, "# TYPE %s counter\n", tau_counters[i].name);
+		fprintf(file, "%s", tau_counters[i].name);
+		tauStatsLabels(file, camera, NULL, NULL, NULL);
+		fprintf(file, " %llu\n", *(unsigned long long *)((char *)&link->stats +
+								  tau_counters[i].offset));
+	}
+
+	fprintf(file, "# HELP tau_phase_seconds Time each phase of an exchange took\n");
+	fprintf(file, "# TYPE tau_phase_seconds histogram\n");
+
+	for (cmd = 0; cmd < 256; cmd++) {
+		if (!link->cmd_stats[cmd]) {
+			continue;
+		}
+
+		info = tauCommandInfo(cmd);
+		if (info) {
+			name = info->name;
+		} else {
+			snprintf(code, sizeof(code), "0x%02X", cmd);
+			name = code;
+		}
+
+		for (phase = 0; phase < TAU_PHASE_COUNT; phase++) {
+			histogram = &link->cmd_stats[cmd]->phases[phase];
+			if (!histogram->count) {
+				continue;
+			}
+
+			/* Every series gets the same bounds, one per octave, so
+			 * scrapes can be aggregated.  The last bucket has no
+			 * bound and is only counted in +Inf. */
+			cumulative = 0;
+			for (i = 0; i < TAU_LATENCY_BUCKETS - 1; i++) {
+				cumulative += histogram->buckets[i];
+				if ((i & 3) != 3) {
+					continue;
+				}
+				snprintf(le, sizeof(le), "%.6f", tauLatencyBucketLimit(i) / 1e6);
+				fprintf(file, "tau_phase_seconds_bucket");
+				tauStatsLabels(file, camera, name, tau_phase_names[phase], le);
+				fprintf(file, " %lu\n", cumulative);
+			}
+			fprintf(file, "tau_phase_seconds_bucket");
+			tauStatsLabels(file, camera, name, tau_phase_names[phase], "+Inf");
+			fprintf(file, " %lu\n", histogram->count);
+
+			fprintf(file, "tau_phase_seconds_sum");
+			tauStatsLabels(file, camera, name, tau_phase_names[phase], NULL);
+			fprintf(file, " %.6f\n", histogram->total_us / 1e6);
+
+			fprintf(file, "tau_phase_seconds_count");
+			tauStatsLabels(file, camera, name, tau_phase_names[phase], NULL);
+			fprintf(file, " %lu\n", histogram->count);
+		}
+	}
+
+	return ferror(file) ? CAM_COMMUNICATION_ERROR : CAM_OK;
+}
@@ -0,0 +1,287 @@
+/* libtau per command response timeouts
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+#define TAU_TIMEOUT_FLOOR        5    /* ms, never wait less for the camera to process */
+#define TAU_TIMEOUT_PERCENTILE   99   /* latency percentile the timeout is based on */
+#define TAU_TIMEOUT_FACTOR       2    /* head room over the learned percentile */
+#define TAU_LATENCY_MIN_SAMPLES  16   /* samples before trusting what was learned */
+#define TAU_LATENCY_WINDOW       1024 /* samples kept before old ones are aged out */
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Returns the processing time allowed for a command that was never timed
+ * \param cmd Tau camera command
+ * \returns milliseconds
+ */
+static long tauCmdBudget(tauCmd cmd)
+{
+	const struct tauCommandInfo *info = tauCommandInfo(cmd);
+
+	return info ? info->processing_ms : TAU_COMM_NORMAL_TIMEOUT;
+}
+
+/** Returns the number of milliseconds the frames take on the wire
+ * \param link state of the handle
+ * \param bytes request and response bytes together
+ * \returns milliseconds, zero if the link is not a serial port
+ */
+static long tauWireTime(struct tauLink *link, long bytes)
+{
+	if (!link->baud) {
+		return 0;
+	}
+
+	/* 8N1 puts ten bits on the wire for each byte */
+	return (bytes * 10 * 1000 + link->baud - 1) / link->baud;
+}
+
+/** Returns the timing state of a command, creating it on first use
+ * \param link state of the handle
+ * \param cmd Tau camera command
+ * \returns the timing state, or NULL if out of memory
+ */
+static struct tauCmdTiming *tauCmdTimingGet(struct tauLink *link, tauCmd cmd)
+{
+	unsigned char index = cmd;
+
+	if (!link->timing[index]) {
+		link->timing[index] = calloc(1, sizeof(struct tauCmdTiming));
+		if (!link->timing[index]) {
+			fprintf(stderr,"%s: failed to allocate command timing\n",__FUNCTION__);
+		}
+	}
+	return link->timing[index];
+}
+
+/** Returns a percentile of the latency learned for a command
+ * \param timing timing state of the command
+ * \param percentile 1 to 100
+ * \returns latency in microseconds
+ */
+static unsigned long tauLatencyPercentile(const struct tauCmdTiming *timing, int percentile)
+{
+	unsigned long total = 0;
+	unsigned long target;
+	int i;
+
+	for (i = 0; i < TAU_LATENCY_BUCKETS; i++) {
+		total += timing->latency[i];
+	}
+
+	target = (total * percentile + 99) / 100;
+	total = 0;
+	for (i = 0; i < TAU_LATENCY_BUCKETS; i++) {
+		total += timing->latency[i];
+		if (total && (total >= target)) {
+			return tauLatencyBucketLimit(i);
+		}
+	}
+	return 0;
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+int tauLatencyBucket(unsigned long us)
+{
+	int msb, bucket;
+
+	if (us < 4) {
+		return us;
+	}
+
+	msb = 63 - __builtin_clzll(us);
+	bucket = 4 * (msb - 1) + ((us >> (msb - 2)) & 3);
+	return bucket < TAU_LATENCY_BUCKETS ? bucket : TAU_LATENCY_BUCKETS - 1;
+}
+
+
+unsigned long tauLatencyBucketLimit(int bucket)
+{
+	int shift;
+
+	if (bucket < 4) {
+		return bucket;
+	}
+
+	shift = bucket / 4 - 1;
+	return ((unsigned long)(4 + (bucket & 3) + 1) << shift) - 1;
+}
+
+
+long tauWireTimeUs(struct tauLink *link, long bytes)
+{
+	if (!link->baud) {
+		return 0;
+	}
+	return ((long long)bytes * 10 * 1000000 + link->baud - 1) / link->baud;
+}
+
+
+long tauTimeoutFor(struct tauLink *link, tauCmd cmd, short inputSize, short outputSize)
+{
+	struct tauCmdTiming *timing = link->timing[(unsigned char)cmd];
+	const struct tauCommandInfo *info = tauCommandInfo(cmd);
+	long bytes = 2 * (TAU_HEADER_SIZE + TAU_CRC_SIZE) + inputSize;
+	long response = outputSize;
+	long processing;
+
+	if (timing && timing->override) {
+		return timing->override;
+	}
+
+	/* The caller's buffer may be much larger than what is coming, so
+	 * the descriptor caps it.  What the command returned before only
+	 * makes the wait longer: a READ_MEMORY of more bytes than the last
+	 * one must still wait for all of them. */
+	if (info && (info->response_max < response)) {
+		response = info->response_max;
+	}
+	if (timing && timing->samples && (timing->response_size > response)) {
+		response = timing->response_size;
+	}
+	bytes += response;
+
+	if (timing && (timing->samples >= TAU_LATENCY_MIN_SAMPLES)) {
+		processing = TAU_TIMEOUT_FACTOR *
+			(tauLatencyPercentile(timing, TAU_TIMEOUT_PERCENTILE) + 999) / 1000;
+		if (processing < TAU_TIMEOUT_FLOOR) {
+			processing = TAU_TIMEOUT_FLOOR;
+		}
+	} else {
+		processing = tauCmdBudget(cmd);
+	}
+
+	return tauWireTime(link, bytes) + processing;
+}
+
+
+void tauTimeoutRecord(struct tauLink *link, tauCmd cmd, tauStatus status,
+		      short inputSize, short outputCount, const struct timespec *start)
+{
+	struct tauCmdTiming *timing;
+	struct timespec now;
+	long us;
+	int i;
+
+	/* Nothing to learn from an exchange that broke down */
+	if (status == CAM_COMMUNICATION_ERROR) {
+		return;
+	}
+
+	/* If data came back the camera answered in time and the line lost
+	 * part of it; counting that as a slow camera would double the
+	 * timeout with every damaged response, and retries make many */
+	if ((status == CAM_TIMEOUT_ERROR) && (link->marked > TAU_PHASE_FIRST_BYTE + 1)) {
+		return;
+	}
+
+	timing = tauCmdTimingGet(link, cmd);
+	if (!timing) {
+		return;
+	}
+
+	if (status == CAM_OK) {
+		timing->response_size = outputCount;
+	}
+
+	/* Only the time the camera spent counts, the wire time follows the
+	 * baud rate and is added back when the timeout is computed.  A
+	 * timeout is a sample of at least that long, which lifts the
+	 * percentile until the camera's real latency is covered */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+	us -= 1000 * tauWireTime(link, 2 * (TAU_HEADER_SIZE + TAU_CRC_SIZE) + inputSize +
+				 timing->response_size);
+	if (us < 0) {
+		us = 0;
+	}
+
+	/* Halve the counts now and then so the camera's latency is tracked
+	 * as it changes */
+	if (timing->samples >= TAU_LATENCY_WINDOW) {
+		for (i = 0; i < TAU_LATENCY_BUCKETS; i++) {
+			timing->latency[i] /= 2;
+		}
+		timing->samples /= 2;
+	}
+
+	timing->latency[tauLatencyBucket(us)]++;
+	timing->samples++;
+}
+
+
+void tauTimeoutFree(struct tauLink *link)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		free(link->timing[i]);
+		link->timing[i] = NULL;
+	}
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+long tauCmdTimeout(tauHandler handler, tauCmd cmd, short input_size, short output_size)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link) {
+		return -1;
+	}
+	return tauTimeoutFor(link, cmd, input_size, output_size);
+}
+
+
+tauStatus tauSetCmdTimeout(tauHandler handler, tauCmd cmd, long ms)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauCmdTiming *timing;
+
+	if (!link || (ms < 0)) {
+		return CAM_RANGE_ERROR;
+	}
+
+	timing = tauCmdTimingGet(link, cmd);
+	if (!timing) {
+		return CAM_NOT_READY;
+	}
+
+	timing->override = ms;
+	return CAM_OK;
+}
+
+
+long tauCmdLatency(tauHandler handler, tauCmd cmd, int percentile)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauCmdTiming *timing;
+
+	if (!link || (percentile < 1) || (percentile > 100)) {
+		return -1;
+	}
+
+	timing = link->timing[(unsigned char)cmd];
+	if (!timing || !timing->samples) {
+		return -1;
+	}
+
+	return tauLatencyPercentile(timing, percentile);
+}
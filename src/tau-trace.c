@@ -0,0 +1,332 @@
+/* libtau wire trace: a lock free ring of timestamped data and parser events
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+#define TAU_TRACE_MIN_SIZE 4096 /* bytes, smallest ring */
+
+/** Ring of records in capture file format.  The thread using the handle
+ *  only moves head and the flushing thread only moves tail, so neither
+ *  waits for the other.  Indexes are free running, the ring position is
+ *  the index modulo the ring size */
+struct tauTrace {
+	unsigned char *ring;
+	unsigned int size;     /* power of two */
+	unsigned int head;     /* where the next record goes */
+	unsigned int tail;     /* first byte not yet in the file */
+	unsigned int dropped;  /* records that didn't fit since the last flush */
+	struct timespec start; /* CLOCK_MONOTONIC when tracing started */
+	FILE *file;
+};
+
+/***************************************************************************
+ * Private routines
+ ***************************************************************************/
+
+/** Copies bytes into the ring, wrapping around its end
+ * \param trace the trace
+ * \param head index to copy to, advanced past the bytes
+ * \param data bytes to copy
+ * \param length number of bytes
+ */
+static void tauTraceCopy(struct tauTrace *trace, unsigned int *head,
+			 const void *data, size_t length)
+{
+	unsigned int start = *head & (trace->size - 1);
+	size_t chunk = trace->size - start;
+
+	if (chunk > length) {
+		chunk = length;
+	}
+	memcpy(&trace->ring[start], data, chunk);
+	memcpy(trace->ring, (const unsigned char *)data + chunk, length - chunk);
+	*head += length;
+}
+
+/** Writes the part of the ring between two indexes to the file
+ * \param trace the trace
+ * \param from first index
+ * \param to index past the last byte
+ * \returns zero on success
+ */
+static int tauTraceWrite(struct tauTrace *trace, unsigned int from, unsigned int to)
+{
+	unsigned int start = from & (trace->size - 1);
+	size_t length = to - from;
+	size_t chunk = trace->size - start;
+
+	if (chunk > length) {
+		chunk = length;
+	}
+	if (fwrite(&trace->ring[start], 1, chunk, trace->file) != chunk) {
+		return -1;
+	}
+	if (fwrite(trace->ring, 1, length - chunk, trace->file) != length - chunk) {
+		return -1;
+	}
+	return 0;
+}
+
+/** Fills in the header of a record stamped with the current time
+ * \param trace the trace
+ * \param record holder for the header
+ * \param type what the record holds
+ * \param length bytes of data after the header
+ */
+static void tauTraceStamp(struct tauTrace *trace, struct tauTraceRecord *record,
+			  enum tauTraceType type, size_t length)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_nsec < trace->start.tv_nsec) {
+		now.tv_sec--;
+		now.tv_nsec += 1000000000;
+	}
+	record->sec = now.tv_sec - trace->start.tv_sec;
+	record->nsec = now.tv_nsec - trace->start.tv_nsec;
+	record->length = length;
+	record->type = type;
+	record->reserved = 0;
+}
+
+/** Writes the ring to the file and notes the records that were lost
+ * \param trace the trace
+ * \returns zero on success
+ */
+static int tauTraceDrain(struct tauTrace *trace)
+{
+	struct tauTraceRecord record;
+	unsigned int head, dropped;
+	uint32_t lost;
+	int ret;
+
+	/* The records are complete up to head once it is seen */
+	head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+	dropped = __atomic_exchange_n(&trace->dropped, 0, __ATOMIC_RELAXED);
+
+	ret = tauTraceWrite(trace, trace->tail, head);
+	__atomic_store_n(&trace->tail, head, __ATOMIC_RELEASE);
+
+	if (dropped) {
+		lost = dropped;
+		tauTraceStamp(trace, &record, TAU_TRACE_DROPPED, sizeof(lost));
+		if ((fwrite(&record, sizeof(record), 1, trace->file) != 1) ||
+		    (fwrite(&lost, sizeof(lost), 1, trace->file) != 1)) {
+			ret = -1;
+		}
+	}
+
+	if (fflush(trace->file)) {
+		ret = -1;
+	}
+	return ret;
+}
+
+/** Writes the rest of the trace and releases it
+ * \param link state of a traced handle
+ * \returns zero on success
+ */
+static int tauTraceClose(struct tauLink *link)
+{
+	struct tauTrace *trace = link->trace;
+	int ret;
+
+	ret = tauTraceDrain(trace);
+	if (fclose(trace->file)) {
+		ret = -1;
+	}
+	free(trace->ring);
+	free(trace);
+	link->trace = NULL;
+	return ret;
+}
+
+/***************************************************************************
+ * Internal routines
+ ***************************************************************************/
+
+void tauTraceData(struct tauLink *link, enum tauTraceType type, const struct iovec *iov,
+		  size_t length)
+{
+	struct tauTrace *trace = link->trace;
+	struct tauTraceRecord record;
+	unsigned int head, tail;
+	size_t chunk;
+
+	/* A longer chunk than a record holds never goes over the link in one
+	 * call, the ring and the largest packet are much smaller */
+	if (length > 0xFFFF) {
+		length = 0xFFFF;
+	}
+
+	head = trace->head;
+	tail = __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE);
+	if (sizeof(record) + length > trace->size - (head - tail)) {
+		__atomic_fetch_add(&trace->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	tauTraceStamp(trace, &record, type, length);
+	tauTraceCopy(trace, &head, &record, sizeof(record));
+	for (; length; iov++) {
+		chunk = iov->iov_len < length ? iov->iov_len : length;
+		tauTraceCopy(trace, &head, iov->iov_base, chunk);
+		length -= chunk;
+	}
+
+	/* Published only once the whole record is in the ring */
+	__atomic_store_n(&trace->head, head, __ATOMIC_RELEASE);
+}
+
+
+void tauTraceEvent(struct tauLink *link, enum tauTraceType type, const void *data,
+		   size_t length)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = length;
+	tauTraceData(link, type, &iov, length);
+}
+
+
+void tauTraceFrame(struct tauLink *link, const struct tauFrame *frame,
+		   unsigned int skipped, unsigned int resyncs, int done)
+{
+	uint32_t lost[2];
+	unsigned char good;
+
+	if ((frame->skipped != skipped) || (frame->resyncs != resyncs)) {
+		lost[0] = frame->skipped - skipped;
+		lost[1] = frame->resyncs - resyncs;
+		tauTraceEvent(link, TAU_TRACE_RESYNC, lost, sizeof(lost));
+	}
+
+	if (done) {
+		good = tauFrameIntact(frame);
+		tauTraceEvent(link, TAU_TRACE_FRAME, &good, sizeof(good));
+	}
+}
+
+
+void tauTraceResult(struct tauLink *link, tauCmd cmd, tauStatus status)
+{
+	unsigned char result[2];
+
+	if (link->trace) {
+		result[0] = cmd;
+		result[1] = status;
+		tauTraceEvent(link, TAU_TRACE_RESULT, result, sizeof(result));
+	}
+}
+
+
+void tauTraceFree(struct tauLink *link)
+{
+	if (link->trace && tauTraceClose(link)) {
+		fprintf(stderr,"%s: failed to write the wire trace\n",__FUNCTION__);
+	}
+}
+
+/***************************************************************************
+ * Public routines
+ ***************************************************************************/
+
+tauStatus tauTraceStart(tauHandler handler, const char *path, unsigned long size)
+{
+	struct tauLink *link = tauLinkGet(handler);
+	struct tauTraceFileHeader header;
+	struct tauTrace *trace;
+	struct timespec now;
+	unsigned int ring_size;
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+	tauTraceFree(link);
+
+	if (!size) {
+		size = TAU_TRACE_DEFAULT_SIZE;
+	}
+	for (ring_size = TAU_TRACE_MIN_SIZE; (ring_size < size) && (ring_size < 0x80000000u); ring_size *= 2);
+
+	trace = calloc(1, sizeof(*trace));
+	if (!trace) {
+		fprintf(stderr,"%s: failed to allocate the wire trace\n",__FUNCTION__);
+		return CAM_COMMUNICATION_ERROR;
+	}
+	trace->size = ring_size;
+	trace->ring = malloc(ring_size);
+	if (!trace->ring) {
+		fprintf(stderr,"%s: failed to allocate a %u byte trace ring\n",__FUNCTION__,ring_size);
+		free(trace);
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	trace->file = fopen(path, "w");
+	if (!trace->file) {
+		perror("Unable to create wire trace");
+		free(trace->ring);
+		free(trace);
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	clock_gettime(CLOCK_MONOTONIC, &trace->start);
+	memset(&header, 0, sizeof(header));
+	header.magic = TAU_TRACE_MAGIC;
+	header.version = TAU_TRACE_VERSION;
+	header.start_sec = now.tv_sec;
+	header.start_nsec = now.tv_nsec;
+	if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+		perror("Unable to write wire trace");
+		fclose(trace->file);
+		free(trace->ring);
+		free(trace);
+		return CAM_COMMUNICATION_ERROR;
+	}
+
+	dbg("Tracing handle %d into %s with a %u byte ring", link->fd, path, ring_size);
+	link->trace = trace;
+	return CAM_OK;
+}
+
+
+tauStatus tauTraceFlush(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+	if (link->trace && tauTraceDrain(link->trace)) {
+		perror("Unable to write wire trace");
+		return CAM_COMMUNICATION_ERROR;
+	}
+	return CAM_OK;
+}
+
+
+tauStatus tauTraceStop(tauHandler handler)
+{
+	struct tauLink *link = tauLinkGet(handler);
+
+	if (!link) {
+		return CAM_COMMUNICATION_ERROR;
+	}
+	if (link->trace && tauTraceClose(link)) {
+		perror("Unable to write wire trace");
+		return CAM_COMMUNICATION_ERROR;
+	}
+	return CAM_OK;
+}
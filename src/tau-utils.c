@@ -52,33 +52,33 @@ int debug_level = 0;
 
 void hexDump(const char *title, const void *data, const long data_count)
 {
-	int i, j, k, l;
-	unsigned char *buffer = (unsigned char *)data;
+	const unsigned char *buffer = data;
+	char row[16 + BYTES_PER_ROW * 6];
+	int i, j, len, c;
 
-	qdbg("\n%s (len: %ld)\n", title, data_count);
+	if (!DEBUG_ENABLED(0)) {
+		return;
+	}
+
+	fprintf(stderr, "\n%s (len: %ld)\n", title, data_count);
 
-	for (i = 0, k = 0; i < data_count; i += BYTES_PER_ROW) {
-		qdbg("  0x%04X: ", i);
-		for (j = 0, l = k; j < BYTES_PER_ROW; j++, l++) {
-			if (l < data_count) {
-				qdbg("0x%02X ", buffer[l]);
+	/* One write per row, not per byte */
+	for (i = 0; i < data_count; i += BYTES_PER_ROW) {
+		len = sprintf(row, "  0x%04X: ", i);
+		for (j = i; j < i + BYTES_PER_ROW; j++) {
+			if (j < data_count) {
+				len += sprintf(&row[len], "0x%02X ", buffer[j]);
 			} else {
-				qdbg("     ");
+				len += sprintf(&row[len], "     ");
 			}
 		}
-		for (j = 0, l = k; j < BYTES_PER_ROW; j++, k++, l++) {
-			if (l < data_count) {
-				int c = buffer[k];
-				if ((c >= 0x20) && (c < 0x7f)) {
-					qdbg("%c", c);
-				} else {
-					qdbg(".");
-				}
-			} else {
-				qdbg(" ");
-			}
+		for (j = i; j < i + BYTES_PER_ROW; j++) {
+			c = j < data_count ? buffer[j] : ' ';
+			row[len++] = ((c >= 0x20) && (c < 0x7f)) ? c : '.';
 		}
-		qdbg("\n");
+		row[len++] = '\n';
+		row[len] = '\0';
+		fputs(row, stderr);
 	}
 }
 
@@ -91,7 +91,7 @@ int asciiHexToBinary(char *buffer, const int buf_len, char *ascii_hex)
 	int nibbles = 0; /* number of nibbles stored in val */
 	char val = 0;
 
-	while (*ptr) {
+	while (*ptr && (count < buf_len)) {
 		c = toupper(*ptr);
 
 		if (isblank(c)) {
@@ -129,76 +129,378 @@ void setDebugLevel(int level)
 
 
 
-/* crcCcitt16() from http://www.lammertbies.nl/comm/software/index.html */
+/* crcCcitt16() originally from http://www.lammertbies.nl/comm/software/index.html
+ *
+ * The tables are generated at build time by tau-crcgen.  Short buffers go
+ * through crc_tabccitt[0] a byte at a time, longer ones eight bytes at a
+ * time using all eight tables, and when the CPU has a carry-less multiply
+ * instruction buffers of 64 bytes or more are folded 16 bytes at a time.
+ */
+
+#include "tau-crc-tables.h"
 
-#define                 P_CCITT     0x1021
+#define P_CCITT 0x1021
 
-static unsigned short   crc_tabccitt[256];
-static int              crc_tabccitt_init       = 0;
+typedef unsigned short (*crcKernel)(unsigned short crc, const unsigned char *data, size_t length);
 
-/** Fills the array of 256 values with the pre-calculated CRC value
+/** Adds bytes to a CCITT16 CRC one at a time
+ * \param crc existing CCITT16 CRC value
+ * \param data bytes to add to the CRC
+ * \param length number of bytes
+ * \return updated CCITT16 CRC value
  */
-static void initCrcCcitt16Tab( void ) {
+static unsigned short updateCrcCcitt16Bytewise(unsigned short crc, const unsigned char *data, size_t length)
+{
+	while (length--) {
+		crc = (crc << 8) ^ crc_tabccitt[0][(crc >> 8) ^ *data++];
+	}
+	return crc;
+}
 
-	int i, j;
-	unsigned short crc, c;
+/** Adds bytes to a CCITT16 CRC eight at a time
+ * \param crc existing CCITT16 CRC value
+ * \param data bytes to add to the CRC
+ * \param length number of bytes
+ * \return updated CCITT16 CRC value
+ */
+static unsigned short updateCrcCcitt16Slice8(unsigned short crc, const unsigned char *data, size_t length)
+{
+	while (length >= 8) {
+		crc = crc_tabccitt[7][data[0] ^ (crc >> 8)] ^
+			crc_tabccitt[6][data[1] ^ (crc & 0xFF)] ^
+			crc_tabccitt[5][data[2]] ^
+			crc_tabccitt[4][data[3]] ^
+			crc_tabccitt[3][data[4]] ^
+			crc_tabccitt[2][data[5]] ^
+			crc_tabccitt[1][data[6]] ^
+			crc_tabccitt[0][data[7]];
+		data += 8;
+		length -= 8;
+	}
+	return updateCrcCcitt16Bytewise(crc, data, length);
+}
 
-	for (i=0; i<256; i++) {
+/* Carry-less multiply folding.  Each 16 byte block is handled as a 128 bit
+ * polynomial, first byte most significant.  Moving a block k blocks forward
+ * multiplies it by x^(128k), so its upper and lower halves are multiplied
+ * by x^(128k+64) mod P and x^(128k) mod P, which keeps it congruent modulo P
+ * while it still fits in 128 bits.  Four blocks are kept in flight to hide
+ * the multiplier latency.  What is left once the data runs out is an
+ * ordinary 16 byte message whose CRC is computed with the tables. */
 
-		crc = 0;
-		c   = ((unsigned short) i) << 8;
+#define CRC_FOLD_MIN 64 /* bytes, smaller buffers use the tables */
 
-		for (j=0; j<8; j++) {
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_CRC_FOLD 1
 
-			if ( (crc ^ c) & 0x8000 ) {
-				crc = ( crc << 1 ) ^ P_CCITT;
-			} else {
-				crc =   crc << 1;
-			}
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i foldCrcCcitt16Block(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+			     _mm_clmulepi64_si128(x, k, 0x00));
+}
 
-			c = c << 1;
-		}
+__attribute__((target("pclmul,ssse3")))
+static unsigned short updateCrcCcitt16Fold(unsigned short crc, const unsigned char *data, size_t length)
+{
+	const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i x0, x1, x2, x3, k;
+	unsigned char block[16];
+
+	if (length < CRC_FOLD_MIN) {
+		return updateCrcCcitt16Slice8(crc, data, length);
+	}
 
-		crc_tabccitt[i] = crc;
+	x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), swap);
+	x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), swap);
+	x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), swap);
+	x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), swap);
+	/* The starting CRC is added to the first two message bytes */
+	x0 = _mm_xor_si128(x0, _mm_set_epi64x((long long)crc << 48, 0));
+	data += 64;
+	length -= 64;
+
+	k = _mm_set_epi64x(crc_foldccitt[3][0], crc_foldccitt[3][1]);
+	while (length >= 64) {
+		x0 = _mm_xor_si128(foldCrcCcitt16Block(x0, k),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), swap));
+		x1 = _mm_xor_si128(foldCrcCcitt16Block(x1, k),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), swap));
+		x2 = _mm_xor_si128(foldCrcCcitt16Block(x2, k),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), swap));
+		x3 = _mm_xor_si128(foldCrcCcitt16Block(x3, k),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), swap));
+		data += 64;
+		length -= 64;
 	}
 
-	crc_tabccitt_init = 1;
+	/* Fold the four blocks into one */
+	x3 = _mm_xor_si128(x3, foldCrcCcitt16Block(x0, _mm_set_epi64x(crc_foldccitt[2][0], crc_foldccitt[2][1])));
+	x3 = _mm_xor_si128(x3, foldCrcCcitt16Block(x1, _mm_set_epi64x(crc_foldccitt[1][0], crc_foldccitt[1][1])));
+	x3 = _mm_xor_si128(x3, foldCrcCcitt16Block(x2, _mm_set_epi64x(crc_foldccitt[0][0], crc_foldccitt[0][1])));
+
+	k = _mm_set_epi64x(crc_foldccitt[0][0], crc_foldccitt[0][1]);
+	while (length >= 16) {
+		x3 = _mm_xor_si128(foldCrcCcitt16Block(x3, k),
+				   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), swap));
+		data += 16;
+		length -= 16;
+	}
+
+	_mm_storeu_si128((__m128i *)block, _mm_shuffle_epi8(x3, swap));
+	crc = updateCrcCcitt16Slice8(0, block, sizeof(block));
+
+	return updateCrcCcitt16Slice8(crc, data, length);
 }
 
+/** Returns the folding kernel if the CPU supports it
+ */
+static crcKernel selectCrcCcitt16Fold(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+		return updateCrcCcitt16Fold;
+	}
+	return NULL;
+}
 
-/** Returns a new CCITT16 CRC value calcualted using an existing CRC
- *  value and adding another character to the CRC
- * \param crc existing CCITT16 CRC value
- * \param c character to add to the CRC
- * \return updated CCITT16 CRC value
+#elif defined(__aarch64__) && defined(__linux__) && defined(TAU_CRC_FOLD_AARCH64)
+/* Not yet built and checked on ARM hardware, so left out unless asked
+ * for with -DTAU_CRC_FOLD_AARCH64; check it with crcCcitt16RunTests()
+ * (-DENABLE_TESTS=1) before turning it on by default */
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_CRC_FOLD 1
+
+__attribute__((target("+crypto")))
+static inline uint64x2_t foldCrcCcitt16Block(uint64x2_t x, const uint64_t *k)
+{
+	uint64x2_t hi, lo;
+
+	hi = vreinterpretq_u64_p128(vmull_p64(vgetq_lane_u64(x, 1), k[0]));
+	lo = vreinterpretq_u64_p128(vmull_p64(vgetq_lane_u64(x, 0), k[1]));
+	return veorq_u64(hi, lo);
+}
+
+/** Loads 16 bytes as a 128 bit polynomial, first byte most significant */
+__attribute__((target("+crypto")))
+static inline uint64x2_t loadCrcCcitt16Block(const unsigned char *data)
+{
+	uint8x16_t v = vrev64q_u8(vld1q_u8(data));
+
+	return vreinterpretq_u64_u8(vextq_u8(v, v, 8));
+}
+
+__attribute__((target("+crypto")))
+static unsigned short updateCrcCcitt16Fold(unsigned short crc, const unsigned char *data, size_t length)
+{
+	uint64x2_t x0, x1, x2, x3;
+	uint8x16_t v;
+	unsigned char block[16];
+
+	if (length < CRC_FOLD_MIN) {
+		return updateCrcCcitt16Slice8(crc, data, length);
+	}
+
+	x0 = loadCrcCcitt16Block(data);
+	x1 = loadCrcCcitt16Block(data + 16);
+	x2 = loadCrcCcitt16Block(data + 32);
+	x3 = loadCrcCcitt16Block(data + 48);
+	/* The starting CRC is added to the first two message bytes */
+	x0 = veorq_u64(x0, vcombine_u64(vcreate_u64(0), vcreate_u64((uint64_t)crc << 48)));
+	data += 64;
+	length -= 64;
+
+	while (length >= 64) {
+		x0 = veorq_u64(foldCrcCcitt16Block(x0, crc_foldccitt[3]), loadCrcCcitt16Block(data));
+		x1 = veorq_u64(foldCrcCcitt16Block(x1, crc_foldccitt[3]), loadCrcCcitt16Block(data + 16));
+		x2 = veorq_u64(foldCrcCcitt16Block(x2, crc_foldccitt[3]), loadCrcCcitt16Block(data + 32));
+		x3 = veorq_u64(foldCrcCcitt16Block(x3, crc_foldccitt[3]), loadCrcCcitt16Block(data + 48));
+		data += 64;
+		length -= 64;
+	}
+
+	/* Fold the four blocks into one */
+	x3 = veorq_u64(x3, foldCrcCcitt16Block(x0, crc_foldccitt[2]));
+	x3 = veorq_u64(x3, foldCrcCcitt16Block(x1, crc_foldccitt[1]));
+	x3 = veorq_u64(x3, foldCrcCcitt16Block(x2, crc_foldccitt[0]));
+
+	while (length >= 16) {
+		x3 = veorq_u64(foldCrcCcitt16Block(x3, crc_foldccitt[0]), loadCrcCcitt16Block(data));
+		data += 16;
+		length -= 16;
+	}
+
+	v = vrev64q_u8(vreinterpretq_u8_u64(x3));
+	vst1q_u8(block, vextq_u8(v, v, 8));
+	crc = updateCrcCcitt16Slice8(0, block, sizeof(block));
+
+	return updateCrcCcitt16Slice8(crc, data, length);
+}
+
+/** Returns the folding kernel if the CPU supports it
  */
-static unsigned short updateCrcCcitt16( unsigned short crc, char c )
+static crcKernel selectCrcCcitt16Fold(void)
 {
+	if (getauxval(AT_HWCAP) & HWCAP_PMULL) {
+		return updateCrcCcitt16Fold;
+	}
+	return NULL;
+}
+#endif
 
-	unsigned short tmp, short_c;
+static crcKernel crcCcitt16Kernel = updateCrcCcitt16Slice8;
 
-	short_c  = 0x00ff & (unsigned short) c;
+#if HAVE_CRC_FOLD
+/** Checks a kernel against the tables on a few lengths around the fold
+ *  sizes, so a kernel that gets the CRC wrong is never used for packets
+ * \param update the kernel
+ * \return nonzero if it agrees with the tables
+ */
+static int checkCrcCcitt16Kernel(crcKernel update)
+{
+	static const size_t lengths[] = { CRC_FOLD_MIN, CRC_FOLD_MIN + 17, 4 * CRC_FOLD_MIN + 5 };
+	unsigned char data[4 * CRC_FOLD_MIN + 5];
+	size_t i;
 
-	if ( ! crc_tabccitt_init )
-	{
-		initCrcCcitt16Tab();
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = i * 167 + 13;
 	}
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		if (update(0x1D0F, data, lengths[i]) !=
+		    updateCrcCcitt16Slice8(0x1D0F, data, lengths[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+#endif
 
-	tmp = (crc >> 8) ^ short_c;
-	crc = (crc << 8) ^ crc_tabccitt[tmp];
+/** Picks the fastest CRC kernel the CPU supports, before main() runs so
+ *  threads never see the choice change
+ */
+__attribute__((constructor))
+static void initCrcCcitt16(void)
+{
+#if HAVE_CRC_FOLD
+	crcKernel fold = selectCrcCcitt16Fold();
+
+	if (fold && checkCrcCcitt16Kernel(fold)) {
+		crcCcitt16Kernel = fold;
+	}
+#endif
+}
 
-	return crc;
 
+unsigned short crcCcitt16Update(unsigned short crc, const void *buffer, size_t length)
+{
+	if (length < 8) {
+		return updateCrcCcitt16Bytewise(crc, buffer, length);
+	}
+	return crcCcitt16Kernel(crc, buffer, length);
 }
 
 
 unsigned short crcCcitt16(char *data, unsigned short length)
 {
-	short crc = 0x0000; /* newer ccitt 16 uses 0xFFFF */
+	return crcCcitt16Update(0x0000, data, length); /* newer ccitt 16 uses 0xFFFF */
+}
 
-	while (length-- > 0) {
-		crc = updateCrcCcitt16(crc, *data++);
-	}
+/***************************************************************************
+ * Development and testing routines
+ ***************************************************************************/
 
+#if ENABLE_TESTS
+#include <time.h>
+
+/** Reference CCITT16 CRC, one bit at a time */
+static unsigned short crcCcitt16Bitwise(unsigned short crc, const unsigned char *data, size_t length)
+{
+	int j;
+
+	while (length--) {
+		crc ^= *data++ << 8;
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ P_CCITT : crc << 1;
+		}
+	}
 	return crc;
 }
+
+int crcCcitt16RunTests(void)
+{
+	static const struct {
+		const char *name;
+		crcKernel update;
+	} kernels[] = {
+		{ "bytewise", updateCrcCcitt16Bytewise },
+		{ "slicing-by-8", updateCrcCcitt16Slice8 },
+#if HAVE_CRC_FOLD
+		{ "carry-less multiply", NULL },
+#endif
+	};
+	const size_t size = 4 << 20;
+	unsigned char *buffer;
+	struct timespec start, end;
+	unsigned int seed = 1;
+	unsigned short expected, crc;
+	size_t offset, length;
+	double seconds;
+	int failures = 0;
+	int i, j;
+
+	buffer = malloc(size);
+	if (!buffer) {
+		return -1;
+	}
+	for (offset = 0; offset < size; offset++) {
+		seed = seed * 1103515245 + 12345;
+		buffer[offset] = seed >> 16;
+	}
+
+	for (i = 0; i < (int)(sizeof(kernels) / sizeof(kernels[0])); i++) {
+		crcKernel update = kernels[i].update;
+
+#if HAVE_CRC_FOLD
+		if (!update) {
+			update = selectCrcCcitt16Fold();
+			if (!update) {
+				printf("CRC %s: not supported by this CPU\n", kernels[i].name);
+				continue;
+			}
+		}
+#endif
+
+		/* Every length up to a few folds, at every alignment, with
+		 * both a zero and a non-zero starting CRC */
+		for (length = 0; length < 300; length++) {
+			for (offset = 0; offset < 16; offset++) {
+				for (j = 0; j < 2; j++) {
+					expected = crcCcitt16Bitwise(j * 0x1D0F, &buffer[offset], length);
+					crc = update(j * 0x1D0F, &buffer[offset], length);
+					if (crc != expected) {
+						printf("CRC %s: length %zu offset %zu: 0x%04X, expected 0x%04X\n",
+						       kernels[i].name, length, offset, crc, expected);
+						failures++;
+					}
+				}
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (j = 0; j < 16; j++) {
+			crc = update(crc, buffer, size);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+		printf("CRC %s: %.1f MB/s (0x%04X)\n", kernels[i].name,
+		       16.0 * size / seconds / 1e6, crc);
+	}
+
+	free(buffer);
+	return failures;
+}
+#endif
@@ -28,13 +28,22 @@
 
 #define dbg_time do { } while (0)
 
-# define  dbg(format, arg...) if (debug_level > 0)			\
+/* Debug messages are only printed when the level asks for them, and are
+ * left out of the build entirely when TAU_NO_DEBUG is defined
+ * (./configure --disable-debug) */
+#ifdef TAU_NO_DEBUG
+# define DEBUG_ENABLED(level) 0
+#else
+# define DEBUG_ENABLED(level) __builtin_expect(debug_level > (level), 0)
+#endif
+
+# define  dbg(format, arg...) if (DEBUG_ENABLED(0))			\
 		do { dbg_time ; fprintf(stderr, "%s: " format "\n", __FUNCTION__, ##arg); } while (0);
 
-# define vdbg(format, arg...) if (debug_level > 1)			\
+# define vdbg(format, arg...) if (DEBUG_ENABLED(1))			\
 		do { dbg_time ; fprintf(stderr, "%s: " format "\n", __FUNCTION__, ##arg); } while (0);
 
-# define  qdbg(format, arg...) if (debug_level > 0) fprintf(stderr, format, ##arg);
+# define  qdbg(format, arg...) if (DEBUG_ENABLED(0)) fprintf(stderr, format, ##arg);
 
 # define PASSERT(truth, msg) do { if (!truth) { fprintf(stderr, "ASSERT: failed, %s\n", msg); } } while (0);
 
@@ -54,7 +63,8 @@ extern int debug_level;
  ************************************************************************/
 
 /** Prints the contents of a buffer as human readable data in hexidecimal
- *  format.  Also prints an optional title string.
+ *  format.  Also prints an optional title string.  Prints nothing unless
+ *  debug is enabled.
  * \param title string to print before printing buffer contents
  * \param data buffer holding data to print
  * \param data_count number of bytes of data to print
@@ -85,4 +95,21 @@ void setDebugLevel(int level);
  * \return CCITT16 CRC value for the data in buffer
  */
 unsigned short crcCcitt16(char *buffer, unsigned short length);
+
+/** Continues a CCITT16 CRC over more data, so a CRC can be computed
+ *  piecewise: crcCcitt16(a+b) == crcCcitt16Update(crcCcitt16(a), b)
+ * \param crc CCITT16 CRC of the data that came before
+ * \param buffer contains bytes of binary data
+ * \param length number of bytes of data in buffer
+ * \return CCITT16 CRC value including the data in buffer
+ */
+unsigned short crcCcitt16Update(unsigned short crc, const void *buffer, size_t length);
+
+#if ENABLE_TESTS
+/** Checks every CRC kernel the CPU supports against a bitwise reference
+ *  and prints the throughput of each
+ * \return number of mismatches found
+ */
+int crcCcitt16RunTests(void);
+#endif
 #endif
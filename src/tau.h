@@ -6,6 +6,9 @@
 #ifndef __TAU_H
 #define __TAU_H
 
+#include <stdint.h>
+#include <stdio.h>
+
 /**
    For documentation on the camera see the Tau Camera User's Manual
    This API was based on version 1.20, Junary 2010
@@ -13,6 +16,15 @@
 
 #define TAU_COMM_NORMAL_TIMEOUT 1000 /* ms */
 
+#define TAU_HEADER_SIZE 8 /* bytes before the packet data, including header crc */
+#define TAU_CRC_SIZE 2 /* bytes of crc after the packet data */
+
+#define TAU_DEFAULT_BAUD_RATE 57600 /* rate the camera powers up at */
+
+#define TAU_DAEMON_SOCKET "/tmp/taud.sock" /* default taud unix socket */
+
+#define TAU_NET_CONNECT_TIMEOUT 3000 /* ms to connect to a network camera */
+
 enum tauStatus {
 	CAM_OK = 0,
 	CAM_BUSY = 1,
@@ -30,15 +42,16 @@ enum tauStatus {
 };
 typedef enum tauStatus tauStatus;
 
-enum tauCmd {
-	NO_OP = 0x00,
-	SET_DEFAULTS = 0x01,
-	CAMERA_RESET = 0x02,
-
-	GET_REVISION = 0x05,
+/* Flags of a command descriptor */
+#define TAU_CMD_IDEMPOTENT 0x01 /* sending it again has no further effect */
+#define TAU_CMD_SETTING    0x02 /* answers its value without data, sets it with data */
+#define TAU_CMD_CONSTANT   0x04 /* the answer never changes while the camera runs */
 
-	FFC_MODE_SELECT = 0x0B
-	/*etc */
+enum tauCmd {
+#define TAU_COMMAND(name, code, request_min, request_max, request_step, \
+		    response_max, flags, processing_ms) name = code,
+#include "tau-commands.def"
+#undef TAU_COMMAND
 };
 typedef enum tauCmd tauCmd;
 
@@ -55,6 +68,31 @@ typedef int tauHandler;
  */
 tauHandler tauOpenFromSerial(char *device);
 
+/** Opens the communication with a Tau camera over the specified
+ * device, with the port set to a rate the camera already uses.
+ * \param device is a string with the path to the RS232 device connected
+ *   to the Tau camera. Ej. "/dev/ttyS0"
+ * \param rate line rate in bits per second, one of 9600, 19200, 57600,
+ *   115200, 460800 or 921600
+ * \returns a tauHandler to use with the rest of the library, or negative
+ *  number in case of error
+ */
+tauHandler tauOpenFromSerialAtRate(char *device, long rate);
+
+/** Opens the communication with a Tau camera over the specified device
+ * at whatever rate the camera uses.  A NO_OP is sent at each rate and
+ * waited for only as long as it takes on the wire, trying the rate the
+ * device was last found at first, then 57600 and the rest fastest first.
+ * A camera is found within a few hundred milliseconds at worst.
+ * \param device is a string with the path to the RS232 device connected
+ *   to the Tau camera. Ej. "/dev/ttyS0"
+ * \param cache_dir (optional, may be NULL) directory where the rate each
+ *   device was found at is kept, one small file per device path
+ * \returns a tauHandler to use with the rest of the library, or negative
+ *  number if the device can't be opened or no camera answers at any rate
+ */
+tauHandler tauOpenFromSerialDetect(char *device, const char *cache_dir);
+
 /** Creates a tauHandler from a standard file descriptior
  * \param fd a file descriptor
  * \returns a tauHandler to use with the rest of the library, or negative
@@ -62,6 +100,29 @@ tauHandler tauOpenFromSerial(char *device);
  */
 tauHandler tauOpenFromFd(int fd);
 
+/** Connects to a taud daemon that owns the serial port to a Tau camera.
+ * The daemon has already verified communication with the camera, and
+ * forwards each request packet on behalf of its clients, so the handler
+ * can be used with tauDoCmd() right away.
+ * \param path unix socket the daemon listens on, NULL for TAU_DAEMON_SOCKET
+ * \returns a tauHandler to use with the rest of the library, or negative
+ * number in case on error
+ */
+tauHandler tauOpenFromDaemon(const char *path);
+
+/** Connects to a Tau camera behind a serial to Ethernet bridge.  The
+ * connection sends each request in one segment and detects a dead peer
+ * with keepalives.  If it drops, the next command connects again, and is
+ * resent if the command is idempotent.
+ * \param host name or address of the bridge
+ * \param port TCP port of the bridge
+ * \param ms_connect milliseconds to wait for the connection, zero for
+ *   TAU_NET_CONNECT_TIMEOUT
+ * \returns a tauHandler to use with the rest of the library, or negative
+ * number in case on error
+ */
+tauHandler tauOpenFromNetwork(const char *host, unsigned short port, long ms_connect);
+
 /** Returns the file discriptor assoicated with the tauHandler
  * \param handler a tau handler used to exchange data with a Tau camera
  * \returns a file descriptor
@@ -82,6 +143,828 @@ tauStatus tauDoCmd(tauHandler handler,tauCmd cmd,
 		   char *input, short input_size,
 		   char* output, short *output_count);
 
+/** Sends an already built request packet to the Tau device and receives
+ * the response packet without interpreting it.
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param request the request packet, header, data and crc
+ * \param request_size number of bytes in the request packet
+ * \param response holder for the response packet
+ * \param response_size on entry the size of the response buffer, at least
+ *   TAU_HEADER_SIZE + TAU_CRC_SIZE; on exit the size of the response packet.
+ *   If the exchange fails response holds a packet with no data and the
+ *   failure as status.
+ * \returns the status of the exchange
+ */
+tauStatus tauExchangePacket(tauHandler handler, char *request, short request_size,
+			    char *response, short *response_size);
+
+/***************************************************************************
+ * Command descriptors
+ *
+ * Every command in tau-commands.def has a descriptor in a table built
+ * with the library.  tauDoCmd() and tauSubmitCmd() use it to reject data
+ * of the wrong size without a round trip to the camera, and to size
+ * response buffers and timeouts.
+ ***************************************************************************/
+
+/** What the library knows about a command */
+struct tauCommandInfo {
+	const char *name;             /* NULL for a code that isn't a command */
+	unsigned char cmd;
+	unsigned short request_min;   /* bytes of data sent with the command */
+	unsigned short request_max;
+	unsigned short request_step;
+	unsigned short response_max;  /* largest response data */
+	unsigned char flags;          /* TAU_CMD_* */
+	unsigned short processing_ms; /* time allowed before any was measured */
+};
+
+/** Returns the descriptor of a command
+ * \param cmd the command
+ * \returns the descriptor, or NULL for a code that isn't in the table
+ */
+const struct tauCommandInfo *tauCommandInfo(tauCmd cmd);
+
+/** Looks a command up by name
+ * \param name the name in enum tauCmd, case is ignored
+ * \returns the command code, or -1 if there is no such command
+ */
+int tauCommandLookup(const char *name);
+
+/** Checks the amount of data sent with a command against its descriptor
+ * \param cmd the command
+ * \param input_size bytes of data
+ * \returns CAM_OK, CAM_BYTE_COUNT_ERROR if the camera would reject it.
+ *  Codes missing from the table are not checked.
+ */
+tauStatus tauCommandCheck(tauCmd cmd, short input_size);
+
+/***************************************************************************
+ * Response cache
+ *
+ * With the cache enabled, a handle answers the reads of settings and of
+ * constants such as GET_REVISION and SERIAL_NUMBER from the responses
+ * it already received.  Setting any setting, or a command that isn't
+ * idempotent such as SET_DEFAULTS or DO_FFC, drops the cached settings;
+ * CAMERA_RESET and RESET_FACTORY_DEFAULTS drop everything.  Requests submitted with tauSubmitCmd() for a value
+ * that an earlier pending request will fetch share its exchange.  The
+ * constants can be kept in a file per camera serial number.
+ ***************************************************************************/
+
+/** Enables or disables the response cache of a handler
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param enable nonzero to cache responses, zero to drop the cache
+ * \returns CAM_OK on success
+ */
+tauStatus tauCacheEnable(tauHandler handler, int enable);
+
+/** Drops every cached response, for when something other than this
+ * handler changed the camera
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ */
+void tauCacheFlush(tauHandler handler);
+
+/** Enables the cache and fills it with the constants saved for the
+ * camera, asking the camera only for its serial number
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param dir directory of the cache files
+ * \returns CAM_OK on success, also when nothing was saved for the camera
+ */
+tauStatus tauCacheLoad(tauHandler handler, const char *dir);
+
+/** Saves the cached constants to the file for the camera's serial number.
+ * A file holding more constants than the cache, since a reset dropped
+ * them, is left as it is
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param dir directory of the cache files
+ * \returns CAM_OK on success
+ */
+tauStatus tauCacheSave(tauHandler handler, const char *dir);
+
+/***************************************************************************
+ * Asynchronous interface
+ *
+ * Commands are queued with tauSubmitCmd() and exchanged one at a time
+ * without blocking.  The application waits on tauFd() for the events
+ * returned by tauAsyncEvents(), or for tauAsyncTimeout() milliseconds,
+ * in its own event loop and then calls tauAsyncStep(), which runs the
+ * completion callback of each request that finished.  tauDoCmd() returns
+ * CAM_BUSY while submitted commands are pending on the handler.
+ ***************************************************************************/
+
+/** Reports the outcome of a command submitted with tauSubmitCmd().
+ * It may submit more commands, and may close the handler when called
+ * from tauAsyncStep(); the commands still pending then complete with
+ * CAM_COMMUNICATION_ERROR from within tauClose(), and those calls must not
+ * close it again.
+ * \param handler the handler the command was submitted on
+ * \param status the status of the command, CAM_TIMEOUT_ERROR if the camera
+ *   did not answer within tauCmdTimeout()
+ * \param cmd the command that completed
+ * \param output response data from the camera, only valid during the call
+ * \param output_count number of valid bytes in output
+ * \param user_data the pointer given to tauSubmitCmd()
+ */
+typedef void (*tauCompletion)(tauHandler handler, tauStatus status, tauCmd cmd,
+			      char *output, short output_count, void *user_data);
+
+/** Queues a cmd for the Tau device without waiting for the response.
+ * The handler's file descriptor is switched to non-blocking mode.
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param cmd the command to send to the camera
+ * \param input (optional, may be NULL) the array of input data sent to camera
+ * \param input_size if input is not NULL, the size of the input array
+ * \param output_size largest amount of response data expected
+ * \param done (optional, may be NULL) called when the command completes
+ * \param user_data passed to done
+ * \returns CAM_OK if the command was queued
+ */
+tauStatus tauSubmitCmd(tauHandler handler, tauCmd cmd,
+		       char *input, short input_size, short output_size,
+		       tauCompletion done, void *user_data);
+
+/** Returns the poll() events to wait for on tauFd() before calling
+ * tauAsyncStep()
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \returns POLLIN, POLLOUT, or zero if no command is pending
+ */
+short tauAsyncEvents(tauHandler handler);
+
+/** Returns how long until the command in progress times out
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \returns milliseconds until tauAsyncStep() has to be called even if no
+ *   event arrives, -1 if no command is pending
+ */
+int tauAsyncTimeout(tauHandler handler);
+
+/** Returns the number of submitted commands that have not completed
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ */
+int tauAsyncPending(tauHandler handler);
+
+/** Sends and receives whatever can be exchanged without blocking, and
+ * completes the commands that finished or timed out
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR for an invalid handler
+ */
+tauStatus tauAsyncStep(tauHandler handler);
+
+/***************************************************************************
+ * Multi-camera interface
+ *
+ * A fleet drives the asynchronous interface of many handlers from one
+ * epoll() loop, so each camera has a command in flight at the same time.
+ * Commands are queued on the member handlers with tauSubmitCmd(), before
+ * or during tauFleetRun(), typically from the completion callbacks.
+ ***************************************************************************/
+
+typedef struct tauFleet tauFleet;
+
+/** Creates an empty fleet
+ * \returns the fleet, or NULL on error
+ */
+tauFleet *tauFleetCreate(void);
+
+/** Adds a camera to the fleet.  Data the camera sent before is discarded
+ * when its first command starts.  The handler must stay open until the
+ * fleet is destroyed.
+ * \param fleet the fleet returned by tauFleetCreate()
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \returns zero on success, -1 on error
+ */
+int tauFleetAdd(tauFleet *fleet, tauHandler handler);
+
+/** Exchanges commands with all the cameras in the fleet in parallel until
+ * none has a command pending.  Completion callbacks run on the calling thread.
+ * \param fleet the fleet returned by tauFleetCreate()
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR if the event loop failed
+ */
+tauStatus tauFleetRun(tauFleet *fleet);
+
+/** Frees a fleet, the member handlers are left open
+ * \param fleet the fleet returned by tauFleetCreate()
+ */
+void tauFleetDestroy(tauFleet *fleet);
+
+/***************************************************************************
+ * Shared handles
+ *
+ * A handle shared with tauShare() takes commands from any number of
+ * threads.  Submitting threads push onto a lock free queue and never wait
+ * for each other; one I/O thread per handle takes the commands in the
+ * order they were submitted and exchanges them with tauDoCmd(), so the
+ * retry policy, cache and rate control apply.  tauDoCmd() called from any
+ * other thread on a shared handle submits the command and waits for it.
+ * Settings such as tauSetRetryPolicy() and tauCacheEnable() should be made
+ * before the handle is shared, and tauClose() called once no other thread
+ * uses it.  The asynchronous interface, tauExchangePacket(),
+ * tauReadMemory(), tauFlashUpdate() and tauSetBaudRate() return CAM_BUSY
+ * on shared handles, and tauNegotiateBaudRate() returns -1; negotiate the
+ * rate before sharing the handle.
+ ***************************************************************************/
+
+typedef struct tauFuture tauFuture;
+
+/** Starts the I/O thread of a handle so other threads can submit commands
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \returns CAM_OK, CAM_BUSY if commands submitted with tauSubmitCmd() are
+ *   pending, or CAM_COMMUNICATION_ERROR if the thread could not be started
+ */
+tauStatus tauShare(tauHandler handler);
+
+/** Queues a cmd on a shared handle without waiting for the response.
+ * Every future returned has to be given to tauFutureWait().
+ * \param handler a handler shared with tauShare()
+ * \param cmd the command to send to the camera
+ * \param input (optional, may be NULL) the array of input data sent to
+ *   camera, copied before the call returns
+ * \param input_size if input is not NULL, the size of the input array
+ * \param output_size largest amount of response data expected
+ * \returns the pending command, or NULL if the handler is not shared or is
+ *   being closed
+ */
+tauFuture *tauShareSubmit(tauHandler handler, tauCmd cmd,
+			  char *input, short input_size, short output_size);
+
+/** Tells whether a submitted command completed, without waiting
+ * \param future returned by tauShareSubmit()
+ * \returns nonzero if tauFutureWait() will return right away
+ */
+int tauFutureReady(tauFuture *future);
+
+/** Waits for a submitted command to complete and releases the future
+ * \param future returned by tauShareSubmit()
+ * \param output (optional, may be NULL) holder for the response data
+ * \param output_count (optional, may be NULL) on entry the size of output,
+ *   on exit the amount of valid data in output
+ * \returns the status of the command
+ */
+tauStatus tauFutureWait(tauFuture *future, char *output, short *output_count);
+
+/***************************************************************************
+ * Scheduler
+ *
+ * A scheduler polls cameras periodically and sends one-off commands
+ * between the polls, one command in flight per camera, through the
+ * asynchronous interface.  Each periodic job is released every period and
+ * has to complete within its deadline; a poll that could not even be sent
+ * by then is dropped.  When a camera is free the next command is the
+ * oldest one-off command of the most urgent priority class, and within
+ * TAU_PRIORITY_POLL, where the jobs are, the one with the earliest
+ * deadline.  Jobs are only accepted while the time their exchanges take
+ * on the wire at the camera's line rate, plus its processing time, stays
+ * within TAU_SCHED_UTILIZATION percent of each camera's time.  The
+ * processing time is the 99th percentile the handle learned; a command it
+ * never timed is exchanged once when the job is added if it is idempotent,
+ * and is otherwise assumed to take as long as its descriptor allows.
+ ***************************************************************************/
+
+#define TAU_SCHED_UTILIZATION 80 /* percent of a link periodic jobs may use */
+
+/** Classes of one-off commands, most urgent first */
+enum tauPriority {
+	TAU_PRIORITY_CONTROL, /* goes ahead of every queued poll, like DO_FFC */
+	TAU_PRIORITY_POLL,    /* competes with the periodic jobs by deadline */
+	TAU_PRIORITY_BULK,    /* only when no poll is due */
+	TAU_PRIORITY_COUNT,
+};
+
+/** How a periodic job kept up with its schedule */
+struct tauSchedStats {
+	unsigned long long released;  /* times the job came due */
+	unsigned long long completed; /* polls that got a response or an error */
+	unsigned long long errors;    /* completed polls that didn't return CAM_OK */
+	unsigned long long late;      /* polls completed past their deadline */
+	unsigned long long dropped;   /* polls dropped unsent once their deadline passed */
+	unsigned long long skipped;   /* releases while the last poll was still due */
+	unsigned long max_late_us;    /* longest a poll completed past its deadline */
+};
+
+typedef struct tauSched tauSched;
+
+/** Creates a scheduler without jobs
+ * \returns the scheduler, or NULL on error
+ */
+tauSched *tauSchedCreate(void);
+
+/** Adds a periodic job.  The handler must stay open until the scheduler is
+ * destroyed, and must not be used by a fleet at the same time.
+ * \param sched the scheduler returned by tauSchedCreate()
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param cmd the command to send to the camera
+ * \param input (optional, may be NULL) data sent with every poll, copied
+ * \param input_size if input is not NULL, the size of the input array
+ * \param output_size largest amount of response data expected
+ * \param period_ms milliseconds between polls, first due right away
+ * \param deadline_ms milliseconds after its release a poll has to have
+ *   completed, at most period_ms; zero for period_ms
+ * \param done (optional, may be NULL) called with each poll's response
+ * \param user_data passed to done
+ * \returns the job number, or -1 if the job is invalid or does not fit the
+ *   link's budget
+ */
+int tauSchedPoll(tauSched *sched, tauHandler handler, tauCmd cmd,
+		 char *input, short input_size, short output_size,
+		 long period_ms, long deadline_ms, tauCompletion done, void *user_data);
+
+/** Queues a one-off command, sent when its camera is next free and nothing
+ * more urgent is waiting
+ * \param sched the scheduler returned by tauSchedCreate()
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param priority the class of the command
+ * \param cmd the command to send to the camera
+ * \param input (optional, may be NULL) the array of input data, copied
+ * \param input_size if input is not NULL, the size of the input array
+ * \param output_size largest amount of response data expected
+ * \param done (optional, may be NULL) called when the command completes
+ * \param user_data passed to done
+ * \returns CAM_OK if the command was queued
+ */
+tauStatus tauSchedCommand(tauSched *sched, tauHandler handler, enum tauPriority priority,
+			  tauCmd cmd, char *input, short input_size, short output_size,
+			  tauCompletion done, void *user_data);
+
+/** Runs the scheduler.  Completion callbacks run on the calling thread and
+ * may add jobs and queue commands.
+ * \param sched the scheduler returned by tauSchedCreate()
+ * \param ms milliseconds to run for, -1 until tauSchedStop() is called
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR if the event loop failed
+ */
+tauStatus tauSchedRun(tauSched *sched, long ms);
+
+/** Makes tauSchedRun() return once the commands in flight completed, for
+ * use from completion callbacks
+ * \param sched the scheduler returned by tauSchedCreate()
+ */
+void tauSchedStop(tauSched *sched);
+
+/** Returns how a periodic job kept up with its schedule
+ * \param sched the scheduler returned by tauSchedCreate()
+ * \param job the number returned by tauSchedPoll()
+ * \param stats holder for the counters
+ * \returns CAM_OK, or CAM_RANGE_ERROR for an unknown job
+ */
+tauStatus tauSchedJobStats(tauSched *sched, int job, struct tauSchedStats *stats);
+
+/** Writes the job counters and the budget of each camera in the
+ * Prometheus text exposition format
+ * \param sched the scheduler returned by tauSchedCreate()
+ * \param file where to write the metrics
+ */
+void tauSchedWrite(tauSched *sched, FILE *file);
+
+/** Frees a scheduler once the commands in flight completed.  Queued
+ * one-off commands complete with CAM_COMMUNICATION_ERROR; the handlers are
+ * left open.
+ * \param sched the scheduler returned by tauSchedCreate()
+ */
+void tauSchedDestroy(tauSched *sched);
+
+/***************************************************************************
+ * Bulk memory access
+ *
+ * tauReadMemory() reads a range of camera memory or flash with one
+ * READ_MEMORY exchange per chunk of up to TAU_READ_CHUNK bytes, back to
+ * back, each chunk parsed straight into its place in the buffer and
+ * checked against the packet crc.  Chunks that fail are retried after
+ * the rest.  The caller may keep the chunk map, for example in a file,
+ * to resume an interrupted read.
+ ***************************************************************************/
+
+#define TAU_READ_CHUNK 256 /* bytes per READ_MEMORY exchange */
+#define TAU_WRITE_CHUNK 256 /* bytes per WRITE_MEMORY exchange */
+#define TAU_FLASH_BLOCK_SIZE 0x10000 /* bytes erased by ERASE_MEMORY_BLOCK */
+#define TAU_CHUNK_COUNT(size) (((size) + TAU_READ_CHUNK - 1) / TAU_READ_CHUNK)
+
+/** Progress of a chunk of a bulk read */
+struct tauChunk {
+	unsigned short crc;  /* crcCcitt16() of the chunk data once read */
+	unsigned char done;  /* the buffer holds the chunk data */
+	unsigned char tries; /* failed attempts */
+};
+
+/** Reports the progress of a bulk read
+ * \param done bytes of the range in the buffer
+ * \param total size of the range
+ * \param bytes_per_second throughput of this call so far
+ * \param user_data the pointer given to tauReadMemory()
+ * \returns zero to go on, nonzero to stop the read
+ */
+typedef int (*tauProgress)(unsigned long done, unsigned long total,
+			   unsigned long bytes_per_second, void *user_data);
+
+/** Reads a range of camera memory
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param address camera address of the first byte
+ * \param size number of bytes to read
+ * \param buffer holder for the data, size bytes
+ * \param chunks (optional, may be NULL) TAU_CHUNK_COUNT(size) entries, zeroed
+ *   for a new read.  Chunks marked done whose data in buffer still matches
+ *   their crc are not read again.
+ * \param retries number of extra passes over the chunks that failed
+ * \param progress (optional, may be NULL) called every 100 ms or so
+ * \param user_data passed to progress
+ * \returns CAM_OK once every chunk was read, CAM_NOT_READY if progress
+ *   stopped the read, CAM_BUSY if the handler is shared or has submitted
+ *   requests pending, otherwise the status of the last failed chunk
+ */
+tauStatus tauReadMemory(tauHandler handler, unsigned long address, unsigned long size,
+			char *buffer, struct tauChunk *chunks, int retries,
+			tauProgress progress, void *user_data);
+
+/** Accounting of a flash update */
+struct tauFlashStats {
+	unsigned long blocks;          /* blocks compared */
+	unsigned long blocks_written;  /* blocks erased and rewritten */
+	unsigned long bytes_skipped;   /* image bytes the camera already held */
+	unsigned long bytes_written;   /* bytes sent with WRITE_MEMORY */
+	unsigned long verify_failures; /* rewritten blocks that read back wrong */
+};
+
+/** Brings a flash region in line with an image, block by block.  Each
+ * block is read and compared with the image; only blocks that differ are
+ * erased, written, leaving chunks that stay erased alone, and read back
+ * to verify them.
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param address camera address of the region, a multiple of block_size
+ * \param image what the region has to hold
+ * \param size number of bytes in image
+ * \param block_size flash erase block size, has to be TAU_FLASH_BLOCK_SIZE
+ * \param stats (optional, may be NULL) holder for the accounting
+ * \param progress (optional, may be NULL) called after each block
+ * \param user_data passed to progress
+ * \returns CAM_OK once the region matches the image, CAM_NOT_READY if
+ *   progress stopped the update, CAM_CHECKSUM_ERROR if a block doesn't
+ *   verify, CAM_RANGE_ERROR for a misplaced region or another block_size,
+ *   CAM_BUSY if the handler is shared or has submitted requests pending,
+ *   otherwise the status of the command that failed
+ */
+tauStatus tauFlashUpdate(tauHandler handler, unsigned long address, const char *image,
+			 unsigned long size, unsigned long block_size,
+			 struct tauFlashStats *stats, tauProgress progress, void *user_data);
+
+/***************************************************************************
+ * Configuration
+ *
+ * A configuration is the value of each camera setting that can be read
+ * back: the command answers with the value when sent without data and
+ * sets it when sent with it.  tauConfigApply() only sets the values that
+ * differ from what the camera has, so on a camera that is already
+ * configured it costs one GET per setting and nothing is saved.
+ ***************************************************************************/
+
+#define TAU_PARAM_MAX_SIZE 8     /* bytes in the largest setting */
+#define TAU_CONFIG_MAX_PARAMS 64 /* settings in a configuration */
+
+/** The value of one camera setting */
+struct tauParam {
+	unsigned char cmd;                /* command that gets and sets it */
+	unsigned char size;               /* bytes in value */
+	char value[TAU_PARAM_MAX_SIZE];
+};
+
+/** A set of camera settings */
+struct tauConfig {
+	int count;
+	struct tauParam params[TAU_CONFIG_MAX_PARAMS];
+};
+
+/** Reads every setting the camera supports
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param config holder for the settings
+ * \returns CAM_OK on success, or the status of the command that failed
+ */
+tauStatus tauConfigSnapshot(tauHandler handler, struct tauConfig *config);
+
+/** Lists the settings of desired whose value differs in current, or that
+ * current doesn't have
+ * \param current the settings the camera has
+ * \param desired the settings it should have
+ * \param changes (optional, may be NULL) holder for the settings to apply,
+ *   with the desired values
+ * \returns the number of differing settings
+ */
+int tauConfigDiff(const struct tauConfig *current, const struct tauConfig *desired,
+		  struct tauConfig *changes);
+
+/** Reads the settings listed in desired from the camera, sets the ones that
+ * differ and, if anything changed and save is nonzero, saves the result
+ * with a single SET_DEFAULTS
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param desired the settings the camera should have
+ * \param save nonzero to make the settings the power on defaults
+ * \param changes (optional, may be NULL) holder for the settings that were set
+ * \returns CAM_OK on success, CAM_RANGE_ERROR if desired names a command
+ *  that is not a setting or the camera kept another value than the one
+ *  asked for, otherwise the status of the command that failed
+ */
+tauStatus tauConfigApply(tauHandler handler, const struct tauConfig *desired, int save,
+			 struct tauConfig *changes);
+
+/** Returns the name of a setting
+ * \param cmd the command that gets and sets it
+ * \returns the name, or NULL if cmd isn't a setting
+ */
+const char *tauParamName(tauCmd cmd);
+
+/** Writes settings as text, one "<command> <value>  # <name>" line each, in
+ * the two digit hex form taucmd -b reads, so the file can be replayed
+ * \param out stream to write to
+ * \param config the settings
+ * \returns zero on success, -1 on error
+ */
+int tauConfigWrite(FILE *out, const struct tauConfig *config);
+
+/** Reads settings written by tauConfigWrite().  Blank lines and
+ * everything after a # are ignored.
+ * \param in stream to read from
+ * \param config holder for the settings
+ * \returns zero on success, -1 if a line can't be parsed, names a command
+ *   that is not a setting, or there are too many settings
+ */
+int tauConfigRead(FILE *in, struct tauConfig *config);
+
+/***************************************************************************
+ * Line rate control
+ *
+ * Handlers opened with tauOpenFromSerial*() can move the camera and the
+ * port to a faster rate.  Every change is confirmed with a NO-OP at the
+ * new rate; if the camera does not answer both ends go back to the old
+ * one.  With rate control enabled tauDoCmd() counts checksum, timeout and
+ * communication errors, steps the rate down when they pile up and tries
+ * the next faster rate again after a long run of clean exchanges.
+ * tauClose() puts the camera back at the rate the port was opened at.
+ ***************************************************************************/
+
+/** Moves the camera and the port to the fastest rate up to max_rate the
+ * link carries without errors
+ * \param handler the handler for the Tau camera returned by tauOpenFromSerial*()
+ * \param max_rate fastest rate to use, in bits per second
+ * \param adaptive nonzero to keep adjusting the rate to the error rate
+ * \returns the rate in use, or -1 if the handler is not a serial port, is
+ *   shared or has submitted requests pending
+ */
+long tauNegotiateBaudRate(tauHandler handler, long max_rate, int adaptive);
+
+/** Moves the camera and the port to the given rate
+ * \param handler the handler for the Tau camera returned by tauOpenFromSerial*()
+ * \param rate line rate in bits per second
+ * \returns CAM_OK if both ends use the new rate, CAM_RANGE_ERROR for an
+ *  unsupported rate, CAM_FEATURE_NOT_ENABLED if the handler is not a serial port,
+ *  CAM_BUSY if the handler is shared or has submitted requests pending
+ */
+tauStatus tauSetBaudRate(tauHandler handler, long rate);
+
+/** Returns the rate the link currently uses
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \returns bits per second, zero if the handler is not a serial port
+ */
+long tauBaudRate(tauHandler handler);
+
+/***************************************************************************
+ * Response timeouts
+ *
+ * Each command waits for its response as long as its frames take on the
+ * wire at the current rate, plus the time the camera takes to process
+ * it.  Until a handle has seen a command a few times the processing time
+ * is the one in the command descriptor, TAU_COMM_NORMAL_TIMEOUT or more
+ * for slow commands such as DO_FFC and SET_DEFAULTS; after that it is
+ * twice the 99th percentile of the latency observed on the handle, so a
+ * dead camera is noticed within a few times its usual response time.
+ ***************************************************************************/
+
+/** Returns how long the next exchange of a command will wait for the response
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param cmd the command
+ * \param input_size number of bytes of data sent with the command
+ * \param output_size largest amount of response data expected
+ * \returns milliseconds, or -1 for an invalid handler
+ */
+long tauCmdTimeout(tauHandler handler, tauCmd cmd, short input_size, short output_size);
+
+/** Fixes the response timeout of a command, replacing the learned one
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param cmd the command
+ * \param ms milliseconds to wait for the response, zero to go back to the
+ *   learned timeout
+ * \returns CAM_OK on success
+ */
+tauStatus tauSetCmdTimeout(tauHandler handler, tauCmd cmd, long ms);
+
+/** Returns a percentile of the time the camera took to process a command
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param cmd the command
+ * \param percentile 1 to 100
+ * \returns microseconds, wire time excluded, or -1 if the command was
+ *   never exchanged on the handler
+ */
+long tauCmdLatency(tauHandler handler, tauCmd cmd, int percentile);
+
+/***************************************************************************
+ * Retries
+ *
+ * tauDoCmd() and tauExchangePacket() send a command again when it fails
+ * in a way the policy of the handle says to retry.  Before each retry
+ * they wait, doubling the wait every time, and throw away whatever the
+ * camera sends meanwhile so the next response is read from a clean
+ * stream.  A command the camera may have run already, because its
+ * response was damaged or never came, is only sent again if it is
+ * TAU_CMD_IDEMPOTENT; one the camera answered it didn't run, busy or with
+ * a crc error of its own, always is.  Handles start with
+ * TAU_RETRY_DEFAULT_* except those opened with tauOpenFromDaemon(), which
+ * leave retries to taud.
+ ***************************************************************************/
+
+/* Failures a policy retries */
+#define TAU_RETRY_CHECKSUM 0x01 /* CAM_CHECKSUM_ERROR from either end */
+#define TAU_RETRY_BUSY     0x02 /* CAM_BUSY and CAM_NOT_READY */
+#define TAU_RETRY_TIMEOUT  0x04 /* CAM_TIMEOUT_ERROR */
+#define TAU_RETRY_UNSAFE   0x08 /* also resend commands that aren't idempotent */
+
+#define TAU_RETRY_DEFAULT_ATTEMPTS 3
+#define TAU_RETRY_DEFAULT_BACKOFF  10  /* ms */
+#define TAU_RETRY_DEFAULT_MAX      200 /* ms */
+#define TAU_RETRY_DEFAULT_JITTER   50  /* percent */
+#define TAU_RETRY_DEFAULT_ON       (TAU_RETRY_CHECKSUM | TAU_RETRY_BUSY | TAU_RETRY_TIMEOUT)
+
+/** How a handle retries failed commands */
+struct tauRetryPolicy {
+	int attempts;        /* sends of a command in all, 1 never retries */
+	long backoff_ms;     /* wait before the first retry */
+	long backoff_max_ms; /* longest wait, the wait doubles up to it */
+	int jitter;          /* percent of each wait taken off at random, 0 to 100 */
+	unsigned int flags;  /* TAU_RETRY_* */
+};
+
+/** Sets how a handler retries failed commands
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param policy (optional, may be NULL) the policy, NULL for the default
+ * \returns CAM_OK, or CAM_RANGE_ERROR if a value is out of range
+ */
+tauStatus tauSetRetryPolicy(tauHandler handler, const struct tauRetryPolicy *policy);
+
+/** Returns how a handler retries failed commands
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param policy holder for the policy
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR for an invalid handler
+ */
+tauStatus tauGetRetryPolicy(tauHandler handler, struct tauRetryPolicy *policy);
+
+/***************************************************************************
+ * Statistics
+ *
+ * Every handle counts the frames, bytes and system calls that went over
+ * it and the errors that came back, and times each exchange of each
+ * command in phases.  The phase times are kept in histograms with a
+ * quarter octave resolution, so percentiles are high by at most 25%.
+ * tauStatsWrite() puts all of it in the Prometheus text format, for a
+ * metrics agent to pick up.
+ ***************************************************************************/
+
+/** Phases of an exchange, timed with CLOCK_MONOTONIC */
+enum tauPhase {
+	TAU_PHASE_BUILD,      /* building the request packet, none for taud clients */
+	TAU_PHASE_WRITE,      /* writing the request */
+	TAU_PHASE_FIRST_BYTE, /* waiting for the first byte of the response */
+	TAU_PHASE_LAST_BYTE,  /* receiving the rest of the response */
+	TAU_PHASE_DECODE,     /* checking the response and handing out its data */
+	TAU_PHASE_COUNT
+};
+
+/** What went over a handle since it was opened or its statistics reset */
+struct tauStats {
+	unsigned long long frames_sent;
+	unsigned long long frames_received;
+	unsigned long long bytes_sent;
+	unsigned long long bytes_received;
+	unsigned long long syscalls;    /* reads, writes and polls of the descriptor */
+	unsigned long long crc_errors;  /* damaged responses, or requests the camera found damaged */
+	unsigned long long timeouts;
+	unsigned long long resyncs;     /* received headers that failed their crc */
+	unsigned long long noise_bytes; /* received bytes that weren't part of a packet */
+	unsigned long long retries;     /* commands sent again by the retry policy */
+};
+
+/** Time a phase of a command took over all its exchanges */
+struct tauPhaseStats {
+	unsigned long count;          /* exchanges that got through the phase */
+	unsigned long long total_us;
+	unsigned long max_us;
+};
+
+/** Returns the counters of a handler
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param stats holder for the counters
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR for an invalid handler
+ */
+tauStatus tauStatsGet(tauHandler handler, struct tauStats *stats);
+
+/** Returns the time a phase of a command took
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param cmd the command
+ * \param phase the phase
+ * \param stats holder for the times, all zero if the command was never
+ *   exchanged on the handler
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR for an invalid handler
+ */
+tauStatus tauStatsPhase(tauHandler handler, tauCmd cmd, enum tauPhase phase,
+			struct tauPhaseStats *stats);
+
+/** Returns a percentile of the time a phase of a command took
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param cmd the command
+ * \param phase the phase
+ * \param percentile 1 to 100
+ * \returns microseconds, or -1 if the command never got through the phase
+ */
+long tauStatsPercentile(tauHandler handler, tauCmd cmd, enum tauPhase phase, int percentile);
+
+/** Zeroes the counters and forgets the phase times of a handler
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ */
+void tauStatsReset(tauHandler handler);
+
+/** Writes the statistics of a handler in the Prometheus text format
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param file where to write them
+ * \param camera (optional, may be NULL) value of the camera label that
+ *   tells this handler's metrics from those of other cameras
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR if writing failed
+ */
+tauStatus tauStatsWrite(tauHandler handler, FILE *file, const char *camera);
+
+/***************************************************************************
+ * Wire trace
+ *
+ * A traced handle copies every chunk of data it writes or reads, and what
+ * its packet parser made of it, into a ring in memory along with the time.
+ * Recording takes no lock and does no I/O; the ring is written to the
+ * capture file by tauTraceFlush(), which may run in another thread than
+ * the one using the handle, but only one thread at a time.  When the ring
+ * is full new records are dropped and the loss is noted in the capture.
+ *
+ * A capture starts with a struct tauTraceFileHeader, followed by records,
+ * each a struct tauTraceRecord and its data, in the byte order of the
+ * machine that wrote it.  tautrace prints a capture as decoded frames.
+ ***************************************************************************/
+
+#define TAU_TRACE_MAGIC 0x54415554 /* "TAUT" in the writer's byte order */
+#define TAU_TRACE_VERSION 1
+#define TAU_TRACE_DEFAULT_SIZE (1024 * 1024) /* bytes of ring */
+
+/** What a trace record holds */
+enum tauTraceType {
+	TAU_TRACE_TX = 1,  /* bytes written to the camera */
+	TAU_TRACE_RX,      /* bytes read from the camera */
+	TAU_TRACE_FRAME,   /* the parser completed a packet, one byte: crc good */
+	TAU_TRACE_RESYNC,  /* the parser skipped data, two uint32_t: noise bytes, bad headers */
+	TAU_TRACE_RESULT,  /* an exchange ended, two bytes: command, status */
+	TAU_TRACE_DROPPED, /* one uint32_t: records lost because the ring was full */
+};
+
+/** First bytes of a capture file */
+struct tauTraceFileHeader {
+	uint32_t magic;      /* TAU_TRACE_MAGIC */
+	uint16_t version;    /* TAU_TRACE_VERSION */
+	uint16_t reserved;
+	uint32_t start_sec;  /* CLOCK_REALTIME when tracing started */
+	uint32_t start_nsec;
+};
+
+/** Header of each record, followed by length bytes of data */
+struct tauTraceRecord {
+	uint32_t sec;    /* CLOCK_MONOTONIC time since tracing started */
+	uint32_t nsec;
+	uint16_t length;
+	uint8_t type;    /* enum tauTraceType */
+	uint8_t reserved;
+};
+
+/** Starts tracing a handler into a new capture file, replacing any trace
+ *  already in progress
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \param path capture file to create
+ * \param size bytes of ring, rounded up to a power of two, zero for
+ *   TAU_TRACE_DEFAULT_SIZE.  It has to hold whatever is recorded between
+ *   two calls to tauTraceFlush()
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR if the file or the ring
+ *   couldn't be created
+ */
+tauStatus tauTraceStart(tauHandler handler, const char *path, unsigned long size);
+
+/** Writes what is in the ring to the capture file
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \returns CAM_OK, also when the handler isn't traced, or
+ *   CAM_COMMUNICATION_ERROR if writing failed
+ */
+tauStatus tauTraceFlush(tauHandler handler);
+
+/** Flushes and closes the capture file.  tauClose() does the same
+ * \param handler the handler for the Tau camera returned by tauOpen* functions
+ * \returns CAM_OK, or CAM_COMMUNICATION_ERROR if writing failed
+ */
+tauStatus tauTraceStop(tauHandler handler);
+
 /** Verifies Tau camera responds to NO-OP (0x00)
  * \param handler the handler for the Tau camera returned by tauOpen* functions
  * \returns zero on success.  On error, -1 is returned, and errno is set appropriately.
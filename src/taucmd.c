@@ -15,9 +15,15 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <errno.h>
 
 #include "tau.h"
 #include "tau-utils.h"
+#include "tau-private.h"
 
 /************************************************************************
  * Constants
@@ -27,12 +33,73 @@
 #define MAX_ARGUMENTS        10
 #define MAX_ARGUMENT_LENGTH  128
 #define MAX_FILENAME_LENGTH  256
-#define MAX_TAU_DATA_LEN     64
+#define MAX_TAU_DATA_LEN     256 /* largest response, READ_MEMORY */
+#define MAX_FLEET_COMMANDS   256
+#define DUMP_RETRIES         3
+#define DUMP_MAGIC           "TAUDUMP1"
+#define TRACE_FLUSH_INTERVAL 256 /* batch commands between trace flushes */
+#define MAX_WATCH_RATE       10000 /* --watch commands per second */
+#define SCRIPT_MAGIC         "TAUSCRP1"
+#define SCRIPT_ANY_LENGTH    0x01 /* the response length isn't known when compiling */
+#define SCRIPT_MAX_LENGTH    0x02 /* the expected length is the longest the response may be */
+#define BAUD_AUTO            0    /* --baud auto, open at whatever rate the camera answers at */
 
 /************************************************************************
  * Data types
  ************************************************************************/
 
+/** A command to send to the camera with its parameters */
+struct command {
+	char cmd;
+	char data[MAX_TAU_DATA_LEN];
+	short data_count;
+};
+
+/** A camera being driven in fleet mode */
+struct camera {
+	char device[MAX_FILENAME_LENGTH];
+	tauHandler handle;
+	int next;     /* index of the next command to send, -1 while verifying */
+	int failures;
+};
+
+/** Start of a dump checkpoint file, the chunk map follows */
+struct dump_checkpoint {
+	char magic[8];
+	unsigned long address;
+	unsigned long size;
+	struct tauChunk chunks[];
+};
+
+/** Start of a compiled script, the frames follow.  Host byte order */
+struct script_header {
+	char magic[8];
+	uint32_t count; /* frames */
+	uint32_t size;  /* bytes of frames */
+};
+
+/** A frame of a compiled script, padded to a multiple of four bytes */
+struct script_frame {
+	uint16_t request_size;          /* bytes of the request packet */
+	uint16_t flags;                 /* SCRIPT_* */
+	char expected[TAU_HEADER_SIZE]; /* header of the CAM_OK response */
+	char request[];                 /* request packet, crcs included */
+};
+
+#define SCRIPT_FRAME_SIZE(request_size) \
+	((sizeof(struct script_frame) + (request_size) + 3) & ~3u)
+
+/** Header of a --watch --binary record, response data follows.  Host
+ *  byte order */
+struct watch_record {
+	uint32_t sec;          /* CLOCK_REALTIME when the response arrived */
+	uint32_t usec;
+	uint32_t latency_us;   /* from sending the command */
+	uint8_t status;
+	uint8_t cmd;
+	uint16_t length;       /* bytes of response data */
+};
+
 /************************************************************************
  * Public Data
  ************************************************************************/
@@ -45,6 +112,40 @@ static char filename[MAX_FILENAME_LENGTH];
 static char tau_host[MAX_FILENAME_LENGTH];
 static unsigned int tau_port;
 static char tau_host[MAX_FILENAME_LENGTH];
+static char daemon_socket[MAX_FILENAME_LENGTH];
+static char batch_filename[MAX_FILENAME_LENGTH];
+static char fleet_filename[MAX_FILENAME_LENGTH];
+static long open_baud = TAU_DEFAULT_BAUD_RATE;
+static long max_baud;
+static int retry_attempts;
+static char cache_dir[MAX_FILENAME_LENGTH];
+static int show_stats;
+static char metrics_filename[MAX_FILENAME_LENGTH];
+static char camera_label[MAX_FILENAME_LENGTH + 8];
+static char trace_filename[MAX_FILENAME_LENGTH];
+static double watch_rate;
+static unsigned long watch_count;
+static int watch_binary;
+
+static struct command fleet_commands[MAX_FLEET_COMMANDS];
+static int fleet_command_count;
+
+static volatile sig_atomic_t interrupted;
+
+static struct option long_options[] = {
+	{ "fleet", required_argument, NULL, 'F' },
+	{ "baud", required_argument, NULL, 'R' },
+	{ "max-baud", required_argument, NULL, 'M' },
+	{ "retries", required_argument, NULL, 'Y' },
+	{ "cache", required_argument, NULL, 'C' },
+	{ "stats", no_argument, NULL, 'T' },
+	{ "metrics", required_argument, NULL, 'P' },
+	{ "trace", required_argument, NULL, 'W' },
+	{ "watch", required_argument, NULL, 'A' },
+	{ "count", required_argument, NULL, 'N' },
+	{ "binary", no_argument, NULL, 'B' },
+	{ NULL, 0, NULL, 0 }
+};
 
 /************************************************************************
  * Forward Function Declarations
@@ -69,24 +170,88 @@ static inline void check_results(char *msg, int ret)
 }
 
 
+/** Lists the commands the library knows, with the data they take
+ */
+static void list_commands(void)
+{
+	const struct tauCommandInfo *info;
+	char sizes[32];
+	int i;
+
+	fprintf(stderr, "\n<command>                    code  data bytes    response bytes\n");
+	for (i = 0; i < 256; i++) {
+		info = tauCommandInfo(i);
+		if (!info) {
+			continue;
+		}
+		if (info->request_min == info->request_max) {
+			snprintf(sizes, sizeof(sizes), "%d", info->request_min);
+		} else if (info->request_min + info->request_step == info->request_max) {
+			snprintf(sizes, sizeof(sizes), "%d or %d", info->request_min, info->request_max);
+		} else if (info->request_step == 1) {
+			snprintf(sizes, sizeof(sizes), "%d to %d", info->request_min, info->request_max);
+		} else {
+			snprintf(sizes, sizeof(sizes), "%d to %d by %d", info->request_min,
+				 info->request_max, info->request_step);
+		}
+		fprintf(stderr, "%-28s %02X    %-13s %d\n", info->name, info->cmd, sizes,
+			info->response_max);
+	}
+}
+
+
 /** Displays application help message
  * \param progname program name
  * \param e_help non-zero if extended help should be displayed
  */
 static void show_usage(const char *progname, int e_help)
 {
-        fprintf(stderr, "Usage: %s [-h|-H] [-d <debug level>] [-f <device filename> | -n <IP:port>] <command> [<command parameters>]\n", progname);
+        fprintf(stderr, "Usage: %s [-h|-H] [-d <debug level>] [-f <device filename> | -n <IP:port> | -s <socket path> | --fleet <inventory>] [--baud <rate>|auto] [--max-baud <rate>] [--retries <n>] [--cache <dir>] [--stats] [--metrics <file>] [--trace <file>] [--watch <hz> [--count <n>] [--binary]] [-b <script> | compile <script> <file> | replay <file> | dump <address> <size> <file> | flash-update <image> [<address>] | config-save|config-diff|config-apply <file> | <command> [<command parameters>]]\n", progname);
 
         fprintf(stderr, "-h                           Display this help information.\n");
         fprintf(stderr, "-H                           Display this help information along with list of all <commands>.\n");
         fprintf(stderr, "-d <debug level>             Set the debug level.  Default is 0, off.  1 is enabled. 2 is verbose.\n");
         fprintf(stderr, "-f <device filename>         Exchange data with tau device over specified filename\n");
         fprintf(stderr, "-n <IP:port>                 Exchange data with tau via a TCP connection to the specified IP address and port\n");
-        fprintf(stderr, "<command>                    two digit hex number\n");
+        fprintf(stderr, "-s <socket path>             Exchange data with tau through the taud daemon listening on the unix socket\n");
+        fprintf(stderr, "--fleet <inventory>          Send the command, or every command in the -b script, to each camera listed\n");
+        fprintf(stderr, "                             in inventory, one device filename per line, all cameras in parallel.\n");
+        fprintf(stderr, "                             Each command prints one line: <device> <status> <command> [<response data>]\n");
+        fprintf(stderr, "--baud <rate>|auto           Open the serial device at rate, the camera must already use it. Default is %d.\n", TAU_DEFAULT_BAUD_RATE);
+        fprintf(stderr, "                             auto tries every rate, the one the device was found at before first\n");
+        fprintf(stderr, "                             if --cache is given\n");
+        fprintf(stderr, "--max-baud <rate>            Move the camera to the fastest rate up to rate the link carries, and keep\n");
+        fprintf(stderr, "                             adjusting it to the error rate.  The camera is put back at the --baud rate on exit\n");
+        fprintf(stderr, "--retries <n>                Send a command that failed with a crc error, busy or timeout up to n more\n");
+        fprintf(stderr, "                             times.  Default is %d, 0 never retries\n", TAU_RETRY_DEFAULT_ATTEMPTS - 1);
+        fprintf(stderr, "--cache <dir>                Answer repeated reads of settings and constants from a cache, keeping the\n");
+        fprintf(stderr, "                             constants, such as the revision, in dir across runs\n");
+        fprintf(stderr, "--stats                      Print what went over the link and how long each phase of the exchanges took\n");
+        fprintf(stderr, "--metrics <file>             Write the same in the Prometheus text format to file, '-' for stdout\n");
+        fprintf(stderr, "--trace <file>               Capture every byte that goes over the link in file, for tautrace\n");
+        fprintf(stderr, "--watch <hz>                 Send the <command> hz times a second over the open connection until\n");
+        fprintf(stderr, "                             interrupted, printing <time> <latency us> <status> <command> [<response data>]\n");
+        fprintf(stderr, "                             for each, and the missed periods and timing jitter at the end\n");
+        fprintf(stderr, "--count <n>                  Stop --watch after n commands\n");
+        fprintf(stderr, "--binary                     Write --watch records in binary: seconds, microseconds, latency in us, all\n");
+        fprintf(stderr, "                             32 bit, status and command, 8 bit, data length, 16 bit, then the data\n");
+        fprintf(stderr, "-b <script>                  Run one <command> [<command parameters>] per line of script, '-' for stdin.\n");
+        fprintf(stderr, "                             Each command prints one line: <status> <command> [<response data>]\n");
+        fprintf(stderr, "compile <script> <file>      Turn a -b script into file of ready to send frames, no camera needed\n");
+        fprintf(stderr, "replay <file>                Send the frames of a compiled script, printing what -b prints\n");
+        fprintf(stderr, "dump <address> <size> <file> Read size bytes of camera memory from address into file.  If interrupted,\n");
+        fprintf(stderr, "                             running it again resumes from <file>.ckpt\n");
+        fprintf(stderr, "flash-update <image> [<address>]\n");
+        fprintf(stderr, "                             Write image to camera flash at address, default 0, rewriting only the erase\n");
+        fprintf(stderr, "                             blocks, 0x%X bytes, that differ from it\n", TAU_FLASH_BLOCK_SIZE);
+        fprintf(stderr, "config-save <file>           Save every camera setting to file, '-' for stdout.  The file is a -b script\n");
+        fprintf(stderr, "config-diff <file>           Print the settings of file the camera doesn't have\n");
+        fprintf(stderr, "config-apply <file>          Set only the settings of file the camera doesn't have, then save them once\n");
+        fprintf(stderr, "<command>                    two digit hex number or command name, -H lists them\n");
         fprintf(stderr, "<command parameters>         zero or more sets of two digit hex numbers\n");
 
 	if (e_help) {
-		/* TODO, add support for <command> as text strings in addition to two digit hex numbers */
+		list_commands();
 	}
 
         fprintf(stderr, "\n");
@@ -96,8 +261,29 @@ static void show_usage(const char *progname, int e_help)
         fprintf(stderr, "             %s -f /dev/ttyS0 00\n", progname);
         fprintf(stderr, "          2) Get serial number using raw format with tau connected remotely via telnetd on machine sdk.ridgerun.net port 5471\n");
         fprintf(stderr, "             %s -n sdk.ridgerun.net:5471 04\n", progname);
-        fprintf(stderr, "          3) Set gain mode to manual with tau connected via serial on /dev/ttyS0\n");
+        fprintf(stderr, "          3) Set gain mode to automatic with tau connected via serial on /dev/ttyS0\n");
         fprintf(stderr, "             %s -f /dev/ttyS0 GAIN_MODE 0000\n", progname);
+        fprintf(stderr, "          4) Get revision from the tau shared by taud\n");
+        fprintf(stderr, "             %s -s %s 05\n", progname, TAU_DAEMON_SOCKET);
+        fprintf(stderr, "          5) Run a script of commands over a single connection to the tau on /dev/ttyS0\n");
+        fprintf(stderr, "             printf '0A 0000\\n0B 0001\\n' | %s -f /dev/ttyS0 -b -\n", progname);
+        fprintf(stderr, "          6) Get revision from every tau listed in cameras.txt\n");
+        fprintf(stderr, "             %s --fleet cameras.txt 05\n", progname);
+        fprintf(stderr, "          7) Run a script over /dev/ttyS0 at up to 921600 baud\n");
+        fprintf(stderr, "             %s -f /dev/ttyS0 --max-baud 921600 -b script.txt\n", progname);
+        fprintf(stderr, "          8) Back up 1 MiB of camera flash\n");
+        fprintf(stderr, "             %s -f /dev/ttyS0 --max-baud 921600 dump 0 0x100000 flash.bin\n", progname);
+        fprintf(stderr, "          9) Restore it, only blocks that changed since are written\n");
+        fprintf(stderr, "             %s -f /dev/ttyS0 --max-baud 921600 flash-update flash.bin\n", progname);
+        fprintf(stderr, "         10) Bring the tau on /dev/ttyS0 in line with a golden configuration\n");
+        fprintf(stderr, "             %s -f /dev/ttyS0 config-apply golden.cfg\n", progname);
+        fprintf(stderr, "         11) Provision cameras with a script compiled once\n");
+        fprintf(stderr, "             %s compile provision.txt provision.tauc\n", progname);
+        fprintf(stderr, "             %s -f /dev/ttyS0 replay provision.tauc\n", progname);
+        fprintf(stderr, "         12) Read the FPA temperature 50 times a second for a minute\n");
+        fprintf(stderr, "             %s -f /dev/ttyS0 --watch 50 --count 3000 READ_SENSOR 0000\n", progname);
+        fprintf(stderr, "         13) Get revision from a tau left at an unknown baud rate\n");
+        fprintf(stderr, "             %s -f /dev/ttyUSB0 --baud auto --cache /var/cache/tau 05\n", progname);
         fprintf(stderr, "\n");
         fprintf(stderr, "\n");
 }
@@ -117,7 +303,7 @@ static int parse_options(int argc, char *argv[])
 	int level;
 
         /* Parse for other options */
-        while ((option=getopt(argc,argv,"hHd:f:n:")) != EOF) {
+        while ((option=getopt_long(argc,argv,"hHd:f:n:s:b:",long_options,NULL)) != EOF) {
                 switch (option){
                 case 'h' :
 			show_usage(argv[0], 0);
@@ -158,7 +344,7 @@ static int parse_options(int argc, char *argv[])
 			}
 
 			memcpy(tau_host, optarg, len);
-			tau_host[ptr-optarg] = '\0';
+			tau_host[len] = '\0';
 
 			ptr++;
 
@@ -170,15 +356,114 @@ static int parse_options(int argc, char *argv[])
 
 			tau_port = atoi(ptr);
 
-			if (! tau_port) {
+			if (! tau_port || (tau_port > 65535)) {
 				show_usage(argv[0], 0);
-				fprintf(stderr, "\nERROR: when using -n option port number has to be a number greater than zero\n\n");
+				fprintf(stderr, "\nERROR: when using -n option port number has to be a number between 1 and 65535\n\n");
 				exit(-1);
 			}
 
 			vdbg("Network connection to %s, port %d", tau_host, tau_port);
 			break;
 
+		case 's' :
+			strncpy(daemon_socket, optarg, MAX_FILENAME_LENGTH);
+			daemon_socket[MAX_FILENAME_LENGTH-1]='\0';
+			vdbg("Tau data exchanged through taud on %s", daemon_socket);
+			break;
+
+		case 'b' :
+			strncpy(batch_filename, optarg, MAX_FILENAME_LENGTH);
+			batch_filename[MAX_FILENAME_LENGTH-1]='\0';
+			vdbg("Commands read from %s", batch_filename);
+			break;
+
+		case 'F' :
+			strncpy(fleet_filename, optarg, MAX_FILENAME_LENGTH);
+			fleet_filename[MAX_FILENAME_LENGTH-1]='\0';
+			vdbg("Cameras listed in %s", fleet_filename);
+			break;
+
+		case 'R' :
+			if (!strcmp(optarg, "auto")) {
+				open_baud = BAUD_AUTO;
+				vdbg("Serial device opened at the rate the camera answers at");
+				break;
+			}
+			open_baud = atol(optarg);
+			if (open_baud <= 0) {
+				show_usage(argv[0], 0);
+				fprintf(stderr, "\nERROR: --baud rate has to be a number greater than zero, or auto\n\n");
+				exit(-1);
+			}
+			vdbg("Serial device opened at %ld baud", open_baud);
+			break;
+
+		case 'M' :
+			max_baud = atol(optarg);
+			if (max_baud <= 0) {
+				show_usage(argv[0], 0);
+				fprintf(stderr, "\nERROR: --max-baud rate has to be a number greater than zero\n\n");
+				exit(-1);
+			}
+			vdbg("Link rate limited to %ld baud", max_baud);
+			break;
+
+		case 'Y' :
+			retry_attempts = atoi(optarg) + 1;
+			if (retry_attempts < 1) {
+				show_usage(argv[0], 0);
+				fprintf(stderr, "\nERROR: --retries takes a number, zero or more\n\n");
+				exit(-1);
+			}
+			vdbg("Failed commands sent up to %d times", retry_attempts);
+			break;
+
+		case 'C' :
+			strncpy(cache_dir, optarg, MAX_FILENAME_LENGTH);
+			cache_dir[MAX_FILENAME_LENGTH-1]='\0';
+			vdbg("Camera constants cached in %s", cache_dir);
+			break;
+
+		case 'T' :
+			show_stats = 1;
+			break;
+
+		case 'P' :
+			strncpy(metrics_filename, optarg, MAX_FILENAME_LENGTH);
+			metrics_filename[MAX_FILENAME_LENGTH-1]='\0';
+			vdbg("Metrics written to %s", metrics_filename);
+			break;
+
+		case 'W' :
+			strncpy(trace_filename, optarg, MAX_FILENAME_LENGTH);
+			trace_filename[MAX_FILENAME_LENGTH-1]='\0';
+			vdbg("Wire trace written to %s", trace_filename);
+			break;
+
+		case 'A' :
+			watch_rate = atof(optarg);
+			if ((watch_rate <= 0) || (watch_rate > MAX_WATCH_RATE)) {
+				show_usage(argv[0], 0);
+				fprintf(stderr, "\nERROR: --watch rate has to be a number of commands per second up to %d\n\n",
+					MAX_WATCH_RATE);
+				exit(-1);
+			}
+			vdbg("Command sent %g times a second", watch_rate);
+			break;
+
+		case 'N' :
+			watch_count = strtoul(optarg, &ptr, 0);
+			if (!watch_count || *ptr) {
+				show_usage(argv[0], 0);
+				fprintf(stderr, "\nERROR: --count takes a number greater than zero\n\n");
+				exit(-1);
+			}
+			break;
+
+		case 'B' :
+			watch_binary = 1;
+			break;
+
 		default :
 			show_usage(argv[0], 0);
 			fprintf(stderr, "\nERROR: unknown option '%c'\n\n", option);
@@ -190,16 +475,1097 @@ static int parse_options(int argc, char *argv[])
 }
 
 
+/** Prints the counters of a handler and the phase times of each command
+ *  it exchanged
+ * \param handle the handler for the Tau camera
+ * \param label name of the camera
+ */
+static void print_stats(tauHandler handle, const char *label)
+{
+	const struct tauCommandInfo *info;
+	struct tauPhaseStats phase_stats;
+	struct tauStats stats;
+	static const char *phases[TAU_PHASE_COUNT] = {
+		"build", "write", "first byte", "last byte", "decode"
+	};
+	char name[8];
+	int cmd, phase;
+
+	if (tauStatsGet(handle, &stats) != CAM_OK) {
+		return;
+	}
+
+	fprintf(stderr, "%s: %llu frames sent, %llu received, %llu bytes sent, %llu received, %llu syscalls\n",
+		label, stats.frames_sent, stats.frames_received, stats.bytes_sent,
+		stats.bytes_received, stats.syscalls);
+	fprintf(stderr, "%s: %llu crc errors, %llu timeouts, %llu resyncs, %llu noise bytes, %llu retries\n",
+		label, stats.crc_errors, stats.timeouts, stats.resyncs, stats.noise_bytes, stats.retries);
+
+	fprintf(stderr, "%-28s %-10s %8s %8s %8s %8s %8s (us)\n",
+		"command", "phase", "count", "mean", "p50", "p99", "max");
+	for (cmd = 0; cmd < 256; cmd++) {
+		info = tauCommandInfo(cmd);
+		if (!info) {
+			snprintf(name, sizeof(name), "%02X", cmd);
+		}
+		for (phase = 0; phase < TAU_PHASE_COUNT; phase++) {
+			tauStatsPhase(handle, cmd, phase, &phase_stats);
+			if (!phase_stats.count) {
+				continue;
+			}
+			fprintf(stderr, "%-28s %-10s %8lu %8llu %8ld %8ld %8lu\n",
+				info ? info->name : name, phases[phase], phase_stats.count,
+				phase_stats.total_us / phase_stats.count,
+				tauStatsPercentile(handle, cmd, phase, 50),
+				tauStatsPercentile(handle, cmd, phase, 99), phase_stats.max_us);
+		}
+	}
+}
+
+
+/** Writes the statistics of a handler for a metrics agent, replacing the
+ *  file at once so the agent never reads half of it
+ * \param handle the handler for the Tau camera
+ * \param label name of the camera
+ * \param path file to write, '-' for stdout
+ * \returns zero on success
+ */
+static int write_metrics(tauHandler handle, const char *label, const char *path)
+{
+	char temp[MAX_FILENAME_LENGTH + 8];
+	FILE *out;
+	int ret;
+
+	if (!strcmp(path, "-")) {
+		return tauStatsWrite(handle, stdout, label);
+	}
+
+	snprintf(temp, sizeof(temp), "%s.new", path);
+	out = fopen(temp, "w");
+	if (!out) {
+		perror("ERROR: could not create metrics file");
+		return -1;
+	}
+
+	ret = tauStatsWrite(handle, out, label);
+	if (fclose(out) || ret || rename(temp, path)) {
+		perror("ERROR: could not write metrics file");
+		unlink(temp);
+		return -1;
+	}
+	return 0;
+}
+
+
+/** Opens a serial device at the --baud rate, or finds the camera's rate
+ * \param device path of the serial device
+ * \returns the handler, negative on error
+ */
+static tauHandler open_serial(char *device)
+{
+	if (open_baud == BAUD_AUTO) {
+		return tauOpenFromSerialDetect(device, cache_dir[0] ? cache_dir : NULL);
+	}
+	return tauOpenFromSerialAtRate(device, open_baud);
+}
+
+
+/** Saves what is worth keeping about the camera and closes the handler
+ * \param handle the handler for the Tau camera
+ * \param label name of the camera, for the statistics
+ * \returns the result of tauClose()
+ */
+static int close_camera(tauHandler handle, const char *label)
+{
+	if (cache_dir[0] && (tauCacheSave(handle, cache_dir) != CAM_OK)) {
+		fprintf(stderr, "WARNING: could not save the cache in %s\n", cache_dir);
+	}
+	if (show_stats) {
+		print_stats(handle, label);
+	}
+	if (metrics_filename[0]) {
+		write_metrics(handle, label, metrics_filename);
+	}
+	if (tauTraceStop(handle) != CAM_OK) {
+		fprintf(stderr, "WARNING: the wire trace in %s is incomplete\n", trace_filename);
+	}
+	return tauClose(handle);
+}
+
+
+/** Parses a <command>, a two digit hex number or a command name
+ * \param text the command, NULL terminated
+ * \returns the command code, -1 if text is neither
+ */
+static int parse_command(const char *text)
+{
+	char hex[1];
+
+	if (isxdigit(text[0]) && isxdigit(text[1]) && !text[2] &&
+	    (asciiHexToBinary(hex, 1, (char *)text) == 1)) {
+		return (unsigned char)hex[0];
+	}
+	return tauCommandLookup(text);
+}
+
+
+/** Parses a batch line of the form <command> [<command parameters>]
+ * \param line NULL terminated line of text
+ * \param cmd holder for the command
+ * \param data holder for the command parameters
+ * \param data_count holder for the number of bytes stored in data
+ * \returns zero on success, 1 for a blank or comment line, -1 on error
+ */
+static int parse_batch_line(char *line, char *cmd, char *data, short *data_count)
+{
+	char *ptr = line;
+	char *end;
+	int digits = 0;
+	int code;
+	int i;
+
+	/* Anything after a # is a comment */
+	line[strcspn(line, "#")] = '\0';
+
+	while (isspace(*ptr)) {
+		ptr++;
+	}
+
+	if (!*ptr || (*ptr == '#')) {
+		return 1;
+	}
+
+	/* The command is two hex digits or a name, followed by blanks or the end */
+	end = ptr;
+	while (*end && !isspace(*end)) {
+		end++;
+	}
+	if (*end) {
+		*end++ = '\0';
+	}
+
+	code = parse_command(ptr);
+	if (code < 0) {
+		return -1;
+	}
+	*cmd = code;
+	ptr = end;
+
+	/* Only pairs of hex digits and blanks may follow, and they have to fit */
+	for (i = 0; ptr[i]; i++) {
+		if (isxdigit(ptr[i])) {
+			digits++;
+		} else if (!isspace(ptr[i])) {
+			return -1;
+		}
+	}
+
+	if ((digits % 2) || (digits / 2 > MAX_TAU_DATA_LEN)) {
+		return -1;
+	}
+
+	*data_count = asciiHexToBinary(data, MAX_TAU_DATA_LEN, ptr);
+	return 0;
+}
+
+/** Prints the machine readable outcome of a command on one line:
+ *  "[<prefix> ]<status> <command> [<response data>]"
+ * \param prefix (optional, may be NULL) text printed first
+ * \param status the status of the command
+ * \param cmd the command
+ * \param result response data
+ * \param result_count number of bytes of response data
+ */
+static void print_result(const char *prefix, tauStatus status, char cmd,
+			 char *result, short result_count)
+{
+	int i;
+
+	if (prefix) {
+		printf("%s ", prefix);
+	}
+	printf("%d %02X", status, (unsigned char)cmd);
+	if (result_count) {
+		printf(" ");
+		for (i = 0; i < result_count; i++) {
+			printf("%02X", (unsigned char)result[i]);
+		}
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/** Runs commands read one per line until the end of the input, printing a
+ *  line for each command as soon as the camera responds:
+ *  "<status> <command> [<response data>]" where status is the tauStatus in
+ *  decimal (-1 if the line could not be parsed) and the rest is hex
+ * \param handle the handler for the Tau camera
+ * \param in stream to read commands from
+ * \returns zero if all commands succeeded, non-zero otherwise
+ */
+static int run_batch(tauHandler handle, FILE *in)
+{
+	char line[MAX_COMMAND_LENGTH];
+	char cmd;
+	char data[MAX_TAU_DATA_LEN];
+	short data_count;
+	char result[MAX_TAU_DATA_LEN];
+	short result_count;
+	tauStatus status;
+	int failures = 0;
+	int commands = 0;
+	int ret;
+
+	while (fgets(line, sizeof(line), in)) {
+		ret = parse_batch_line(line, &cmd, data, &data_count);
+
+		if (ret > 0) {
+			continue;
+		}
+
+		if (ret < 0) {
+			line[strcspn(line, "\r\n")] = '\0';
+			fprintf(stderr, "ERROR: unable to parse '%s'\n", line);
+			printf("-1 --\n");
+			fflush(stdout);
+			failures++;
+			continue;
+		}
+
+		result_count = MAX_TAU_DATA_LEN;
+		status = tauDoCmd(handle, cmd, data, data_count, result, &result_count);
+
+		if (status != CAM_OK) {
+			result_count = 0;
+			failures++;
+		}
+
+		print_result(NULL, status, cmd, result, result_count);
+
+		if (++commands % TRACE_FLUSH_INTERVAL == 0) {
+			tauTraceFlush(handle);
+		}
+	}
+
+	return failures != 0;
+}
+
+/** Compiles a script of <command> [<command parameters>] lines into a
+ *  file of request packets, each with the header of the response that
+ *  means success, so replaying it needs no parsing or crc computation
+ * \param script_name script to compile, '-' for stdin
+ * \param filename compiled script to write
+ * \returns zero on success, non-zero otherwise
+ */
+static int run_compile(const char *script_name, const char *filename)
+{
+	char line[MAX_COMMAND_LENGTH];
+	char data[MAX_TAU_DATA_LEN];
+	char response[TAU_HEADER_SIZE + MAX_TAU_DATA_LEN + TAU_CRC_SIZE];
+	char zeros[MAX_TAU_DATA_LEN];
+	const struct tauCommandInfo *info;
+	struct script_header header;
+	struct script_frame *frame;
+	char *frames = NULL, *grown;
+	size_t size = 0, capacity = 0;
+	short data_count, request_size, response_size, expected;
+	uint16_t count;
+	FILE *in = stdin, *out;
+	int line_number = 0, ret = 0;
+	char cmd;
+
+	if (strcmp(script_name, "-")) {
+		in = fopen(script_name, "r");
+		if (!in) {
+			perror("ERROR: could not open script");
+			return -1;
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	memset(zeros, 0, sizeof(zeros));
+
+	while (fgets(line, sizeof(line), in)) {
+		line_number++;
+		ret = parse_batch_line(line, &cmd, data, &data_count);
+		if (ret > 0) {
+			ret = 0;
+			continue;
+		}
+		if ((ret < 0) || (tauCommandCheck(cmd, data_count) != CAM_OK)) {
+			line[strcspn(line, "\r\n")] = '\0';
+			fprintf(stderr, "ERROR: %s:%d: unable to compile '%s'\n", script_name, line_number, line);
+			ret = -1;
+			break;
+		}
+
+		if (size + SCRIPT_FRAME_SIZE(sizeof(response)) > capacity) {
+			capacity = capacity ? 2 * capacity : 4096;
+			grown = realloc(frames, capacity);
+			if (!grown) {
+				fprintf(stderr, "ERROR: out of memory compiling %s\n", script_name);
+				ret = -1;
+				break;
+			}
+			frames = grown;
+		}
+		frame = (struct script_frame *)&frames[size];
+		memset(frame, 0, SCRIPT_FRAME_SIZE(sizeof(response)));
+
+		request_size = sizeof(response);
+		tauBuildRequest(cmd, frame->request, &request_size, data, data_count);
+		frame->request_size = request_size;
+
+		/* Reads of memory return the count asked for and commands without
+		 * response data return none; anything else may answer with less
+		 * than the descriptor's largest response */
+		info = tauCommandInfo(cmd);
+		if ((unsigned char)cmd == READ_MEMORY) {
+			memcpy(&count, &data[4], sizeof(count));
+			expected = ntohs(count);
+		} else if (info) {
+			expected = info->response_max;
+			if (expected) {
+				frame->flags |= SCRIPT_MAX_LENGTH;
+			}
+		} else {
+			expected = 0;
+			frame->flags |= SCRIPT_ANY_LENGTH;
+		}
+		response_size = sizeof(response);
+		tauBuildPacket(cmd, CAM_OK, response, &response_size, zeros, expected);
+		memcpy(frame->expected, response, TAU_HEADER_SIZE);
+
+		size += SCRIPT_FRAME_SIZE(request_size);
+		header.count++;
+	}
+
+	if (in != stdin) {
+		fclose(in);
+	}
+	if (ret) {
+		free(frames);
+		return ret;
+	}
+
+	memcpy(header.magic, SCRIPT_MAGIC, sizeof(header.magic));
+	header.size = size;
+
+	out = fopen(filename, "w");
+	if (!out) {
+		perror("ERROR: could not create compiled script");
+		free(frames);
+		return -1;
+	}
+	if ((fwrite(&header, sizeof(header), 1, out) != 1) ||
+	    (size && (fwrite(frames, size, 1, out) != 1)) || fclose(out)) {
+		perror("ERROR: could not write compiled script");
+		free(frames);
+		return -1;
+	}
+
+	dbg("%u frames compiled into %s", header.count, filename);
+	free(frames);
+	return 0;
+}
+
+/** Sends the frames of a compiled script straight from the mapped file and
+ *  checks each response header against the one compiled in, printing a
+ *  line for each frame like run_batch()
+ * \param handle the handler for the Tau camera
+ * \param filename compiled script
+ * \returns zero if all commands succeeded, non-zero otherwise
+ */
+static int run_replay(tauHandler handle, const char *filename)
+{
+	char response[TAU_HEADER_SIZE + MAX_TAU_DATA_LEN + TAU_CRC_SIZE];
+	const struct script_header *header;
+	const struct script_frame *frame;
+	const char *map, *end;
+	short response_size, compared;
+	uint16_t length, longest;
+	tauStatus status;
+	struct stat st;
+	uint32_t i;
+	int failures = 0;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		perror("ERROR: could not open compiled script");
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("ERROR: could not open compiled script");
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < (off_t)sizeof(*header)) {
+		fprintf(stderr, "ERROR: %s is not a compiled script\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("ERROR: could not map compiled script");
+		return -1;
+	}
+
+	header = (const struct script_header *)map;
+	end = map + st.st_size;
+	if (memcmp(header->magic, SCRIPT_MAGIC, sizeof(header->magic)) ||
+	    (header->size != st.st_size - sizeof(*header))) {
+		fprintf(stderr, "ERROR: %s is not a compiled script, or was compiled on another machine\n",
+			filename);
+		munmap((void *)map, st.st_size);
+		return -1;
+	}
+
+	frame = (const struct script_frame *)(header + 1);
+	for (i = 0; i < header->count; i++) {
+		if (((const char *)frame->request > end) ||
+		    (frame->request_size < TAU_HEADER_SIZE + TAU_CRC_SIZE) ||
+		    (frame->request_size > end - frame->request)) {
+			fprintf(stderr, "ERROR: %s is truncated at frame %u\n", filename, i);
+			failures++;
+			break;
+		}
+
+		response_size = sizeof(response);
+		status = tauExchangePacket(handle, (char *)frame->request, frame->request_size,
+					   response, &response_size);
+
+		/* A response that says anything but what was compiled in failed */
+		compared = frame->flags & (SCRIPT_ANY_LENGTH | SCRIPT_MAX_LENGTH) ? 4 : TAU_HEADER_SIZE;
+		if ((status == CAM_OK) && memcmp(response, frame->expected, compared)) {
+			status = response[1] ? (unsigned char)response[1] : CAM_BYTE_COUNT_ERROR;
+		}
+		if ((status == CAM_OK) && (frame->flags & SCRIPT_MAX_LENGTH)) {
+			memcpy(&length, &response[4], sizeof(length));
+			memcpy(&longest, &frame->expected[4], sizeof(longest));
+			if (ntohs(length) > ntohs(longest)) {
+				status = CAM_BYTE_COUNT_ERROR;
+			}
+		}
+
+		if (status != CAM_OK) {
+			response_size = TAU_HEADER_SIZE + TAU_CRC_SIZE;
+			failures++;
+		}
+		print_result(NULL, status, frame->request[3], &response[TAU_HEADER_SIZE],
+			     response_size - TAU_HEADER_SIZE - TAU_CRC_SIZE);
+
+		if ((i + 1) % TRACE_FLUSH_INTERVAL == 0) {
+			tauTraceFlush(handle);
+		}
+		frame = (const struct script_frame *)((const char *)frame +
+						      SCRIPT_FRAME_SIZE(frame->request_size));
+	}
+
+	munmap((void *)map, st.st_size);
+	return failures != 0;
+}
+
+/** Reads the commands of a script for fleet mode
+ * \param in stream to read commands from
+ * \returns zero on success, -1 if a line can't be parsed or there are too many
+ */
+static int load_fleet_commands(FILE *in)
+{
+	char line[MAX_COMMAND_LENGTH];
+	struct command *command;
+	int ret;
+
+	while (fgets(line, sizeof(line), in)) {
+		if (fleet_command_count == MAX_FLEET_COMMANDS) {
+			fprintf(stderr, "ERROR: more than %d commands in script\n", MAX_FLEET_COMMANDS);
+			return -1;
+		}
+
+		command = &fleet_commands[fleet_command_count];
+		ret = parse_batch_line(line, &command->cmd, command->data, &command->data_count);
+
+		if (ret > 0) {
+			continue;
+		}
+
+		if (ret < 0) {
+			line[strcspn(line, "\r\n")] = '\0';
+			fprintf(stderr, "ERROR: unable to parse '%s'\n", line);
+			return -1;
+		}
+
+		fleet_command_count++;
+	}
+
+	return 0;
+}
+
+/** Sends a camera the next command of the fleet script, reporting and
+ *  going past the commands that can't be submitted
+ * \param camera the camera
+ * \param done completion callback
+ */
+static void fleet_submit_next(struct camera *camera, tauCompletion done)
+{
+	struct command *command;
+	tauStatus status;
+
+	while (camera->next < fleet_command_count) {
+		command = &fleet_commands[camera->next++];
+		status = tauSubmitCmd(camera->handle, command->cmd, command->data, command->data_count,
+				      MAX_TAU_DATA_LEN, done, camera);
+		if (status == CAM_OK) {
+			return;
+		}
+		print_result(camera->device, status, command->cmd, NULL, 0);
+		camera->failures++;
+	}
+}
+
+/** Completion callback of fleet mode, prints the result and moves the
+ *  camera on to its next command
+ */
+static void fleet_done(tauHandler handle, tauStatus status, tauCmd cmd,
+		       char *output, short output_count, void *user_data)
+{
+	struct camera *camera = user_data;
+
+	if (camera->next < 0) {
+		/* Verification NO_OP, a camera that doesn't answer is skipped */
+		if (status != CAM_OK) {
+			print_result(camera->device, status, cmd, NULL, 0);
+			camera->failures++;
+			return;
+		}
+		camera->next = 0;
+	} else {
+		print_result(camera->device, status, cmd, output, output_count);
+		if (status != CAM_OK) {
+			camera->failures++;
+		}
+	}
+
+	fleet_submit_next(camera, fleet_done);
+}
+
+/** Sends the fleet commands to every camera listed in the inventory file,
+ *  with all cameras working at the same time
+ * \param inventory file with one device filename per line
+ * \returns zero if every command on every camera succeeded
+ */
+static int run_fleet(const char *inventory)
+{
+	char line[MAX_COMMAND_LENGTH];
+	struct camera *cameras = NULL;
+	int count = 0;
+	tauFleet *fleet;
+	FILE *in;
+	char *ptr;
+	int failed = 0;
+	int i;
+
+	in = fopen(inventory, "r");
+	if (!in) {
+		perror("ERROR: could not open inventory");
+		return -1;
+	}
+
+	fleet = tauFleetCreate();
+	if (!fleet) {
+		fclose(in);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		ptr = line + strspn(line, " \t");
+		ptr[strcspn(ptr, " \t\r\n")] = '\0';
+
+		if (!*ptr || (*ptr == '#')) {
+			continue;
+		}
+
+		cameras = realloc(cameras, (count + 1) * sizeof(*cameras));
+		if (!cameras) {
+			fprintf(stderr, "ERROR: out of memory\n");
+			exit(-1);
+		}
+
+		strncpy(cameras[count].device, ptr, MAX_FILENAME_LENGTH);
+		cameras[count].device[MAX_FILENAME_LENGTH-1] = '\0';
+		cameras[count].next = -1;
+		cameras[count].failures = 0;
+
+		dbg("Opening tau communication file: %s", ptr);
+		cameras[count].handle = open_serial(cameras[count].device);
+		if (cameras[count].handle < 0) {
+			print_result(cameras[count].device, CAM_COMMUNICATION_ERROR, NO_OP, NULL, 0);
+			failed = 1;
+			continue;
+		}
+
+		if (tauFleetAdd(fleet, cameras[count].handle) < 0) {
+			tauClose(cameras[count].handle);
+			failed = 1;
+			continue;
+		}
+		count++;
+	}
+	fclose(in);
+
+	/* Pointers into cameras are only handed out once it stops moving */
+	for (i = 0; i < count; i++) {
+		if (tauSubmitCmd(cameras[i].handle, NO_OP, NULL, 0, 0, fleet_done, &cameras[i]) != CAM_OK) {
+			print_result(cameras[i].device, CAM_NOT_READY, NO_OP, NULL, 0);
+			cameras[i].failures++;
+		}
+	}
+
+	if (tauFleetRun(fleet) != CAM_OK) {
+		failed = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (cameras[i].failures) {
+			failed = 1;
+		}
+		dbg("%s: %d command(s) failed", cameras[i].device, cameras[i].failures);
+		close_camera(cameras[i].handle, cameras[i].device);
+	}
+
+	tauFleetDestroy(fleet);
+	free(cameras);
+
+	return failed;
+}
+
+/** Stops a dump or flash update at the next progress report
+ * \param sig signal number
+ */
+static void stop_interrupt(int sig)
+{
+	interrupted = 1;
+}
+
+/** Shows the progress of a dump or flash update on stderr, and keeps the
+ *  wire trace from filling up
+ * \param user_data the handler for the Tau camera
+ * \returns nonzero once the dump was interrupted
+ */
+static int show_progress(unsigned long done, unsigned long total,
+			 unsigned long bytes_per_second, void *user_data)
+{
+	tauTraceFlush(*(tauHandler *)user_data);
+
+	fprintf(stderr, "\r%lu/%lu bytes, %lu bytes/s ", done, total, bytes_per_second);
+	if (done == total) {
+		fprintf(stderr, "\n");
+	}
+	return interrupted;
+}
+
+/** Writes the record of a --watch response to stdout
+ * \param when CLOCK_REALTIME when the response arrived
+ * \param latency_us time since the command was sent
+ * \param status the status of the command
+ * \param cmd the command
+ * \param result response data
+ * \param result_count number of bytes of response data
+ */
+static void print_watch_record(const struct timespec *when, long latency_us, tauStatus status,
+			       char cmd, char *result, short result_count)
+{
+	struct watch_record record;
+	char prefix[48];
+
+	if (!watch_binary) {
+		snprintf(prefix, sizeof(prefix), "%ld.%06ld %ld", (long)when->tv_sec,
+			 when->tv_nsec / 1000, latency_us);
+		print_result(prefix, status, cmd, result, result_count);
+		return;
+	}
+
+	record.sec = when->tv_sec;
+	record.usec = when->tv_nsec / 1000;
+	record.latency_us = latency_us;
+	record.status = status;
+	record.cmd = cmd;
+	record.length = result_count;
+	fwrite(&record, sizeof(record), 1, stdout);
+	fwrite(result, 1, result_count, stdout);
+	fflush(stdout);
+}
+
+/** Returns the microseconds from one time to another
+ * \param from the earlier time
+ * \param to the later time
+ */
+static long elapsed_us(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+/** Sends a command watch_rate times a second until watch_count commands
+ *  were sent or the program is interrupted.  A timerfd keeps the periods
+ *  on a fixed grid, so a late command doesn't shift the ones after it; a
+ *  period that passed while the camera was still answering is skipped
+ *  and counted as missed
+ * \param handle the handler for the Tau camera
+ * \param cmd the command
+ * \param data command parameters
+ * \param data_count number of bytes of command parameters
+ * \returns zero if all commands succeeded, non-zero otherwise
+ */
+static int run_watch(tauHandler handle, char cmd, char *data, short data_count)
+{
+	struct itimerspec timer;
+	struct timespec start, sent, received, when;
+	struct sigaction action;
+	char result[MAX_TAU_DATA_LEN];
+	short result_count;
+	tauStatus status;
+	unsigned long long period_ns, ticks = 0, expirations;
+	unsigned long sent_count = 0, missed = 0, failures = 0;
+	long jitter, jitter_min = 0, jitter_max = 0, latency;
+	long long jitter_total = 0;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd < 0) {
+		perror("ERROR: could not create the watch timer");
+		return -1;
+	}
+
+	/* The first command goes out right away, the rest on the grid */
+	period_ns = 1e9 / watch_rate;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	timer.it_value = start;
+	timer.it_interval.tv_sec = period_ns / 1000000000;
+	timer.it_interval.tv_nsec = period_ns % 1000000000;
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &timer, NULL) < 0) {
+		perror("ERROR: could not start the watch timer");
+		close(fd);
+		return -1;
+	}
+
+	/* Without SA_RESTART, so the wait for the next period ends too */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_interrupt;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	while (!interrupted && (!watch_count || (sent_count < watch_count))) {
+		if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("ERROR: could not wait for the watch timer");
+			failures++;
+			break;
+		}
+		ticks += expirations;
+		missed += expirations - 1;
+
+		/* How late this command goes out after its period started */
+		clock_gettime(CLOCK_MONOTONIC, &sent);
+		jitter = (sent.tv_sec - start.tv_sec) * 1000000LL +
+			(sent.tv_nsec - start.tv_nsec) / 1000 - (long long)((ticks - 1) * period_ns / 1000);
+		if (!sent_count || (jitter < jitter_min)) {
+			jitter_min = jitter;
+		}
+		if (!sent_count || (jitter > jitter_max)) {
+			jitter_max = jitter;
+		}
+		jitter_total += jitter;
+
+		result_count = MAX_TAU_DATA_LEN;
+		status = tauDoCmd(handle, cmd, data, data_count, result, &result_count);
+		clock_gettime(CLOCK_MONOTONIC, &received);
+		clock_gettime(CLOCK_REALTIME, &when);
+		latency = elapsed_us(&sent, &received);
+
+		if (status != CAM_OK) {
+			result_count = 0;
+			failures++;
+		}
+		print_watch_record(&when, latency, status, cmd, result, result_count);
+
+		if (++sent_count % TRACE_FLUSH_INTERVAL == 0) {
+			tauTraceFlush(handle);
+		}
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	close(fd);
+
+	fprintf(stderr, "%lu commands, %lu failed, %lu periods missed; start jitter min %ld us, "
+		"mean %lld us, max %ld us\n", sent_count, failures, missed, jitter_min,
+		sent_count ? jitter_total / (long long)sent_count : 0, jitter_max);
+
+	return failures != 0;
+}
+
+/** Maps a file of the given size, creating or growing it as needed
+ * \param filename file to map
+ * \param size number of bytes to map
+ * \param created set to nonzero if the file didn't exist
+ * \returns the mapping, or NULL on error
+ */
+static void *dump_map(const char *filename, size_t size, int *created)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	*created = stat(filename, &st) < 0;
+
+	fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(filename);
+		return NULL;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		perror(filename);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		perror(filename);
+		return NULL;
+	}
+	return map;
+}
+
+/** Dumps camera memory to a file.  Progress is kept in <file>.ckpt, so an
+ *  interrupted dump picks up where it stopped when run again
+ * \param handle the handler for the Tau camera
+ * \param address_arg camera address, decimal or 0x hex
+ * \param size_arg number of bytes, decimal or 0x hex
+ * \param filename output file
+ * \returns zero on success, non-zero otherwise
+ */
+static int run_dump(tauHandler handle, const char *address_arg, const char *size_arg,
+		    const char *filename)
+{
+	char checkpoint_name[MAX_FILENAME_LENGTH + 8];
+	struct dump_checkpoint *checkpoint;
+	size_t checkpoint_size;
+	unsigned long address, size;
+	char *end;
+	char *data;
+	int created;
+	tauStatus status;
+
+	address = strtoul(address_arg, &end, 0);
+	if (*end) {
+		fprintf(stderr, "ERROR: invalid dump address: '%s'\n", address_arg);
+		return -1;
+	}
+	size = strtoul(size_arg, &end, 0);
+	if (*end || !size) {
+		fprintf(stderr, "ERROR: invalid dump size: '%s'\n", size_arg);
+		return -1;
+	}
+
+	snprintf(checkpoint_name, sizeof(checkpoint_name), "%s.ckpt", filename);
+	checkpoint_size = sizeof(*checkpoint) + TAU_CHUNK_COUNT(size) * sizeof(struct tauChunk);
+
+	checkpoint = dump_map(checkpoint_name, checkpoint_size, &created);
+	if (!checkpoint) {
+		return -1;
+	}
+
+	/* A checkpoint left by a dump of another range is of no use */
+	if (memcmp(checkpoint->magic, DUMP_MAGIC, sizeof(checkpoint->magic)) ||
+	    (checkpoint->address != address) || (checkpoint->size != size)) {
+		memset(checkpoint, 0, checkpoint_size);
+		memcpy(checkpoint->magic, DUMP_MAGIC, sizeof(checkpoint->magic));
+		checkpoint->address = address;
+		checkpoint->size = size;
+	} else if (!created) {
+		fprintf(stderr, "Resuming dump from %s\n", checkpoint_name);
+	}
+
+	data = dump_map(filename, size, &created);
+	if (!data) {
+		munmap(checkpoint, checkpoint_size);
+		return -1;
+	}
+
+	signal(SIGINT, stop_interrupt);
+	signal(SIGTERM, stop_interrupt);
+
+	status = tauReadMemory(handle, address, size, data, checkpoint->chunks, DUMP_RETRIES,
+			       show_progress, &handle);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	msync(data, size, MS_SYNC);
+	munmap(data, size);
+	msync(checkpoint, checkpoint_size, MS_SYNC);
+	munmap(checkpoint, checkpoint_size);
+
+	if (status != CAM_OK) {
+		fprintf(stderr, "\nERROR: dump incomplete (%d), run again to resume\n", status);
+		return -1;
+	}
+
+	unlink(checkpoint_name);
+	return 0;
+}
+
+/** Updates camera flash from an image file, rewriting only the blocks
+ *  that differ
+ * \param handle the handler for the Tau camera
+ * \param filename image file
+ * \param address_arg camera address, decimal or 0x hex, NULL for 0
+ * \returns zero on success, non-zero otherwise
+ */
+static int run_flash_update(tauHandler handle, const char *filename, const char *address_arg)
+{
+	struct tauFlashStats stats;
+	unsigned long address = 0;
+	struct stat st;
+	char *image;
+	char *end;
+	int fd;
+	tauStatus status;
+
+	if (address_arg) {
+		address = strtoul(address_arg, &end, 0);
+		if (*end) {
+			fprintf(stderr, "ERROR: invalid flash address: '%s'\n", address_arg);
+			return -1;
+		}
+	}
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		perror(filename);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(filename);
+		close(fd);
+		return -1;
+	}
+	if (!st.st_size) {
+		fprintf(stderr, "ERROR: %s is empty\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		perror(filename);
+		return -1;
+	}
+
+	signal(SIGINT, stop_interrupt);
+	signal(SIGTERM, stop_interrupt);
+
+	status = tauFlashUpdate(handle, address, image, st.st_size, TAU_FLASH_BLOCK_SIZE, &stats,
+				show_progress, &handle);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	munmap(image, st.st_size);
+
+	fprintf(stderr, "%lu of %lu blocks rewritten, %lu bytes skipped, %lu bytes written\n",
+		stats.blocks_written, stats.blocks, stats.bytes_skipped, stats.bytes_written);
+
+	if (status != CAM_OK) {
+		fprintf(stderr, "ERROR: flash update failed (%d)\n", status);
+		return -1;
+	}
+	return 0;
+}
+
+/** Saves, compares or applies the camera configuration
+ * \param handle the handler for the Tau camera
+ * \param action "config-save", "config-diff" or "config-apply"
+ * \param filename configuration file, '-' for stdin or stdout
+ * \returns zero on success, non-zero otherwise
+ */
+static int run_config(tauHandler handle, const char *action, const char *filename)
+{
+	struct tauConfig current, desired, changes;
+	FILE *file;
+	tauStatus status;
+	int ret;
+
+	if (!strcmp(action, "config-save")) {
+		status = tauConfigSnapshot(handle, &current);
+		if (status != CAM_OK) {
+			fprintf(stderr, "ERROR: could not read the configuration (%d)\n", status);
+			return -1;
+		}
+
+		file = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+		if (!file) {
+			perror("ERROR: could not create configuration file");
+			return -1;
+		}
+		ret = tauConfigWrite(file, &current);
+		if (file != stdout) {
+			ret |= fclose(file);
+		}
+		return ret;
+	}
+
+	file = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+	if (!file) {
+		perror("ERROR: could not open configuration file");
+		return -1;
+	}
+	ret = tauConfigRead(file, &desired);
+	if (file != stdin) {
+		fclose(file);
+	}
+	if (ret) {
+		return -1;
+	}
+
+	if (!strcmp(action, "config-diff")) {
+		status = tauConfigSnapshot(handle, &current);
+		if (status == CAM_OK) {
+			tauConfigDiff(&current, &desired, &changes);
+		}
+	} else {
+		status = tauConfigApply(handle, &desired, 1, &changes);
+	}
+
+	if (status != CAM_OK) {
+		fprintf(stderr, "ERROR: %s failed (%d)\n", action, status);
+		return -1;
+	}
+
+	/* Both print the settings that differ(ed), with their desired values */
+	tauConfigWrite(stdout, &changes);
+	return 0;
+}
+
 /***************************************************************************
  * Public Functions
  ***************************************************************************/
 
 int main(int argc, char **argv, char **envp)
 {
-	int fd;
 	tauHandler handle;
 	int ret = 0;
 	int idx;
+	int cmd_code;
 	char cmd;
 	char raw_buffer[MAX_TAU_DATA_LEN];
 	short raw_buffer_count;
@@ -208,39 +1574,226 @@ int main(int argc, char **argv, char **envp)
 
         idx = parse_options(argc, argv);
 
-	if ( !filename[0] && !tau_host[0]) {
-		fprintf(stderr, "ERROR: must specify means to communication with Tau - either a file name or network address:port\n");
+	if (fleet_filename[0]) {
+		if (filename[0] || tau_host[0] || daemon_socket[0] || max_baud || retry_attempts ||
+		    cache_dir[0] || metrics_filename[0] || trace_filename[0] || watch_rate) {
+			fprintf(stderr, "ERROR: --fleet can't be combined with -f, -n, -s, --max-baud, --retries, --cache, --metrics, --trace or --watch\n");
+			exit(-1);
+		}
+
+		if (batch_filename[0]) {
+			FILE *in = stdin;
+
+			if (strcmp(batch_filename, "-")) {
+				in = fopen(batch_filename, "r");
+				if (!in) {
+					perror("ERROR: could not open script");
+					exit(-1);
+				}
+			}
+			ret = load_fleet_commands(in);
+			if (in != stdin) {
+				fclose(in);
+			}
+			if (ret) {
+				exit(-1);
+			}
+		} else if (idx < argc) {
+			struct command *command = &fleet_commands[fleet_command_count++];
+
+			cmd_code = parse_command(argv[idx++]);
+			if (cmd_code < 0) {
+				fprintf(stderr, "\nERROR: <command> must be two ASCII digits or a command name\n\n");
+				exit(-1);
+			}
+			command->cmd = cmd_code;
+			if (idx < argc) {
+				command->data_count = asciiHexToBinary(command->data, MAX_TAU_DATA_LEN, argv[idx++]);
+			}
+		}
+
+		if (idx != argc) {
+			fprintf(stderr, "ERROR: unexpected parameter: '%s'\n\n", argv[idx]);
+			exit(-1);
+		}
+
+		return run_fleet(fleet_filename);
+	}
+
+	/* Compiling needs no camera */
+	if ((idx < argc) && !strcmp(argv[idx], "compile")) {
+		if (argc - idx != 3) {
+			fprintf(stderr, "ERROR: compile takes <script> <file>\n\n");
+			exit(-1);
+		}
+		return run_compile(argv[idx + 1], argv[idx + 2]);
+	}
+
+	if ((watch_count || watch_binary) && !watch_rate) {
+		fprintf(stderr, "ERROR: --count and --binary go with --watch\n");
+		exit(-1);
+	}
+	if (watch_rate && (batch_filename[0] || (idx == argc) || !strcmp(argv[idx], "dump") ||
+			   !strcmp(argv[idx], "flash-update") || !strncmp(argv[idx], "config-", 7) ||
+			   !strcmp(argv[idx], "replay"))) {
+		fprintf(stderr, "ERROR: --watch needs a <command> and can't be combined with -b, dump, flash-update, config-* or replay\n");
 		exit(-1);
 	}
 
-	if (filename[0]) {
+	if ( !filename[0] && !tau_host[0] && !daemon_socket[0]) {
+		fprintf(stderr, "ERROR: must specify means to communication with Tau - either a file name, network address:port or taud socket\n");
+		exit(-1);
+	}
+
+	if (daemon_socket[0]) {
+		dbg("Connecting to taud on %s", daemon_socket);
+		handle = tauOpenFromDaemon(daemon_socket);
+		if (handle < 0) {
+			fprintf(stderr, "ERROR: could not connect to taud on %s\n", daemon_socket);
+			exit(-1);
+		}
+		snprintf(camera_label, sizeof(camera_label), "%s", daemon_socket);
+	} else if (filename[0]) {
 		dbg("Opening tau communication file: %s", filename);
-		handle = tauOpenFromSerial(filename);
+		handle = open_serial(filename);
 		if (handle < 0) {
-			perror("ERROR: could not open tau communication file");
+			if (open_baud == BAUD_AUTO) {
+				fprintf(stderr, "ERROR: could not find a tau on %s\n", filename);
+			} else {
+				perror("ERROR: could not open tau communication file");
+			}
 			exit(-1);
 		}
+		snprintf(camera_label, sizeof(camera_label), "%s", filename);
 	} else if (tau_host[0]) {
-		fprintf(stderr, "TODO ERROR: network communication not implemented\n");
-		exit(-1);
-		handle = tauOpenFromFd(fd);
+		dbg("Connecting to tau at %s port %d", tau_host, tau_port);
+		handle = tauOpenFromNetwork(tau_host, tau_port, 0);
+		if (handle < 0) {
+			fprintf(stderr, "ERROR: could not connect to %s port %d\n", tau_host, tau_port);
+			exit(-1);
+		}
+		snprintf(camera_label, sizeof(camera_label), "%s:%u", tau_host, tau_port);
 	} else {
 		fprintf(stderr, "ERROR: must specify means to communication with Tau - either a file name or network address:port\n");
 		exit(-1);
 	}
 
-	vdbg("Attempting to communication with Tau camera");
-        ret = tauVerifyCommunication(handle);
-	check_results("ERROR: Failed to get a response from Tau camera", ret);
+	if (trace_filename[0] && (tauTraceStart(handle, trace_filename, 0) != CAM_OK)) {
+		fprintf(stderr, "ERROR: could not start the wire trace in %s\n", trace_filename);
+		exit(-1);
+	}
+
+	if (retry_attempts) {
+		struct tauRetryPolicy policy;
+
+		tauGetRetryPolicy(handle, &policy);
+		policy.attempts = retry_attempts;
+		tauSetRetryPolicy(handle, &policy);
+	}
+
+	/* taud verified communication when it opened the camera */
+	if (!daemon_socket[0]) {
+		vdbg("Attempting to communication with Tau camera");
+		ret = tauVerifyCommunication(handle);
+		check_results("ERROR: Failed to get a response from Tau camera", ret);
+	}
+
+	if (max_baud) {
+		if (!filename[0]) {
+			fprintf(stderr, "ERROR: --max-baud needs a serial device, -f\n");
+			exit(-1);
+		}
+		if (tauNegotiateBaudRate(handle, max_baud, 1) < 0) {
+			fprintf(stderr, "ERROR: could not negotiate the baud rate\n");
+			exit(-1);
+		}
+		dbg("Link running at %ld baud", tauBaudRate(handle));
+	}
+
+	if (cache_dir[0] && (tauCacheLoad(handle, cache_dir) != CAM_OK)) {
+		fprintf(stderr, "ERROR: could not load the cache from %s\n", cache_dir);
+		exit(-1);
+	}
+
+	if (batch_filename[0]) {
+		FILE *in = stdin;
+
+		if (idx != argc) {
+			fprintf(stderr, "ERROR: unexpected parameter with -b: '%s'\n\n", argv[idx]);
+			exit(-1);
+		}
+
+		if (strcmp(batch_filename, "-")) {
+			in = fopen(batch_filename, "r");
+			if (!in) {
+				perror("ERROR: could not open script");
+				exit(-1);
+			}
+		}
+
+		ret = run_batch(handle, in);
+
+		if (in != stdin) {
+			fclose(in);
+		}
+		close_camera(handle, camera_label);
+		return ret;
+	}
+
+	if ((idx < argc) && !strcmp(argv[idx], "replay")) {
+		if (argc - idx != 2) {
+			fprintf(stderr, "ERROR: replay takes <file>\n\n");
+			exit(-1);
+		}
+		ret = run_replay(handle, argv[idx + 1]);
+		close_camera(handle, camera_label);
+		return ret;
+	}
+
+	if ((idx < argc) && !strcmp(argv[idx], "dump")) {
+		if (argc - idx != 4) {
+			fprintf(stderr, "ERROR: dump takes <address> <size> <file>\n\n");
+			exit(-1);
+		}
+		ret = run_dump(handle, argv[idx + 1], argv[idx + 2], argv[idx + 3]);
+		close_camera(handle, camera_label);
+		return ret;
+	}
+
+	if ((idx < argc) && !strncmp(argv[idx], "config-", 7)) {
+		if (strcmp(argv[idx], "config-save") && strcmp(argv[idx], "config-diff") &&
+		    strcmp(argv[idx], "config-apply")) {
+			fprintf(stderr, "ERROR: unknown command '%s'\n\n", argv[idx]);
+			exit(-1);
+		}
+		if (argc - idx != 2) {
+			fprintf(stderr, "ERROR: %s takes <file>\n\n", argv[idx]);
+			exit(-1);
+		}
+		ret = run_config(handle, argv[idx], argv[idx + 1]);
+		close_camera(handle, camera_label);
+		return ret;
+	}
+
+	if ((idx < argc) && !strcmp(argv[idx], "flash-update")) {
+		if ((argc - idx < 2) || (argc - idx > 3)) {
+			fprintf(stderr, "ERROR: flash-update takes <image> [<address>]\n\n");
+			exit(-1);
+		}
+		ret = run_flash_update(handle, argv[idx + 1],
+				       argc - idx > 2 ? argv[idx + 2] : NULL);
+		close_camera(handle, camera_label);
+		return ret;
+	}
 
 	if (idx < argc) {
-		ret = asciiHexToBinary(raw_buffer, MAX_TAU_DATA_LEN, argv[idx++]);
-		if (ret != 1) {
-			fprintf(stderr, "\nERROR: <command> must be two ASCII digits\n\n");
+		cmd_code = parse_command(argv[idx++]);
+		if (cmd_code < 0) {
+			fprintf(stderr, "\nERROR: <command> must be two ASCII digits or a command name\n\n");
 			exit(-1);
 		}
 
-		cmd = raw_buffer[0];
+		cmd = cmd_code;
 		dbg("<command>: 0x%X", cmd);
 
 		if (idx < argc) {
@@ -257,12 +1810,18 @@ int main(int argc, char **argv, char **envp)
 			exit(-1);
 		}
 
+		if (watch_rate) {
+			ret = run_watch(handle, cmd, raw_buffer, raw_buffer_count);
+			close_camera(handle, camera_label);
+			return ret;
+		}
+
 		result_count = MAX_TAU_DATA_LEN;
 		ret = tauDoCmd(handle, cmd, raw_buffer, raw_buffer_count, result_buffer, &result_count);
 		check_results("ERROR: command failed", ret);
 	}
 
-	return tauClose(handle);
+	return close_camera(handle, camera_label);
 }
 
 /***************************************************************************
@@ -0,0 +1,603 @@
+/* taud - FLIR Tau camera daemon sharing one serial port among many clients
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ */
+
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+
+/************************************************************************
+ * Constants
+ ************************************************************************/
+
+#define MAX_FILENAME_LENGTH  256
+#define MAX_CLIENTS          64
+#define MAX_PACKET_DATA      512
+#define MAX_PACKET_SIZE      (TAU_HEADER_SIZE + MAX_PACKET_DATA + TAU_CRC_SIZE)
+#define LISTEN_BACKLOG       16
+#define METRICS_INTERVAL     1     /* s between rewrites of the metrics file */
+
+/************************************************************************
+ * Data types
+ ************************************************************************/
+
+/** A connected client and the request packet it is sending */
+struct client {
+	int fd;                        /* -1 when the slot is free */
+	char packet[MAX_PACKET_SIZE];  /* request packet being received */
+	int count;                     /* bytes of the packet received so far */
+	int ready;                     /* complete request waiting for the camera */
+};
+
+/************************************************************************
+ * Private Data
+ ************************************************************************/
+
+static char filename[MAX_FILENAME_LENGTH];
+static char camera_host[MAX_FILENAME_LENGTH];
+static unsigned int camera_port;
+static char socket_path[MAX_FILENAME_LENGTH] = TAU_DAEMON_SOCKET;
+static char tcp_address[MAX_FILENAME_LENGTH] = "127.0.0.1";
+static unsigned int tcp_port;
+static char cache_dir[MAX_FILENAME_LENGTH];
+static char metrics_filename[MAX_FILENAME_LENGTH];
+
+static struct client clients[MAX_CLIENTS];
+static int next_client; /* where the round robin search for work starts */
+
+static time_t metrics_time; /* when the metrics file was last written */
+
+static volatile sig_atomic_t stop_requested;
+
+/************************************************************************
+ * Private Functions
+ ************************************************************************/
+
+/** Displays application help message
+ * \param progname program name
+ */
+static void show_usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-h] [-d <debug level>] -f <device filename> | -n <IP:port> [-s <socket path>] [-p [<IP>:]<TCP port>] [-c <cache dir>] [-m <metrics file>]\n", progname);
+
+	fprintf(stderr, "-h                           Display this help information.\n");
+	fprintf(stderr, "-d <debug level>             Set the debug level.  Default is 0, off.  1 is enabled. 2 is verbose.\n");
+	fprintf(stderr, "-f <device filename>         Serial device the tau camera is connected to\n");
+	fprintf(stderr, "-n <IP:port>                 TCP address of the serial to Ethernet bridge the tau camera is connected to\n");
+	fprintf(stderr, "-s <socket path>             Unix socket to serve clients on.  Default is %s\n", TAU_DAEMON_SOCKET);
+	fprintf(stderr, "-p [<IP>:]<TCP port>         Also serve clients on the specified TCP port, on the local address IP.\n");
+	fprintf(stderr, "                             Default is 127.0.0.1, this host only.  Clients are not authenticated and\n");
+	fprintf(stderr, "                             can send any command, flash writes included, so only listen on another\n");
+	fprintf(stderr, "                             address, or 0.0.0.0 for all, on a network where every host is trusted\n");
+	fprintf(stderr, "-c <cache dir>               Answer repeated reads of settings and constants from a cache, keeping the\n");
+	fprintf(stderr, "                             constants, such as the revision, in cache dir across runs\n");
+	fprintf(stderr, "-m <metrics file>            Keep the statistics of the camera link in metrics file, in the Prometheus\n");
+	fprintf(stderr, "                             text format, rewritten at most every %d s while requests are served\n", METRICS_INTERVAL);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Clients send Tau request packets and receive the camera's response packets.\n");
+	fprintf(stderr, "Requests from different clients are sent to the camera one at a time, in turn.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Examples:\n");
+	fprintf(stderr, "          1) Share the tau connected via serial on /dev/ttyS0, then get its revision\n");
+	fprintf(stderr, "             %s -f /dev/ttyS0 &\n", progname);
+	fprintf(stderr, "             taucmd -s %s 05\n", TAU_DAEMON_SOCKET);
+	fprintf(stderr, "          2) Keep one connection open to the tau behind the bridge at 192.168.1.20 port 4001\n");
+	fprintf(stderr, "             %s -n 192.168.1.20:4001 &\n", progname);
+	fprintf(stderr, "          3) Also serve the tau on /dev/ttyS0 to hosts on the lab network, on port 5471\n");
+	fprintf(stderr, "             %s -f /dev/ttyS0 -p 192.168.1.10:5471 &\n", progname);
+	fprintf(stderr, "\n");
+}
+
+
+/** Parses command line options, setting application global variables
+ * holding user specified preferences.
+ * \param argc number of command line options
+ * \param argv array of options
+ */
+static void parse_options(int argc, char *argv[])
+{
+	int option;
+	int level;
+	char *ptr;
+
+	while ((option=getopt(argc,argv,"hd:f:n:s:p:c:m:")) != EOF) {
+		switch (option){
+		case 'h' :
+			show_usage(argv[0]);
+			exit(0);
+			break;
+		case 'd' :
+			level = atoi(optarg);
+			setDebugLevel(level);
+			vdbg("Program debug level set to %d", level);
+			break;
+		case 'f' :
+			strncpy(filename, optarg, MAX_FILENAME_LENGTH);
+			filename[MAX_FILENAME_LENGTH-1]='\0';
+			break;
+		case 'n' :
+			ptr = strrchr(optarg, ':');
+			if (!ptr || (ptr == optarg) || (ptr - optarg >= MAX_FILENAME_LENGTH)) {
+				show_usage(argv[0]);
+				fprintf(stderr, "\nERROR: -n takes <IP:port>\n\n");
+				exit(-1);
+			}
+			memcpy(camera_host, optarg, ptr - optarg);
+			camera_host[ptr - optarg] = '\0';
+			camera_port = atoi(ptr + 1);
+			if (!camera_port || (camera_port > 65535)) {
+				show_usage(argv[0]);
+				fprintf(stderr, "\nERROR: TCP port has to be a number between 1 and 65535\n\n");
+				exit(-1);
+			}
+			break;
+		case 'c' :
+			strncpy(cache_dir, optarg, MAX_FILENAME_LENGTH);
+			cache_dir[MAX_FILENAME_LENGTH-1]='\0';
+			break;
+		case 'm' :
+			strncpy(metrics_filename, optarg, MAX_FILENAME_LENGTH);
+			metrics_filename[MAX_FILENAME_LENGTH-1]='\0';
+			break;
+		case 's' :
+			strncpy(socket_path, optarg, MAX_FILENAME_LENGTH);
+			socket_path[MAX_FILENAME_LENGTH-1]='\0';
+			break;
+		case 'p' :
+			ptr = strrchr(optarg, ':');
+			if (ptr) {
+				if ((ptr == optarg) || (ptr - optarg >= MAX_FILENAME_LENGTH)) {
+					show_usage(argv[0]);
+					fprintf(stderr, "\nERROR: -p takes [<IP>:]<TCP port>\n\n");
+					exit(-1);
+				}
+				memcpy(tcp_address, optarg, ptr - optarg);
+				tcp_address[ptr - optarg] = '\0';
+				optarg = ptr + 1;
+			}
+			tcp_port = atoi(optarg);
+			if (!tcp_port || (tcp_port > 65535)) {
+				show_usage(argv[0]);
+				fprintf(stderr, "\nERROR: TCP port has to be a number between 1 and 65535\n\n");
+				exit(-1);
+			}
+			break;
+		default :
+			show_usage(argv[0]);
+			fprintf(stderr, "\nERROR: unknown option '%c'\n\n", option);
+			exit(-1);
+		}
+	}
+
+	if (optind != argc) {
+		show_usage(argv[0]);
+		fprintf(stderr, "\nERROR: unexpected parameter '%s'\n\n", argv[optind]);
+		exit(-1);
+	}
+
+	if (!filename[0] == !camera_host[0]) {
+		show_usage(argv[0]);
+		fprintf(stderr, "\nERROR: must specify either the serial device or the network address of the Tau camera\n\n");
+		exit(-1);
+	}
+}
+
+
+static void handle_signal(int sig)
+{
+	stop_requested = 1;
+}
+
+
+/** Creates the unix socket clients connect to
+ * \param path file system path of the socket
+ * \returns the listening socket, or -1 on error
+ */
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "ERROR: socket path too long: %s\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("ERROR: unable to create unix socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* Remove the socket left behind by a previous run */
+	unlink(path);
+
+	if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+	    (listen(fd, LISTEN_BACKLOG) < 0)) {
+		perror("ERROR: unable to listen on unix socket");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/** Creates the TCP socket clients connect to
+ * \param address local IPv4 address to listen on, 0.0.0.0 for all
+ * \param port TCP port to listen on
+ * \returns the listening socket, or -1 on error
+ */
+static int listen_tcp(const char *address, unsigned int port)
+{
+	struct sockaddr_in addr;
+	int fd;
+	int on = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+		fprintf(stderr, "ERROR: %s is not an IPv4 address\n", address);
+		return -1;
+	}
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("ERROR: unable to create TCP socket");
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+	    (listen(fd, LISTEN_BACKLOG) < 0)) {
+		perror("ERROR: unable to listen on TCP port");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/** Accepts a pending connection and gives it a client slot
+ * \param listen_fd socket with the pending connection
+ */
+static void accept_client(int listen_fd)
+{
+	int fd;
+	int i;
+	int on = 1;
+
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0) {
+		if ((errno != EAGAIN) && (errno != EINTR)) {
+			perror("Unable to accept client");
+		}
+		return;
+	}
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd < 0) {
+			break;
+		}
+	}
+
+	if (i == MAX_CLIENTS) {
+		fprintf(stderr, "Too many clients, dropping new connection\n");
+		close(fd);
+		return;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	/* Ignored on unix sockets */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	clients[i].fd = fd;
+	clients[i].count = 0;
+	clients[i].ready = 0;
+	dbg("Client %d connected", i);
+}
+
+
+static void drop_client(struct client *client)
+{
+	dbg("Client %d disconnected", (int)(client - clients));
+	close(client->fd);
+	client->fd = -1;
+	client->count = 0;
+	client->ready = 0;
+}
+
+
+/** Reads as much of the client's next request packet as is available,
+ *  never reading past the end of the packet
+ * \param client client with data to read
+ */
+static void receive_request(struct client *client)
+{
+	uint16_t data_len;
+	int need;
+	ssize_t len;
+
+	if (client->count < TAU_HEADER_SIZE) {
+		need = TAU_HEADER_SIZE;
+	} else {
+		memcpy(&data_len, &client->packet[4], sizeof(data_len));
+		need = TAU_HEADER_SIZE + ntohs(data_len) + TAU_CRC_SIZE;
+	}
+
+	len = recv(client->fd, &client->packet[client->count], need - client->count, 0);
+
+	if (len < 0) {
+		if ((errno != EAGAIN) && (errno != EINTR)) {
+			drop_client(client);
+		}
+		return;
+	}
+
+	if (len == 0) {
+		drop_client(client);
+		return;
+	}
+
+	client->count += len;
+
+	if (client->count == TAU_HEADER_SIZE) {
+		uint16_t crc;
+
+		memcpy(&data_len, &client->packet[4], sizeof(data_len));
+		memcpy(&crc, &client->packet[6], sizeof(crc));
+
+		if ((client->packet[0] != 0x6E) ||
+		    (ntohs(crc) != crcCcitt16(client->packet, 6)) ||
+		    (ntohs(data_len) > MAX_PACKET_DATA)) {
+			fprintf(stderr, "Client %d sent an invalid packet header\n", (int)(client - clients));
+			drop_client(client);
+			return;
+		}
+		/* Read the rest of the packet on the next pass */
+		return;
+	}
+
+	if ((client->count > TAU_HEADER_SIZE) && (client->count == need)) {
+		client->ready = 1;
+	}
+}
+
+
+/** Replaces the metrics file with the current statistics of the camera link
+ * \param handle the handler for the Tau camera
+ */
+static void write_metrics(tauHandler handle)
+{
+	char temp[MAX_FILENAME_LENGTH + 8];
+	FILE *out;
+	int ret;
+
+	/* Written aside and renamed, the metrics agent never sees half a file */
+	snprintf(temp, sizeof(temp), "%s.new", metrics_filename);
+	out = fopen(temp, "w");
+	if (!out) {
+		perror("Unable to create metrics file");
+		return;
+	}
+
+	ret = tauStatsWrite(handle, out, camera_host[0] ? camera_host : filename);
+	if (fclose(out) || ret || rename(temp, metrics_filename)) {
+		perror("Unable to write metrics file");
+		unlink(temp);
+	}
+}
+
+
+/** Forwards the next ready request, taking clients in turn so a busy
+ *  client can't starve the others, and sends back the camera's response
+ * \param handle the handler for the Tau camera
+ */
+static void serve_next_request(tauHandler handle)
+{
+	char response[MAX_PACKET_SIZE];
+	short response_size = MAX_PACKET_SIZE;
+	struct client *client = NULL;
+	tauStatus status;
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		struct client *candidate = &clients[(next_client + i) % MAX_CLIENTS];
+
+		if ((candidate->fd >= 0) && candidate->ready) {
+			client = candidate;
+			break;
+		}
+	}
+
+	if (!client) {
+		return;
+	}
+
+	next_client = (client - clients + 1) % MAX_CLIENTS;
+
+	status = tauExchangePacket(handle, client->packet, client->count, response, &response_size);
+	if (status != CAM_OK) {
+		fprintf(stderr, "Request 0x%02X from client %d failed: %d\n",
+			(unsigned char)client->packet[3], (int)(client - clients), status);
+	}
+
+	client->count = 0;
+	client->ready = 0;
+
+	if (send(client->fd, response, response_size, MSG_NOSIGNAL) != response_size) {
+		drop_client(client);
+	}
+
+	if (metrics_filename[0] && (time(NULL) - metrics_time >= METRICS_INTERVAL)) {
+		write_metrics(handle);
+		metrics_time = time(NULL);
+	}
+}
+
+/***************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(int argc, char **argv, char **envp)
+{
+	struct pollfd fds[2 + MAX_CLIENTS];
+	struct client *owner[2 + MAX_CLIENTS];
+	struct sigaction sa;
+	tauHandler handle;
+	int unix_fd, tcp_fd = -1;
+	int pending, nfds;
+	int ret = 0;
+	int i;
+
+	parse_options(argc, argv);
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		clients[i].fd = -1;
+	}
+
+	if (camera_host[0]) {
+		dbg("Connecting to tau at %s port %d", camera_host, camera_port);
+		handle = tauOpenFromNetwork(camera_host, camera_port, 0);
+		if (handle < 0) {
+			fprintf(stderr, "ERROR: could not connect to %s port %d\n", camera_host, camera_port);
+			exit(-1);
+		}
+	} else {
+		dbg("Opening tau communication file: %s", filename);
+		handle = tauOpenFromSerial(filename);
+		if (handle < 0) {
+			fprintf(stderr, "ERROR: could not open tau communication file %s\n", filename);
+			exit(-1);
+		}
+	}
+
+	if (tauVerifyCommunication(handle)) {
+		fprintf(stderr, "ERROR: Failed to get a response from Tau camera\n");
+		exit(-1);
+	}
+
+	if (cache_dir[0] && (tauCacheLoad(handle, cache_dir) != CAM_OK)) {
+		fprintf(stderr, "ERROR: could not load the cache from %s\n", cache_dir);
+		exit(-1);
+	}
+
+	unix_fd = listen_unix(socket_path);
+	if (unix_fd < 0) {
+		exit(-1);
+	}
+
+	if (tcp_port) {
+		tcp_fd = listen_tcp(tcp_address, tcp_port);
+		if (tcp_fd < 0) {
+			unlink(socket_path);
+			exit(-1);
+		}
+		dbg("Serving clients on %s port %u", tcp_address, tcp_port);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	dbg("Serving %s on %s", filename, socket_path);
+
+	while (!stop_requested) {
+		nfds = 0;
+		pending = 0;
+
+		fds[nfds].fd = unix_fd;
+		fds[nfds].events = POLLIN;
+		owner[nfds++] = NULL;
+
+		if (tcp_fd >= 0) {
+			fds[nfds].fd = tcp_fd;
+			fds[nfds].events = POLLIN;
+			owner[nfds++] = NULL;
+		}
+
+		/* Clients with a request waiting for the camera are not read
+		 * from, the rest of what they send waits in the socket */
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].fd < 0) {
+				continue;
+			}
+			if (clients[i].ready) {
+				pending = 1;
+				continue;
+			}
+			fds[nfds].fd = clients[i].fd;
+			fds[nfds].events = POLLIN;
+			owner[nfds++] = &clients[i];
+		}
+
+		ret = poll(fds, nfds, pending ? 0 : -1);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("ERROR: poll() failed");
+			break;
+		}
+
+		for (i = 0; i < nfds; i++) {
+			if (!fds[i].revents) {
+				continue;
+			}
+			if (owner[i]) {
+				receive_request(owner[i]);
+			} else {
+				accept_client(fds[i].fd);
+			}
+		}
+
+		serve_next_request(handle);
+	}
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0) {
+			close(clients[i].fd);
+		}
+	}
+	if (tcp_fd >= 0) {
+		close(tcp_fd);
+	}
+	close(unix_fd);
+	unlink(socket_path);
+
+	if (cache_dir[0] && (tauCacheSave(handle, cache_dir) != CAM_OK)) {
+		fprintf(stderr, "WARNING: could not save the cache in %s\n", cache_dir);
+	}
+
+	if (metrics_filename[0]) {
+		write_metrics(handle);
+	}
+
+	return tauClose(handle);
+}
@@ -0,0 +1,704 @@
+/* tausim - simulated FLIR Tau camera on a pseudo terminal
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ *
+ * Answers the Tau serial protocol on a pty so libtau, taucmd and taud can be
+ * exercised and timed without a camera, with faults injected on purpose.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+/************************************************************************
+ * Constants
+ ************************************************************************/
+
+#define MAX_FILENAME_LENGTH  256
+#define MAX_REQUEST_DATA     512
+#define MAX_PACKET_SIZE      (TAU_HEADER_SIZE + MAX_REQUEST_DATA + TAU_CRC_SIZE)
+#define DEFAULT_MEMORY_SIZE  (16 * TAU_FLASH_BLOCK_SIZE)
+#define DEFAULT_BAUD_CODE    0x0004 /* 57600, the rate the camera powers up at */
+#define RESET_TIME           500    /* ms the camera doesn't answer after CAMERA_RESET */
+#define BYTE_DELAY_LINE      -1     /* byte delay follows the BAUD_RATE setting */
+
+static const unsigned char revision[8] = { 0x0A, 0x00, 0x02, 0x2B, 0x08, 0x00, 0x00, 0x40 };
+static const unsigned char serial_number[8] = { 0x00, 0x01, 0x23, 0x45, 0x00, 0x06, 0x78, 0x9A };
+static const char part_number[32] = "46640013H-SPNLX";
+
+/* BAUD_RATE codes from the Tau 2 IDD and the rates they select */
+static const struct {
+	unsigned short code;
+	long rate;
+	speed_t speed;
+} line_rates[] = {
+	{ 0x0001, 9600,   B9600 },
+	{ 0x0002, 19200,  B19200 },
+	{ 0x0004, 57600,  B57600 },
+	{ 0x0005, 115200, B115200 },
+	{ 0x0006, 460800, B460800 },
+	{ 0x0007, 921600, B921600 },
+};
+
+#define LINE_RATE_COUNT ((int)(sizeof(line_rates) / sizeof(line_rates[0])))
+
+/************************************************************************
+ * Data types
+ ************************************************************************/
+
+/** What the simulated camera remembers */
+struct camera {
+	char params[256][TAU_PARAM_MAX_SIZE];   /* value of each setting */
+	char defaults[256][TAU_PARAM_MAX_SIZE]; /* values SET_DEFAULTS saved */
+	unsigned short baud_code;               /* BAUD_RATE setting */
+	unsigned char *memory;                  /* flash, starting at address 0 */
+	unsigned long memory_size;
+	struct timespec ready_at;               /* silent until, after CAMERA_RESET */
+};
+
+/** Faults injected, each one counted once per response */
+struct faults {
+	unsigned int requests;  /* requests answered or ignored */
+	unsigned int dropped;   /* responses missing a byte */
+	unsigned int corrupted; /* responses with a flipped bit */
+	unsigned int busy;      /* requests answered with CAM_NOT_READY */
+	unsigned int bad;       /* requests that failed their crc */
+	unsigned int garbled;   /* bytes sent at a rate other than the camera's */
+};
+
+/************************************************************************
+ * Private Data
+ ************************************************************************/
+
+static char link_path[MAX_FILENAME_LENGTH];
+static unsigned long memory_size = DEFAULT_MEMORY_SIZE;
+static long byte_delay;          /* us per response byte, or BYTE_DELAY_LINE */
+static long latency;             /* ms to process a command */
+static unsigned int drop_rate;   /* 1 in drop_rate responses loses a byte, 0 never */
+static unsigned int corrupt_rate;
+static unsigned int busy_rate;
+static unsigned int seed = 1;
+static unsigned short power_up_code = DEFAULT_BAUD_CODE; /* BAUD_RATE after a reset */
+static int check_rate;           /* garble what is sent at the wrong rate */
+
+static struct camera camera;
+static struct faults faults;
+
+static volatile sig_atomic_t stop_requested;
+
+static struct option long_options[] = {
+	{ "byte-delay", required_argument, NULL, 'B' },
+	{ "latency", required_argument, NULL, 'L' },
+	{ "drop", required_argument, NULL, 'D' },
+	{ "corrupt", required_argument, NULL, 'X' },
+	{ "busy", required_argument, NULL, 'N' },
+	{ "seed", required_argument, NULL, 'S' },
+	{ "baud", required_argument, NULL, 'R' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/************************************************************************
+ * Private Functions
+ ************************************************************************/
+
+/** Displays application help message
+ * \param progname program name
+ */
+static void show_usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-h] [-d <debug level>] [-l <link path>] [-m <memory size>] [--byte-delay <us>|line]\n", progname);
+	fprintf(stderr, "       [--latency <ms>] [--drop <n>] [--corrupt <n>] [--busy <n>] [--seed <seed>] [--baud <rate>]\n");
+
+	fprintf(stderr, "-h                           Display this help information.\n");
+	fprintf(stderr, "-d <debug level>             Set the debug level.  Default is 0, off.  1 is enabled. 2 is verbose.\n");
+	fprintf(stderr, "-l <link path>               Also make the pseudo terminal available as link path\n");
+	fprintf(stderr, "-m <memory size>             Bytes of flash memory.  Default is 0x%X\n", DEFAULT_MEMORY_SIZE);
+	fprintf(stderr, "--byte-delay <us>|line       Time each response byte takes, or line for the time at the BAUD_RATE setting\n");
+	fprintf(stderr, "--latency <ms>               Time the camera takes to process each command\n");
+	fprintf(stderr, "--drop <n>                   Leave a byte out of 1 in n responses\n");
+	fprintf(stderr, "--corrupt <n>                Flip a bit in 1 in n responses\n");
+	fprintf(stderr, "--busy <n>                   Answer 1 in n requests with CAM_NOT_READY\n");
+	fprintf(stderr, "--seed <seed>                Seed of the fault injection.  Default is 1, the same faults every run\n");
+	fprintf(stderr, "--baud <rate>                Power up at rate instead of 57600, and turn what the terminal sends at\n");
+	fprintf(stderr, "                             any rate but the BAUD_RATE setting into noise, as a real UART would\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "The name of the pseudo terminal is printed on standard output.\n");
+	fprintf(stderr, "A summary of the requests and the faults injected is printed on exit.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Examples:\n");
+	fprintf(stderr, "          1) Simulate a camera, then get its revision\n");
+	fprintf(stderr, "             %s -l /tmp/tau &\n", progname);
+	fprintf(stderr, "             taucmd -f /tmp/tau 05\n");
+	fprintf(stderr, "          2) Simulate a camera on a noisy 57600 baud line\n");
+	fprintf(stderr, "             %s -l /tmp/tau --byte-delay line --corrupt 50 &\n", progname);
+	fprintf(stderr, "          3) Simulate a camera someone left at 921600 baud\n");
+	fprintf(stderr, "             %s -l /tmp/tau --baud 921600 &\n", progname);
+	fprintf(stderr, "\n");
+}
+
+
+/** Parses a count for a fault option, exiting on error
+ * \param progname program name
+ * \param option name of the option
+ * \param arg option argument
+ * \returns the count
+ */
+static long parse_count(const char *progname, const char *option, const char *arg)
+{
+	char *end;
+	long value;
+
+	value = strtol(arg, &end, 0);
+	if ((end == arg) || *end || (value < 0)) {
+		show_usage(progname);
+		fprintf(stderr, "\nERROR: %s takes a number, not '%s'\n\n", option, arg);
+		exit(-1);
+	}
+	return value;
+}
+
+
+/** Parses command line options, setting application global variables
+ * holding user specified preferences.
+ * \param argc number of command line options
+ * \param argv array of options
+ */
+static void parse_options(int argc, char *argv[])
+{
+	int option;
+	int level;
+	long rate;
+	int i;
+
+	while ((option=getopt_long(argc,argv,"hd:l:m:",long_options,NULL)) != EOF) {
+		switch (option){
+		case 'h' :
+			show_usage(argv[0]);
+			exit(0);
+			break;
+		case 'd' :
+			level = atoi(optarg);
+			setDebugLevel(level);
+			vdbg("Program debug level set to %d", level);
+			break;
+		case 'l' :
+			strncpy(link_path, optarg, MAX_FILENAME_LENGTH);
+			link_path[MAX_FILENAME_LENGTH-1]='\0';
+			break;
+		case 'm' :
+			memory_size = parse_count(argv[0], "-m", optarg);
+			if (!memory_size || (memory_size % TAU_FLASH_BLOCK_SIZE)) {
+				show_usage(argv[0]);
+				fprintf(stderr, "\nERROR: memory size has to be a multiple of 0x%X\n\n", TAU_FLASH_BLOCK_SIZE);
+				exit(-1);
+			}
+			break;
+		case 'B' :
+			byte_delay = strcmp(optarg, "line") ? parse_count(argv[0], "--byte-delay", optarg) : BYTE_DELAY_LINE;
+			break;
+		case 'L' :
+			latency = parse_count(argv[0], "--latency", optarg);
+			break;
+		case 'D' :
+			drop_rate = parse_count(argv[0], "--drop", optarg);
+			break;
+		case 'X' :
+			corrupt_rate = parse_count(argv[0], "--corrupt", optarg);
+			break;
+		case 'N' :
+			busy_rate = parse_count(argv[0], "--busy", optarg);
+			break;
+		case 'S' :
+			seed = parse_count(argv[0], "--seed", optarg);
+			break;
+		case 'R' :
+			rate = parse_count(argv[0], "--baud", optarg);
+			for (i = 0; (i < LINE_RATE_COUNT) && (line_rates[i].rate != rate); i++);
+			if (i == LINE_RATE_COUNT) {
+				show_usage(argv[0]);
+				fprintf(stderr, "\nERROR: %ld is not a rate the camera supports\n\n", rate);
+				exit(-1);
+			}
+			power_up_code = line_rates[i].code;
+			check_rate = 1;
+			break;
+		default :
+			show_usage(argv[0]);
+			fprintf(stderr, "\nERROR: unknown option '%c'\n\n", option);
+			exit(-1);
+		}
+	}
+
+	if (optind != argc) {
+		show_usage(argv[0]);
+		fprintf(stderr, "\nERROR: unexpected parameter '%s'\n\n", argv[optind]);
+		exit(-1);
+	}
+}
+
+
+static void handle_signal(int sig)
+{
+	stop_requested = 1;
+}
+
+
+/** Creates the pseudo terminal clients open as the camera's serial port
+ * \param name holder for the file name of the terminal
+ * \param slave holder for the terminal side, kept open so the simulator
+ *        keeps running while no client has it open
+ * \returns the master side, or -1 on error
+ */
+static int open_pty(char *name, int *slave)
+{
+	struct termios tio;
+	int fd;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((fd < 0) || grantpt(fd) || unlockpt(fd) || ptsname_r(fd, name, MAX_FILENAME_LENGTH)) {
+		perror("ERROR: unable to create pseudo terminal");
+		return -1;
+	}
+
+	*slave = open(name, O_RDWR | O_NOCTTY);
+	if (*slave < 0) {
+		perror("ERROR: unable to open pseudo terminal");
+		close(fd);
+		return -1;
+	}
+
+	/* The same raw line a client sets up, so nothing is echoed back
+	 * before the client opens the terminal */
+	tcgetattr(*slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(*slave, TCSANOW, &tio);
+
+	return fd;
+}
+
+
+/** Tells whether the client sends at the rate the camera expects.  The
+ *  terminal's rate is the one the client last set on its side
+ * \param slave terminal side of the pseudo terminal
+ * \returns nonzero if the rates agree, or rates are not checked
+ */
+static int rate_matches(int slave)
+{
+	struct termios tio;
+	int i;
+
+	if (!check_rate || tcgetattr(slave, &tio)) {
+		return 1;
+	}
+
+	for (i = 0; i < LINE_RATE_COUNT; i++) {
+		if (line_rates[i].code == camera.baud_code) {
+			return cfgetospeed(&tio) == line_rates[i].speed;
+		}
+	}
+	return 1;
+}
+
+
+/** Decides whether a fault happens this time
+ * \param rate 1 in rate times, never if zero
+ * \returns nonzero if the fault happens
+ */
+static int inject(unsigned int rate)
+{
+	return rate && !(rand_r(&seed) % rate);
+}
+
+
+/** Returns the time a response byte takes
+ * \returns microseconds
+ */
+static long response_byte_time(void)
+{
+	int i;
+
+	if (byte_delay != BYTE_DELAY_LINE) {
+		return byte_delay;
+	}
+
+	/* Start bit, eight data bits and a stop bit */
+	for (i = 0; i < LINE_RATE_COUNT; i++) {
+		if (line_rates[i].code == camera.baud_code) {
+			return 10 * 1000000L / line_rates[i].rate;
+		}
+	}
+	return 0;
+}
+
+
+/** Sends a response packet, injecting the faults that are due
+ * \param fd master side of the terminal
+ * \param cmd command the response is for
+ * \param status camera status
+ * \param data response data
+ * \param dataSize bytes of response data
+ */
+static void send_response(int fd, tauCmd cmd, tauStatus status, char *data, short dataSize)
+{
+	char packet[MAX_PACKET_SIZE];
+	short count = sizeof(packet);
+	struct timespec pause;
+	long us;
+	int i;
+
+	tauBuildPacket(cmd, status, packet, &count, data, dataSize);
+
+	if (inject(corrupt_rate)) {
+		i = rand_r(&seed) % count;
+		packet[i] ^= 1 << (rand_r(&seed) % 8);
+		faults.corrupted++;
+		dbg("Flipped a bit of byte %d of the response to 0x%02X", i, (unsigned char)cmd);
+	}
+
+	if (inject(drop_rate)) {
+		i = rand_r(&seed) % count;
+		memmove(&packet[i], &packet[i + 1], count - i - 1);
+		count--;
+		faults.dropped++;
+		dbg("Dropped byte %d of the response to 0x%02X", i, (unsigned char)cmd);
+	}
+
+	us = response_byte_time();
+	if (!us) {
+		if (write(fd, packet, count) != count) {
+			perror("Unable to send response");
+		}
+		return;
+	}
+
+	pause.tv_sec = us / 1000000;
+	pause.tv_nsec = (us % 1000000) * 1000;
+	for (i = 0; i < count; i++) {
+		if (write(fd, &packet[i], 1) != 1) {
+			perror("Unable to send response");
+			return;
+		}
+		nanosleep(&pause, NULL);
+	}
+}
+
+
+/** Checks an address range of the flash
+ * \param address first byte
+ * \param size number of bytes
+ * \returns nonzero if the range is in the flash
+ */
+static int in_memory(unsigned long address, unsigned long size)
+{
+	return (address <= camera.memory_size) && (size <= camera.memory_size - address);
+}
+
+
+/** Acts on a request the way the camera does
+ * \param cmd the command
+ * \param input request data
+ * \param inputSize bytes of request data
+ * \param output holder for the response data, MAX_REQUEST_DATA bytes
+ * \param outputCount holder for the bytes of response data
+ * \returns the camera status
+ */
+static tauStatus run_command(tauCmd cmd, char *input, short inputSize, char *output, short *outputCount)
+{
+	const struct tauCommandInfo *info = tauCommandInfo(cmd);
+	uint32_t address, size;
+	uint16_t code, count;
+	int i;
+
+	*outputCount = 0;
+
+	if (!info) {
+		return CAM_UNDEFINED_FUNCTION_ERROR;
+	}
+
+	if ((inputSize < info->request_min) || (inputSize > info->request_max) ||
+	    ((inputSize - info->request_min) % info->request_step)) {
+		return CAM_BYTE_COUNT_ERROR;
+	}
+
+	if (info->flags & TAU_CMD_SETTING) {
+		/* Set with data, which the camera echoes, read without */
+		if (inputSize) {
+			memcpy(camera.params[cmd], input, inputSize);
+		}
+		*outputCount = info->response_max;
+		memcpy(output, camera.params[cmd], *outputCount);
+		return CAM_OK;
+	}
+
+	switch (cmd) {
+	case NO_OP :
+	case DO_FFC :
+		break;
+
+	case SET_DEFAULTS :
+		memcpy(camera.defaults, camera.params, sizeof(camera.defaults));
+		break;
+
+	case CAMERA_RESET :
+		memcpy(camera.params, camera.defaults, sizeof(camera.params));
+		camera.baud_code = power_up_code;
+		tauDeadlineSet(&camera.ready_at, RESET_TIME + latency);
+		break;
+
+	case RESET_FACTORY_DEFAULTS :
+		memset(camera.params, 0, sizeof(camera.params));
+		memset(camera.defaults, 0, sizeof(camera.defaults));
+		break;
+
+	case SERIAL_NUMBER :
+		*outputCount = sizeof(serial_number);
+		memcpy(output, serial_number, *outputCount);
+		break;
+
+	case GET_REVISION :
+		*outputCount = sizeof(revision);
+		memcpy(output, revision, *outputCount);
+		break;
+
+	case CAMERA_PART :
+		*outputCount = sizeof(part_number);
+		memcpy(output, part_number, *outputCount);
+		break;
+
+	case BAUD_RATE :
+		if (inputSize) {
+			memcpy(&code, input, sizeof(code));
+			for (i = 0; i < LINE_RATE_COUNT; i++) {
+				if (line_rates[i].code == ntohs(code)) {
+					break;
+				}
+			}
+			if (i == LINE_RATE_COUNT) {
+				return CAM_RANGE_ERROR;
+			}
+			camera.baud_code = ntohs(code);
+		}
+		code = htons(camera.baud_code);
+		memcpy(output, &code, sizeof(code));
+		*outputCount = sizeof(code);
+		break;
+
+	case READ_MEMORY :
+		memcpy(&address, input, sizeof(address));
+		memcpy(&count, &input[4], sizeof(count));
+		address = ntohl(address);
+		count = ntohs(count);
+		if ((count > info->response_max) || !in_memory(address, count)) {
+			return CAM_RANGE_ERROR;
+		}
+		memcpy(output, &camera.memory[address], count);
+		*outputCount = count;
+		break;
+
+	case WRITE_MEMORY :
+		memcpy(&address, input, sizeof(address));
+		address = ntohl(address);
+		count = inputSize - sizeof(address);
+		if (!in_memory(address, count)) {
+			return CAM_RANGE_ERROR;
+		}
+		/* Programming flash only clears bits */
+		for (i = 0; i < count; i++) {
+			camera.memory[address + i] &= input[sizeof(address) + i];
+		}
+		break;
+
+	case ERASE_MEMORY_BLOCK :
+		memcpy(&count, input, sizeof(count));
+		address = ntohs(count) * (uint32_t)TAU_FLASH_BLOCK_SIZE;
+		if (!in_memory(address, TAU_FLASH_BLOCK_SIZE)) {
+			return CAM_RANGE_ERROR;
+		}
+		memset(&camera.memory[address], 0xFF, TAU_FLASH_BLOCK_SIZE);
+		break;
+
+	case GET_NV_MEMORY_SIZE :
+	case GET_MEMORY_ADDRESS :
+		/* Every region is the whole flash: where it starts and its size */
+		memset(output, 0, sizeof(size));
+		size = htonl(camera.memory_size);
+		memcpy(&output[4], &size, sizeof(size));
+		*outputCount = 8;
+		break;
+
+	default :
+		/* Sensors read as zero, anything else echoes its data */
+		*outputCount = inputSize ? inputSize : info->response_max;
+		if (inputSize) {
+			memcpy(output, input, inputSize);
+		} else {
+			memset(output, 0, *outputCount);
+		}
+		break;
+	}
+
+	return CAM_OK;
+}
+
+
+/** Answers a complete request packet
+ * \param fd master side of the terminal
+ * \param frame parser holding the request
+ */
+static void serve_request(int fd, struct tauFrame *frame)
+{
+	char output[MAX_REQUEST_DATA];
+	short output_count = 0;
+	tauCmd cmd = frame->header[3];
+	struct timespec pause;
+	tauStatus status;
+	uint16_t crc;
+
+	faults.requests++;
+
+	if (tauDeadlineRemaining(&camera.ready_at)) {
+		dbg("Resetting, request 0x%02X ignored", (unsigned char)cmd);
+		return;
+	}
+
+	memcpy(&crc, frame->trailer, sizeof(crc));
+	if (ntohs(crc) != frame->crc) {
+		faults.bad++;
+		status = CAM_CHECKSUM_ERROR;
+	} else if (frame->data_len > frame->capacity) {
+		status = CAM_BYTE_COUNT_ERROR;
+	} else if (inject(busy_rate)) {
+		faults.busy++;
+		status = CAM_NOT_READY;
+	} else {
+		status = run_command(cmd, frame->data, frame->data_len, output, &output_count);
+	}
+
+	dbg("Request 0x%02X with %d bytes, status %d, %d bytes back", (unsigned char)cmd,
+	    frame->data_len, status, output_count);
+
+	if (latency) {
+		pause.tv_sec = latency / 1000;
+		pause.tv_nsec = (latency % 1000) * 1000000;
+		nanosleep(&pause, NULL);
+	}
+
+	send_response(fd, cmd, status, output, output_count);
+}
+
+/***************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(int argc, char **argv, char **envp)
+{
+	unsigned char buffer[MAX_PACKET_SIZE];
+	char data[MAX_REQUEST_DATA];
+	char name[MAX_FILENAME_LENGTH];
+	struct tauFrame frame;
+	struct sigaction sa;
+	struct pollfd pfd;
+	int fd, slave;
+	ssize_t len;
+	unsigned int used;
+	int ret;
+
+	parse_options(argc, argv);
+
+	camera.baud_code = power_up_code;
+	camera.memory_size = memory_size;
+	camera.memory = malloc(memory_size);
+	if (!camera.memory) {
+		fprintf(stderr, "ERROR: unable to allocate 0x%lX bytes of memory\n", memory_size);
+		exit(-1);
+	}
+	memset(camera.memory, 0xFF, memory_size);
+
+	fd = open_pty(name, &slave);
+	if (fd < 0) {
+		exit(-1);
+	}
+
+	if (link_path[0]) {
+		unlink(link_path);
+		if (symlink(name, link_path)) {
+			perror("ERROR: unable to link the pseudo terminal");
+			exit(-1);
+		}
+	}
+
+	printf("%s\n", name);
+	fflush(stdout);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	tauFrameInit(&frame, data, sizeof(data));
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (!stop_requested) {
+		ret = poll(&pfd, 1, -1);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("ERROR: poll() failed");
+			break;
+		}
+
+		len = read(fd, buffer, sizeof(buffer));
+		if (len < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) {
+				continue;
+			}
+			perror("ERROR: unable to read pseudo terminal");
+			break;
+		}
+
+		/* Sampled at the wrong rate every byte comes out as noise */
+		if (!rate_matches(slave)) {
+			for (used = 0; used < (unsigned int)len; used++) {
+				buffer[used] = rand_r(&seed);
+			}
+			faults.garbled += len;
+		}
+
+		for (used = 0; used < (unsigned int)len; ) {
+			used += tauFrameParse(&frame, &buffer[used], len - used);
+			if (frame.state == TAU_FRAME_DONE) {
+				serve_request(fd, &frame);
+				tauFrameInit(&frame, data, sizeof(data));
+			}
+		}
+	}
+
+	fprintf(stderr, "%u requests, %u failed their crc, %u busy, %u responses corrupted, %u dropped a byte, %u bytes at the wrong rate\n",
+		faults.requests, faults.bad, faults.busy, faults.corrupted, faults.dropped, faults.garbled);
+
+	if (link_path[0]) {
+		unlink(link_path);
+	}
+	close(slave);
+	close(fd);
+	free(camera.memory);
+
+	return 0;
+}
@@ -0,0 +1,379 @@
+/* tautrace - prints a libtau wire trace as decoded frames
+ * Copyright 2010 RidgeRun LLC
+ * Covered by BSD 2-Clause License
+ *
+ * Reads a capture written by tauTraceStart() (taucmd --trace) and follows
+ * the bytes each way through a packet parser, printing every request and
+ * response along with what libtau made of them.
+ */
+
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "tau.h"
+#include "tau-utils.h"
+#include "tau-private.h"
+
+/************************************************************************
+ * Constants
+ ************************************************************************/
+
+#define MAX_FRAME_DATA 4096 /* packet data kept for printing */
+#define DATA_SHOWN     16   /* bytes of packet data printed without -x */
+#define BYTES_PER_ROW  16
+
+/* Names of the status codes in enum tauStatus */
+static const struct {
+	tauStatus status;
+	const char *name;
+} status_names[] = {
+	{ CAM_OK, "CAM_OK" },
+	{ CAM_BUSY, "CAM_BUSY" },
+	{ CAM_NOT_READY, "CAM_NOT_READY" },
+	{ CAM_RANGE_ERROR, "CAM_RANGE_ERROR" },
+	{ CAM_CHECKSUM_ERROR, "CAM_CHECKSUM_ERROR" },
+	{ CAM_UNDEFINED_PROCESS_ERROR, "CAM_UNDEFINED_PROCESS_ERROR" },
+	{ CAM_UNDEFINED_FUNCTION_ERROR, "CAM_UNDEFINED_FUNCTION_ERROR" },
+	{ CAM_TIMEOUT_ERROR, "CAM_TIMEOUT_ERROR" },
+	{ CAM_BYTE_COUNT_ERROR, "CAM_BYTE_COUNT_ERROR" },
+	{ CAM_FEATURE_NOT_ENABLED, "CAM_FEATURE_NOT_ENABLED" },
+	{ CAM_COMMUNICATION_ERROR, "CAM_COMMUNICATION_ERROR" },
+};
+
+#define STATUS_NAME_COUNT ((int)(sizeof(status_names) / sizeof(status_names[0])))
+
+/************************************************************************
+ * Data types
+ ************************************************************************/
+
+/** Packets going one way */
+struct direction {
+	const char *name;
+	struct tauFrame frame;
+	char data[MAX_FRAME_DATA];
+	unsigned int skipped; /* frame.skipped already reported */
+};
+
+/************************************************************************
+ * Private Data
+ ************************************************************************/
+
+static char trace_filename[256];
+static int show_raw;
+
+/************************************************************************
+ * Private Functions
+ ************************************************************************/
+
+/** Displays application help message
+ * \param progname program name
+ */
+static void show_usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-h] [-d <debug level>] [-x] <capture file>\n", progname);
+
+	fprintf(stderr, "-h                           Display this help information.\n");
+	fprintf(stderr, "-d <debug level>             Set the debug level.  Default is 0, off.  1 is enabled. 2 is verbose.\n");
+	fprintf(stderr, "-x                           Also print every chunk of data as it was read or written, and\n");
+	fprintf(stderr, "                             each packet libtau's parser completed\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Each line starts with the seconds since tracing started.  tx lines are requests,\n");
+	fprintf(stderr, "rx lines responses, and -- lines what libtau made of them.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Examples:\n");
+	fprintf(stderr, "          1) Trace a batch of commands, then look at the exchanges\n");
+	fprintf(stderr, "             taucmd -f /dev/ttyS0 --trace tau.trace -b script.txt\n");
+	fprintf(stderr, "             %s tau.trace\n", progname);
+	fprintf(stderr, "\n");
+}
+
+
+/** Parses command line options, setting application global variables
+ * holding user specified preferences.
+ * \param argc number of command line options
+ * \param argv array of options
+ */
+static void parse_options(int argc, char *argv[])
+{
+	int option;
+	int level;
+
+	while ((option=getopt(argc,argv,"hd:x")) != EOF) {
+		switch (option){
+		case 'h' :
+			show_usage(argv[0]);
+			exit(0);
+			break;
+		case 'd' :
+			level = atoi(optarg);
+			setDebugLevel(level);
+			vdbg("Program debug level set to %d", level);
+			break;
+		case 'x' :
+			show_raw = 1;
+			break;
+		default :
+			show_usage(argv[0]);
+			fprintf(stderr, "\nERROR: unknown option '%c'\n\n", option);
+			exit(-1);
+		}
+	}
+
+	if (argc - optind != 1) {
+		show_usage(argv[0]);
+		fprintf(stderr, "\nERROR: a capture file is required\n\n");
+		exit(-1);
+	}
+	strncpy(trace_filename, argv[optind], sizeof(trace_filename));
+	trace_filename[sizeof(trace_filename)-1]='\0';
+}
+
+
+/** Returns the name of a command
+ * \param cmd the command
+ * \param buffer holder for the hex code of unknown commands, 8 bytes
+ * \returns the name
+ */
+static const char *command_name(unsigned char cmd, char *buffer)
+{
+	const struct tauCommandInfo *info = tauCommandInfo(cmd);
+
+	if (info) {
+		return info->name;
+	}
+	snprintf(buffer, 8, "0x%02X", cmd);
+	return buffer;
+}
+
+
+/** Returns the name of a status code
+ * \param status the status
+ * \param buffer holder for the number of unknown codes, 8 bytes
+ * \returns the name
+ */
+static const char *status_name(unsigned char status, char *buffer)
+{
+	int i;
+
+	for (i = 0; i < STATUS_NAME_COUNT; i++) {
+		if (status_names[i].status == status) {
+			return status_names[i].name;
+		}
+	}
+	snprintf(buffer, 8, "%u", status);
+	return buffer;
+}
+
+
+/** Prints bytes in hex, a row at a time, below a record line
+ * \param bytes the bytes
+ * \param count number of bytes
+ */
+static void print_bytes(const unsigned char *bytes, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		printf("%s%02X", (i % BYTES_PER_ROW) ? " " : "                   ", bytes[i]);
+		if ((i % BYTES_PER_ROW == BYTES_PER_ROW - 1) || (i + 1 == count)) {
+			printf("\n");
+		}
+	}
+}
+
+
+/** Prints a complete packet
+ * \param time seconds since tracing started
+ * \param dir the way the packet went
+ */
+static void print_frame(double time, struct direction *dir)
+{
+	struct tauFrame *frame = &dir->frame;
+	char cmd_buffer[8], status_buffer[8];
+	unsigned int i, shown;
+	uint16_t crc;
+
+	printf("%11.6f %s %s", time, dir->name, command_name(frame->header[3], cmd_buffer));
+	if (dir->name[0] == 'r') {
+		printf(" %s", status_name(frame->header[1], status_buffer));
+	}
+
+	memcpy(&crc, frame->trailer, sizeof(crc));
+	if (ntohs(crc) != frame->crc) {
+		printf(" BAD CRC");
+	}
+
+	shown = frame->data_len < frame->capacity ? frame->data_len : frame->capacity;
+	if (!show_raw && (shown > DATA_SHOWN)) {
+		shown = DATA_SHOWN;
+	}
+	if (frame->data_len) {
+		printf(" [%u]", frame->data_len);
+	}
+	for (i = 0; i < shown; i++) {
+		printf(" %02X", (unsigned char)dir->data[i]);
+	}
+	printf("%s\n", shown < frame->data_len ? " ..." : "");
+}
+
+
+/** Feeds a chunk of data to the parser of its direction, printing every
+ *  packet it completes
+ * \param time seconds since tracing started
+ * \param dir the way the data went
+ * \param bytes the data
+ * \param count number of bytes
+ */
+static void follow(double time, struct direction *dir, const unsigned char *bytes,
+		   unsigned int count)
+{
+	unsigned int used = 0;
+
+	while (used < count) {
+		used += tauFrameParse(&dir->frame, &bytes[used], count - used);
+
+		if (dir->frame.skipped != dir->skipped) {
+			printf("%11.6f %s %u bytes of noise\n", time, dir->name,
+			       dir->frame.skipped - dir->skipped);
+			dir->skipped = dir->frame.skipped;
+		}
+
+		if (dir->frame.state == TAU_FRAME_DONE) {
+			print_frame(time, dir);
+			tauFrameInit(&dir->frame, dir->data, sizeof(dir->data));
+			dir->skipped = 0;
+		}
+	}
+}
+
+
+/** Prints an event libtau recorded
+ * \param time seconds since tracing started
+ * \param record the record header
+ * \param data the record data
+ */
+static void print_event(double time, const struct tauTraceRecord *record,
+			const unsigned char *data)
+{
+	char cmd_buffer[8], status_buffer[8];
+	uint32_t values[2];
+
+	switch (record->type) {
+	case TAU_TRACE_FRAME :
+		if (show_raw && (record->length >= 1)) {
+			printf("%11.6f -- packet complete, crc %s\n", time, data[0] ? "good" : "bad");
+		}
+		break;
+	case TAU_TRACE_RESYNC :
+		if (record->length >= sizeof(values)) {
+			memcpy(values, data, sizeof(values));
+			printf("%11.6f -- skipped %u noise bytes, %u bad headers\n", time,
+			       values[0], values[1]);
+		}
+		break;
+	case TAU_TRACE_RESULT :
+		if (record->length >= 2) {
+			printf("%11.6f -- %s %s\n", time, command_name(data[0], cmd_buffer),
+			       status_name(data[1], status_buffer));
+		}
+		break;
+	case TAU_TRACE_DROPPED :
+		if (record->length >= sizeof(values[0])) {
+			memcpy(values, data, sizeof(values[0]));
+			printf("%11.6f -- %u records lost, the trace ring was full\n", time, values[0]);
+		}
+		break;
+	default :
+		printf("%11.6f -- unknown record type %u, %u bytes\n", time, record->type,
+		       record->length);
+		break;
+	}
+}
+
+/***************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(int argc, char **argv, char **envp)
+{
+	static struct direction tx = { .name = "tx" }, rx = { .name = "rx" };
+	struct tauTraceFileHeader header;
+	struct tauTraceRecord record;
+	unsigned char data[0x10000];
+	char started[32];
+	struct tm tm;
+	time_t start;
+	double time;
+	FILE *in;
+
+	parse_options(argc, argv);
+
+	in = fopen(trace_filename, "r");
+	if (!in) {
+		perror("ERROR: could not open capture file");
+		exit(-1);
+	}
+
+	if (fread(&header, sizeof(header), 1, in) != 1) {
+		fprintf(stderr, "ERROR: %s is too short to be a capture\n", trace_filename);
+		exit(-1);
+	}
+	if (header.magic != TAU_TRACE_MAGIC) {
+		fprintf(stderr, "ERROR: %s is not a capture, or was written with the other byte order\n",
+			trace_filename);
+		exit(-1);
+	}
+	if (header.version != TAU_TRACE_VERSION) {
+		fprintf(stderr, "ERROR: %s is a version %u capture, only version %u is known\n",
+			trace_filename, header.version, TAU_TRACE_VERSION);
+		exit(-1);
+	}
+
+	start = header.start_sec;
+	localtime_r(&start, &tm);
+	strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("Trace started %s.%06u\n", started, header.start_nsec / 1000);
+
+	tauFrameInit(&tx.frame, tx.data, sizeof(tx.data));
+	tauFrameInit(&rx.frame, rx.data, sizeof(rx.data));
+
+	while (fread(&record, sizeof(record), 1, in) == 1) {
+		if (fread(data, 1, record.length, in) != record.length) {
+			fprintf(stderr, "WARNING: %s ends in the middle of a record\n", trace_filename);
+			break;
+		}
+
+		time = record.sec + record.nsec / 1e9;
+
+		if ((record.type == TAU_TRACE_TX) || (record.type == TAU_TRACE_RX)) {
+			if (show_raw) {
+				printf("%11.6f %s %u bytes\n", time,
+				       record.type == TAU_TRACE_TX ? "write" : "read", record.length);
+				print_bytes(data, record.length);
+			}
+			follow(time, record.type == TAU_TRACE_TX ? &tx : &rx, data, record.length);
+		} else {
+			/* libtau starts every exchange with a fresh parser */
+			if ((record.type == TAU_TRACE_RESULT) && (rx.frame.state != TAU_FRAME_SYNC)) {
+				printf("%11.6f rx partial packet abandoned\n", time);
+				tauFrameInit(&rx.frame, rx.data, sizeof(rx.data));
+				rx.skipped = 0;
+			}
+			print_event(time, &record, data);
+		}
+	}
+
+	if (ferror(in)) {
+		perror("ERROR: could not read capture file");
+		fclose(in);
+		exit(-1);
+	}
+	fclose(in);
+
+	return 0;
+}